@@ -13,6 +13,75 @@ template<size_t SIZE> struct gc_obj_t : public picogc::gc_object {
   std::string s_[SIZE]; // ditto
 };
 
+// having a GC member, and a buffer not initialized by the constructor
+template<size_t SIZE> struct gc_traced_obj_t : public picogc::gc_object {
+  picogc::member<gc_traced_obj_t> next_;
+  std::string s_[SIZE];
+  char buf_[SIZE * 64];
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(next_);
+  }
+};
+
+enum {
+  NEW_ATOMIC, // new (picogc::IS_ATOMIC)
+  NEW,        // new without the flag; zero-filled and traced
+  MAKE,       // picogc::make, detected as atomic
+  NEW_TRACED, // new, zero-filled
+  MAKE_TRACED // picogc::make, not zero-filled
+};
+
+template<size_t SIZE> static void allocate_object(int mode, int flags)
+{
+  switch (mode) {
+  case NEW_ATOMIC:
+    new (picogc::IS_ATOMIC | flags) gc_obj_t<SIZE>;
+    break;
+  case NEW:
+    new (flags) gc_obj_t<SIZE>;
+    break;
+  case MAKE:
+    picogc::make<gc_obj_t<SIZE> >(flags);
+    break;
+  case NEW_TRACED:
+    new (flags) gc_traced_obj_t<SIZE>;
+    break;
+  case MAKE_TRACED:
+    picogc::make<gc_traced_obj_t<SIZE> >(flags);
+    break;
+  }
+}
+
+static void allocate_objects(rng_t& rng, int n, int flags,
+			     int mode = NEW_ATOMIC)
+{
+  for (int i = 0; i < n / 100; ++i) {
+    picogc::scope scope;
+    for (int j = 0; j < 100; ++j) {
+      switch ((rng() >> 8) & 15) {
+#define CASE(n) case n: allocate_object<n>(mode, flags); break
+	CASE(0);
+	CASE(1);
+	CASE(2);
+	CASE(3);
+	CASE(4);
+	CASE(5);
+	CASE(6);
+	CASE(7);
+	CASE(8);
+	CASE(9);
+	CASE(10);
+	CASE(11);
+	CASE(12);
+	CASE(13);
+	CASE(14);
+	CASE(15);
+#undef CASE
+      }
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   { // normal case
@@ -49,35 +118,69 @@ int main(int argc, char** argv)
     benchmark_t bench("picogc");
     picogc::scope scope;
     rng_t rng;
+    allocate_objects(rng, LOOP_CNT, 0);
+    gc.trigger_gc();
+  }
 
-    for (int i = 0; i < LOOP_CNT / 100; ++i) {
-      picogc::scope scope;
-      for (int j = 0; j < 100; ++j) {
-	switch ((rng() >> 8) & 15) {
-#define CASE(n) case n: new (picogc::IS_ATOMIC) gc_obj_t<n>; break
-	  CASE(0);
-	  CASE(1);
-	  CASE(2);
-	  CASE(3);
-	  CASE(4);
-	  CASE(5);
-	  CASE(6);
-	  CASE(7);
-	  CASE(8);
-	  CASE(9);
-	  CASE(10);
-	  CASE(11);
-	  CASE(12);
-	  CASE(13);
-	  CASE(14);
-	  CASE(15);
-#undef CASE
-	}
-      }
-    }
+  { // GC case, not flagged as atomic
+    benchmark_t bench("picogc-unflagged");
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT, 0, NEW);
+    gc.trigger_gc();
+  }
 
+  { // GC case, detected as atomic
+    benchmark_t bench("picogc-make");
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT, 0, MAKE);
+    gc.trigger_gc();
+  }
+
+  { // GC case, larger objects having GC members
+    benchmark_t bench("picogc-traced");
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT, 0, NEW_TRACED);
     gc.trigger_gc();
   }
 
+  { // ditto, not zero-filled
+    benchmark_t bench("picogc-traced-make");
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT, 0, MAKE_TRACED);
+    gc.trigger_gc();
+  }
+
+  { // GC case, with atomic objects stored in chunks
+    picogc::gc gc(picogc::config().atomic_chunks(true));
+    picogc::gc_scope gc_scope(&gc);
+    benchmark_t bench("picogc-atomic-chunks");
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT, 0);
+    gc.trigger_gc();
+  }
+
+  { // memory footprint
+    picogc::gc gc(picogc::config().gc_interval_bytes(SIZE_MAX));
+    picogc::gc_scope gc_scope(&gc);
+    heap_usage_t usage("picogc", LOOP_CNT / 10);
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT / 10, picogc::IMMEDIATELY_TRACEABLE);
+  }
+  {
+    picogc::gc gc(picogc::config().gc_interval_bytes(SIZE_MAX)
+		  .atomic_chunks(true));
+    picogc::gc_scope gc_scope(&gc);
+    heap_usage_t usage("picogc-atomic-chunks", LOOP_CNT / 10);
+    picogc::scope scope;
+    rng_t rng;
+    allocate_objects(rng, LOOP_CNT / 10, picogc::IMMEDIATELY_TRACEABLE);
+  }
+
   return 0;
 }
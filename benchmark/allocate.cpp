@@ -2,6 +2,7 @@
 #option -cWall -p -cO2
 
 #include "benchmark/benchmark.h"
+#include "picogc/allocator.h"
 
 #define LOOP_CNT 10000000
 
@@ -43,5 +44,121 @@ int main(int argc, char** argv)
     gc.trigger_gc();
   }
 
+  { // GC case, allocated in batches
+    benchmark_t bench("picogc-batch");
+    picogc::scope scope;
+    gc_obj_t* objs[100];
+
+    for (int i = 0; i < LOOP_CNT / 100; ++i) {
+      picogc::scope scope;
+      gc.allocate_batch(100, objs, picogc::IS_ATOMIC);
+    }
+
+    gc.trigger_gc();
+  }
+
+  { // GC case, with the backing allocators
+    picogc::pool_allocator pool;
+    picogc::freelist_allocator freelist;
+    picogc::gc_allocator* allocators[] = { &pool, &freelist };
+    const char* names[] = { "picogc-pool", "picogc-freelist" };
+    for (size_t a = 0; a != 2; ++a) {
+      picogc::gc gc(picogc::config().allocator(allocators[a]));
+      picogc::gc_scope gc_scope(&gc);
+      benchmark_t bench(names[a]);
+      picogc::scope scope;
+      for (int i = 0; i < LOOP_CNT / 100; ++i) {
+	picogc::scope scope;
+	for (int j = 0; j < 100; ++j) {
+	  new (picogc::IS_ATOMIC) gc_obj_t;
+	}
+      }
+      gc.trigger_gc();
+    }
+  }
+
+  picogc::gc gc_arena(picogc::config().arena_chunk_size(1024 * 1024));
+  { // GC case, with the arena (single, then in batches)
+    picogc::gc_scope gc_scope(&gc_arena);
+    {
+      benchmark_t bench("picogc-arena");
+      picogc::scope scope;
+      for (int i = 0; i < LOOP_CNT / 100; ++i) {
+	picogc::scope scope;
+	for (int j = 0; j < 100; ++j) {
+	  new (picogc::IS_ATOMIC) gc_obj_t;
+	}
+      }
+      gc_arena.trigger_gc();
+    }
+    {
+      benchmark_t bench("picogc-arena-batch");
+      picogc::scope scope;
+      gc_obj_t* objs[100];
+      for (int i = 0; i < LOOP_CNT / 100; ++i) {
+	picogc::scope scope;
+	gc_arena.allocate_batch(100, objs, picogc::IS_ATOMIC);
+      }
+      gc_arena.trigger_gc();
+    }
+  }
+
+  picogc::gc gc2(picogc::config().atomic_chunks(true));
+  { // GC case, with atomic objects stored in chunks
+    picogc::gc_scope gc_scope(&gc2);
+    benchmark_t bench("picogc-atomic-chunks");
+    picogc::scope scope;
+    rng_t rng;
+
+    for (int i = 0; i < LOOP_CNT / 100; ++i) {
+      picogc::scope scope;
+      for (int j = 0; j < 100; ++j) {
+	new (picogc::IS_ATOMIC) gc_obj_t;
+      }
+    }
+
+    gc2.trigger_gc();
+  }
+
+  { // GC case, with the behaviour fixed at compile time
+    picogc::basic_gc<picogc::gc_emitter,
+		     picogc::fixed_interval<8 * 1024 * 1024>,
+		     picogc::fixed_allocator<>,
+		     picogc::fixed_tracer<> > gc;
+    picogc::gc_scope gc_scope(&gc);
+    benchmark_t bench("picogc-basic_gc");
+    picogc::scope scope;
+    rng_t rng;
+
+    for (int i = 0; i < LOOP_CNT / 100; ++i) {
+      picogc::scope scope;
+      for (int j = 0; j < 100; ++j) {
+	new (gc, picogc::IS_ATOMIC) gc_obj_t;
+      }
+    }
+
+    gc.trigger_gc();
+  }
+
+  { // memory footprint
+    picogc::gc gc(picogc::config().gc_interval_bytes(SIZE_MAX));
+    picogc::gc_scope gc_scope(&gc);
+    heap_usage_t usage("picogc", LOOP_CNT / 10);
+    picogc::scope scope;
+    for (int i = 0; i < LOOP_CNT / 10; ++i) {
+      new (picogc::IMMEDIATELY_TRACEABLE | picogc::IS_ATOMIC) gc_obj_t;
+    }
+  }
+  {
+    picogc::gc gc(picogc::config().gc_interval_bytes(SIZE_MAX)
+		  .atomic_chunks(true));
+    picogc::gc_scope gc_scope(&gc);
+    heap_usage_t usage("picogc-atomic-chunks", LOOP_CNT / 10);
+    picogc::scope scope;
+    for (int i = 0; i < LOOP_CNT / 10; ++i) {
+      new (picogc::IMMEDIATELY_TRACEABLE | picogc::IS_ATOMIC) gc_obj_t;
+    }
+  }
+
   return 0;
 }
@@ -2,6 +2,7 @@
 #define benchmark_h
 
 extern "C" {
+#include <malloc.h>
 #include <sys/resource.h>
 }
 #include "picogc.h"
@@ -21,6 +22,24 @@ public:
   }
 };
 
+// reports the heap usage per object, of the objects allocated during its
+// lifetime
+class heap_usage_t {
+  std::string name_;
+  size_t num_objects_;
+  size_t start_;
+public:
+  heap_usage_t(const std::string& name, size_t num_objects)
+    : name_(name), num_objects_(num_objects), start_(now()) {}
+  ~heap_usage_t() {
+    std::cout << name_ << "\t" << (double)(now() - start_) / num_objects_
+	      << " bytes/object" << std::endl;
+  }
+  static size_t now() {
+    return mallinfo2().uordblks;
+  }
+};
+
 class rng_t {
   unsigned n_;
 public:
@@ -0,0 +1,92 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+// a cache of movable entries replaced at random, then shrunk to a quarter;
+// the heap size, the fragmentation of the movable objects and the time
+// taken to walk the entries, with and without the compaction (the
+// fragmentation is that of the last compaction)
+
+#include <cstdio>
+#include "benchmark/benchmark.h"
+
+#define NUM_ENTRIES 200000
+#define LOOP_CNT 1000000
+#define WALK_CNT 100
+
+struct entry_t : public picogc::gc_object {
+  int value;
+  char payload[44];
+  entry_t(int v) : value(v) {}
+};
+
+struct table_t : public picogc::gc_object {
+  picogc::movable<entry_t> entries[NUM_ENTRIES];
+  void gc_mark(picogc::gc* gc) {
+    for (size_t i = 0; i != NUM_ENTRIES; ++i)
+      gc->mark(entries[i]);
+  }
+};
+
+struct compaction_emitter : public picogc::gc_emitter {
+  size_t num_compactions_;
+  size_t bytes_moved_;
+  double fragmentation_before_, fragmentation_after_;
+  compaction_emitter()
+    : num_compactions_(0), bytes_moved_(0), fragmentation_before_(0),
+      fragmentation_after_(0) {}
+  virtual void compact_end(picogc::gc*, const picogc::gc_compaction& r) {
+    ++num_compactions_;
+    bytes_moved_ += r.bytes_moved;
+    fragmentation_before_ = r.fragmentation_before;
+    fragmentation_after_ = r.fragmentation_after;
+  }
+};
+
+static void run(bool compact)
+{
+  picogc::gc gc(picogc::config().compaction_threshold(compact ? 0.5 : 0));
+  compaction_emitter emitter;
+  gc.emitter(&emitter);
+  picogc::gc_scope gc_scope(&gc);
+  const char* name = compact ? "compaction" : "no-compaction";
+  picogc::scope scope;
+  picogc::local<table_t> table = new table_t;
+  rng_t rng;
+  for (int i = 0; i < NUM_ENTRIES; ++i) {
+    picogc::scope scope;
+    table->entries[i] = new (picogc::MOVABLE) entry_t(i);
+  }
+  for (int i = 0; i < LOOP_CNT; ++i) {
+    picogc::scope scope;
+    table->entries[rng() % NUM_ENTRIES] =
+      new (picogc::MOVABLE | picogc::MAY_TRIGGER_GC) entry_t(i);
+  }
+  for (int i = 0; i < NUM_ENTRIES; ++i)
+    if (i % 4 != 0)
+      table->entries[i] = NULL;
+  gc.trigger_gc();
+  std::cout << name << "-compactions\t" << emitter.num_compactions_
+	    << std::endl
+	    << name << "-bytes-moved\t" << emitter.bytes_moved_ << std::endl
+	    << name << "-fragmentation-before\t"
+	    << emitter.fragmentation_before_ << std::endl
+	    << name << "-fragmentation-after\t"
+	    << emitter.fragmentation_after_ << std::endl
+	    << name << "-heap-bytes\t" << gc.metrics().heap_bytes << std::endl;
+  long long sum = 0;
+  {
+    benchmark_t b(std::string(name) + "-walk");
+    for (int n = 0; n < WALK_CNT; ++n)
+      for (int i = 0; i < NUM_ENTRIES; i += 4)
+	sum += table->entries[i]->value;
+  }
+  if (sum == 0)
+    std::cout << "unexpected" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  run(false);
+  run(true);
+  return 0;
+}
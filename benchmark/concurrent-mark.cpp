@@ -0,0 +1,115 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+// the longest pauses of the collections, of a program updating a tree of
+// given number of nodes: marked in a pause (stop-the-world), and marked
+// concurrently (where the pauses are the scan of the roots, and the remark)
+
+#include <cstdio>
+#include "benchmark/benchmark.h"
+
+#define LOOP_CNT 2000000
+
+struct node_t : public picogc::gc_object {
+  picogc::member<node_t> left;
+  picogc::member<node_t> right;
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(left);
+    gc->mark(right);
+  }
+};
+
+// longest pauses of marking (including the scan of the roots) and sweeping
+struct pause_emitter : public picogc::gc_emitter {
+  double start_, mark_, max_mark_, max_sweep_;
+  pause_emitter() : start_(0), mark_(0), max_mark_(0), max_sweep_(0) {}
+  virtual void gc_start(picogc::gc*) {
+    start_ = picogc::gc::now();
+  }
+  virtual void setup_local_end(picogc::gc*) {
+    mark_ = picogc::gc::now() - start_;
+  }
+  virtual void mark_start(picogc::gc*) {
+    start_ = picogc::gc::now();
+  }
+  virtual void mark_end(picogc::gc*) {
+    _mark_paused(picogc::gc::now() - start_);
+  }
+  virtual void remark_start(picogc::gc*) {
+    _mark_paused(mark_); // the roots were scanned in another pause
+    mark_ = 0;
+    start_ = picogc::gc::now();
+  }
+  virtual void remark_end(picogc::gc*) {
+    _mark_paused(picogc::gc::now() - start_);
+  }
+  virtual void sweep_start(picogc::gc*) {
+    start_ = picogc::gc::now();
+  }
+  virtual void sweep_end(picogc::gc*) {
+    double t = picogc::gc::now() - start_;
+    if (t > max_sweep_)
+      max_sweep_ = t;
+  }
+  void _mark_paused(double t) {
+    if (mark_ + t > max_mark_)
+      max_mark_ = mark_ + t;
+    mark_ = 0;
+  }
+};
+
+static node_t* build(int depth)
+{
+  picogc::scope scope;
+  picogc::local<node_t> n = new node_t;
+  if (depth != 0) {
+    n->left = build(depth - 1);
+    n->right = build(depth - 1);
+  }
+  return scope.close(n.get());
+}
+
+static void run(int depth, bool concurrent)
+{
+  picogc::gc gc(picogc::config().concurrent_marking(concurrent));
+  pause_emitter emitter;
+  gc.emitter(&emitter);
+  picogc::gc_scope gc_scope(&gc);
+  double start = picogc::gc::now();
+  {
+    picogc::scope scope;
+    picogc::local<node_t> root = build(depth);
+    gc.trigger_gc();
+    emitter = pause_emitter();
+    rng_t rng;
+    // replace the subtrees at the bottom
+    for (int i = 0; i < LOOP_CNT; ++i) {
+      picogc::scope scope;
+      node_t* n = root;
+      for (int d = 0; d < depth - 2; ++d)
+	n = (rng() & 1) != 0 ? n->left : n->right;
+      node_t* m = new (picogc::MAY_TRIGGER_GC) node_t;
+      m->left = n->left->left;
+      m->right = n->right->right;
+      if ((rng() & 1) != 0)
+	n->left = m;
+      else
+	n->right = m;
+    }
+  }
+  char name[64];
+  sprintf(name, "%s-%dk", concurrent ? "concurrent" : "stop-the-world",
+	  (2 << depth) / 1000);
+  std::cout << name << "-mark-pause\t" << emitter.max_mark_ << std::endl
+	    << name << "-sweep-pause\t" << emitter.max_sweep_ << std::endl
+	    << name << "-total\t" << picogc::gc::now() - start << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  for (int depth = 15; depth <= 20; depth += 5) {
+    run(depth, false);
+    run(depth, true);
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+// requests handled by coroutines sharing a heap, each allocating a few
+// objects per step; run one after another, and interleaved step by step
+// with a root context per coroutine (reused from a pool) being attached
+// whenever resumed
+
+#include <vector>
+#include "benchmark/benchmark.h"
+
+#define REQUEST_CNT 100000
+#define IN_FLIGHT 100
+#define STEPS_PER_REQUEST 10
+#define OBJECTS_PER_STEP 10
+
+struct obj_t : public picogc::gc_object {
+  picogc::member<obj_t> next_;
+  int i_;
+  obj_t(int i) : i_(i) {}
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(next_);
+  }
+};
+
+// the frame of a request, having a scope kept open across the steps
+struct request_t {
+  picogc::scope* scope_;
+  picogc::local<obj_t>* head_;
+  int steps_;
+  void start() {
+    scope_ = new picogc::scope;
+    head_ = new picogc::local<obj_t>;
+    steps_ = 0;
+  }
+  // returns if done
+  bool step() {
+    {
+      picogc::scope scope;
+      for (int i = 0; i < OBJECTS_PER_STEP; ++i) {
+	obj_t* o = new (picogc::MAY_TRIGGER_GC) obj_t(i);
+	o->next_ = *head_;
+	*head_ = o;
+      }
+    }
+    if (++steps_ != STEPS_PER_REQUEST)
+      return false;
+    delete head_;
+    delete scope_;
+    return true;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  { // one after another
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    benchmark_t bench("sequential");
+    request_t req;
+    for (int i = 0; i < REQUEST_CNT; ++i) {
+      req.start();
+      while (! req.step())
+	;
+    }
+  }
+
+  { // interleaved
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    benchmark_t bench("interleaved");
+    std::vector<picogc::root_context*> pool;
+    for (int i = 0; i < IN_FLIGHT; ++i)
+      pool.push_back(new picogc::root_context);
+    request_t reqs[IN_FLIGHT];
+    for (int i = 0; i < IN_FLIGHT; ++i) {
+      pool[i]->attach();
+      reqs[i].start();
+      pool[i]->detach();
+    }
+    int started = IN_FLIGHT;
+    for (int finished = 0; finished < REQUEST_CNT; ) {
+      for (int i = 0; i < IN_FLIGHT; ++i) {
+	if (reqs[i].scope_ == NULL)
+	  continue;
+	pool[i]->attach();
+	if (reqs[i].step()) {
+	  ++finished;
+	  if (started < REQUEST_CNT) {
+	    reqs[i].start();
+	    ++started;
+	  } else {
+	    reqs[i].scope_ = NULL;
+	  }
+	}
+	pool[i]->detach();
+      }
+    }
+    for (int i = 0; i < IN_FLIGHT; ++i)
+      delete pool[i];
+  }
+
+  return 0;
+}
@@ -0,0 +1,52 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+#include "benchmark/benchmark.h"
+
+#define DEPTH 64
+#define NUM_GC 100
+
+struct leaf_t : public picogc::gc_object {
+  int value;
+};
+
+struct node_t : public picogc::gc_object {
+  node_t* next;
+  leaf_t* leaf;
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(next);
+    gc->mark(leaf);
+  }
+};
+
+// allocates atomic objects in each of the nested scopes, and measures the
+// collections run from the innermost one; since the young objects are
+// marked upon allocation and the atomic ones are never traced, the pause
+// should not depend on how many of them are alive
+static void run(picogc::gc& gc, int depth, size_t num_per_scope)
+{
+  picogc::scope scope;
+  picogc::local<node_t> n = new node_t;
+  for (size_t i = 0; i != num_per_scope; ++i)
+    new (picogc::IS_ATOMIC) leaf_t;
+  n->leaf = new (picogc::IS_ATOMIC) leaf_t;
+  if (depth != 0) {
+    run(gc, depth - 1, num_per_scope);
+  } else {
+    char name[64];
+    sprintf(name, "%zu young objects", (DEPTH + 1) * (num_per_scope + 2));
+    benchmark_t bench(name);
+    for (int i = 0; i != NUM_GC; ++i)
+      gc.trigger_gc();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  run(gc, DEPTH, 0);
+  run(gc, DEPTH, 1000);
+  run(gc, DEPTH, 30000);
+  return 0;
+}
@@ -0,0 +1,69 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+// allocating garbage while holding a live set, with and without the heap
+// limit set at given ratios of the live set; the time taken, and the
+// number of collections (those triggered by the limit within braces)
+
+#include <cstdio>
+#include "benchmark/benchmark.h"
+
+#define NUM_LIVE 20000
+#define LOOP_CNT 2000000
+
+struct node_t : public picogc::gc_object {
+  picogc::member<node_t> next;
+  char payload[200];
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(next);
+  }
+};
+
+static void run(double ratio)
+{
+  picogc::gc probe;
+  size_t live_bytes;
+  { // measure the heap used by the live set
+    picogc::gc_scope gc_scope(&probe);
+    picogc::scope scope;
+    for (int i = 0; i < NUM_LIVE; ++i)
+      new node_t;
+    live_bytes = probe.metrics().heap_bytes;
+  }
+  picogc::gc gc(picogc::config()
+		.heap_limit_bytes((size_t)(live_bytes * ratio)));
+  picogc::gc_scope gc_scope(&gc);
+  char name[64];
+  if (ratio == 0)
+    sprintf(name, "no-limit");
+  else
+    sprintf(name, "limit-%.1fx", ratio);
+  {
+    picogc::scope scope;
+    picogc::local<node_t> head;
+    for (int i = 0; i < NUM_LIVE; ++i) {
+      picogc::scope scope;
+      node_t* n = new node_t;
+      n->next = head;
+      head = n;
+    }
+    benchmark_t b(name);
+    for (int i = 0; i < LOOP_CNT; ++i) {
+      picogc::scope scope;
+      new (picogc::MAY_TRIGGER_GC) node_t;
+    }
+  }
+  picogc::gc_metrics m = gc.metrics();
+  std::cout << name << "-collections\t" << m.num_gc << " ("
+	    << m.num_limit_gc << ")" << std::endl
+	    << name << "-peak-heap-bytes\t" << m.peak_heap_bytes << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  run(0);
+  run(4);
+  run(2);
+  run(1.2);
+  return 0;
+}
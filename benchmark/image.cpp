@@ -0,0 +1,101 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+extern "C" {
+#include <stdlib.h>
+#include <unistd.h>
+}
+#include "benchmark/benchmark.h"
+#include "picogc/image.h"
+
+#define TREE_DEPTH 19 // 1M nodes
+
+struct node_t : public picogc::gc_object {
+  node_t* left;
+  node_t* right;
+  int value;
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(left);
+    gc->mark(right);
+  }
+};
+
+static node_t* build(int depth)
+{
+  picogc::scope scope;
+  picogc::local<node_t> n = new node_t;
+  n->value = depth;
+  if (depth != 0) {
+    n->left = build(depth - 1);
+    n->right = build(depth - 1);
+  }
+  return scope.close(n.get());
+}
+
+static long sum(node_t* n)
+{
+  return n != NULL ? n->value + sum(n->left) + sum(n->right) : 0;
+}
+
+// mapping the image is mostly spent in the kernel, so the wall clock is used
+class wallclock_t {
+  std::string name_;
+  double start_;
+public:
+  wallclock_t(const std::string& name)
+    : name_(name), start_(picogc::gc::now()) {}
+  ~wallclock_t() {
+    std::cout << name_ << "\t" << (picogc::gc::now() - start_) << std::endl;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  char path[] = "/tmp/picogc-image-XXXXXX";
+  close(mkstemp(path));
+  picogc::image_types types;
+  types.add<node_t>(1);
+
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  long expected;
+  {
+    picogc::scope scope;
+    picogc::local<node_t> root;
+    {
+      wallclock_t bench("build");
+      root = build(TREE_DEPTH);
+    }
+    expected = sum(root);
+    wallclock_t bench("save");
+    FILE* fp = fopen(path, "wb");
+    picogc::gc_object* roots[] = { root.get() };
+    if (! picogc::save_image(fp, gc, roots, 1, types)) {
+      fprintf(stderr, "failed to save image\n");
+      return 1;
+    }
+    fclose(fp);
+  }
+  gc.trigger_gc();
+
+  picogc::image img;
+  {
+    wallclock_t bench("load");
+    if (! img.load(path, types)) {
+      fprintf(stderr, "failed to load image\n");
+      return 1;
+    }
+  }
+  if (sum(static_cast<node_t*>(img.root(0))) != expected) {
+    fprintf(stderr, "image is broken\n");
+    return 1;
+  }
+  { // the objects are kept marked; scanning them costs a call per object
+    wallclock_t bench("gc with image");
+    gc.add_roots(&img);
+    gc.trigger_gc();
+  }
+
+  unlink(path);
+  return 0;
+}
@@ -0,0 +1,63 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+#include <cstdio>
+#include "benchmark/benchmark.h"
+#include "picogc/intern.h"
+
+#define NUM_STRINGS 2000000
+#define NUM_WORDS 20000
+
+typedef picogc::array<picogc::interned_string*> strings_t;
+
+// builds an array of strings drawn from a skewed vocabulary, either
+// interned or allocated one by one
+static strings_t* build(picogc::intern_table<picogc::interned_string>* table)
+{
+  picogc::scope scope;
+  picogc::local<strings_t> strings =
+    picogc::make_array<picogc::interned_string*>(NUM_STRINGS);
+  rng_t rng;
+  char buf[32];
+  for (int i = 0; i < NUM_STRINGS; ++i) {
+    picogc::scope scope;
+    double r = (double)rng() / 0x7fffffff;
+    size_t len = sprintf(buf, "word-%d", (int)(r * r * NUM_WORDS));
+    (*strings)[i] = table != NULL
+      ? picogc::intern(*table, buf, len, picogc::MAY_TRIGGER_GC)
+      : new (picogc::trailing<char>(len + 1),
+	     picogc::IS_ATOMIC | picogc::TRIVIALLY_DESTRUCTIBLE
+	     | picogc::MAY_TRIGGER_GC) picogc::interned_string(buf, len);
+  }
+  return scope.close(strings.get());
+}
+
+static void run(const char* name, bool interned)
+{
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  picogc::intern_table<picogc::interned_string> table(gc);
+  picogc::scope scope;
+  picogc::local<strings_t> strings;
+  {
+    benchmark_t bench(std::string(name) + "-build");
+    strings = build(interned ? &table : NULL);
+  }
+  {
+    benchmark_t bench(std::string(name) + "-gc");
+    for (int i = 0; i < 10; ++i)
+      gc.trigger_gc();
+  }
+  std::cout << name << "-live\t" << gc.metrics().live_bytes << " bytes"
+	    << std::endl;
+  if (interned)
+    std::cout << name << "-dedup\t" << table.stats().dedup_ratio()
+	      << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  run("separate", false);
+  run("interned", true);
+  return 0;
+}
@@ -2,6 +2,7 @@
 #option -cWall -p -cO2 -cDNDEBUG
 
 #include "benchmark/benchmark.h"
+#include "picogc/allocator.h"
 #include "picogc/util.h"
 
 #define MARK_CNT 100000
@@ -84,30 +85,102 @@ inline gc_link_t* create_gc_link(rng_t& rng)
   }
 }
 
-int main(int argc, char** argv)
+// links having 1 to 16 more references (to themselves), through the
+// pointers given (full or compressed)
+template <template <typename> class Ptr>
+struct gc_node_t : public picogc::gc_object {
+  Ptr<gc_node_t> next;
+};
+
+template <template <typename> class Ptr, size_t SIZE>
+struct gc_node_tmpl_t : public gc_node_t<Ptr> {
+  Ptr<gc_node_t<Ptr> > refs[SIZE + 1];
+  gc_node_tmpl_t() {
+    for (size_t i = 0; i != SIZE + 1; ++i)
+      refs[i] = this;
+  }
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(this->next);
+    for (size_t i = 0; i != SIZE + 1; ++i)
+      gc->mark(refs[i]);
+  }
+};
+
+template <template <typename> class Ptr>
+inline gc_node_t<Ptr>* create_gc_node(rng_t& rng)
 {
-  { // normal case
-    benchmark_t bench("malloc");
+  switch (RND()) {
+#define CASE(n) case n: return new gc_node_tmpl_t<Ptr, n>
+    CASE(0);
+    CASE(1);
+    CASE(2);
+    CASE(3);
+    CASE(4);
+    CASE(5);
+    CASE(6);
+    CASE(7);
+    CASE(8);
+    CASE(9);
+    CASE(10);
+    CASE(11);
+    CASE(12);
+    CASE(13);
+    CASE(14);
+    CASE(15);
+#undef CASE
+  }
+  return NULL;
+}
+
+// the time, the time spent for marking, and the bytes of the objects alive
+template <template <typename> class Ptr>
+static void run_nodes(const char* name, picogc::gc_allocator* allocator)
+{
+  typedef gc_node_t<Ptr> node_t;
+  picogc::gc gc(picogc::config().allocator(allocator));
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  {
+    benchmark_t bench(name);
     rng_t rng;
+    picogc::scope scope;
 
-    malloc_link_t* head = create_malloc_link(rng);
-    malloc_link_t* tail = head;
-    for (int i = 0; i < MARK_CNT; ++i) {
-      tail = tail->next = create_malloc_link(rng);
+    picogc::local<node_t> head;
+    {
+      picogc::scope scope;
+      head = create_gc_node<Ptr>(rng);
     }
-    for (int i = 0; i < LOOP_CNT; ++i) {
-      tail = tail->next = create_malloc_link(rng);
-      malloc_link_t* t = head;
-      head = head->next;
-      delete t;
+    picogc::local<node_t> tail = head;
+    {
+      picogc::scope scope;
+      for (int i = 0; i < MARK_CNT; ++i) {
+	tail->next = create_gc_node<Ptr>(rng);
+	tail = tail->next;
+      }
+    }
+    for (int i = 0; i < LOOP_CNT / 100; ++i) {
+      picogc::scope scope;
+      for (int j = 0; j < 100; ++j) {
+	tail->next = create_gc_node<Ptr>(rng);
+	tail = tail->next;
+	head = head->next;
+      }
     }
+    gc.trigger_gc();
   }
+  std::cout << name << "-mark-time\t" << log.mark_time() << std::endl
+	    << name << "-live-bytes\t" << gc.metrics().live_bytes << std::endl;
+}
 
-  picogc::gc gc; //(new picogc::config(102400));
-  //gc.emitter(new picogc::gc_log_emitter(stdout));
+static void run_gc(const char* name, const picogc::config& conf)
+{
+  picogc::gc gc(conf);
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
   picogc::gc_scope gc_scope(&gc);
   { // GC case
-    benchmark_t bench("picogc");
+    benchmark_t bench(name);
     rng_t rng;
     picogc::scope scope;
 
@@ -136,6 +209,94 @@ int main(int argc, char** argv)
     }
     gc.trigger_gc();
   }
+  printf("%s\tsweep_time\t%g\n", name, log.sweep_time());
+}
+
+// objects whose destructors update the state of their type (e.g. a pool or
+// the statistics of the class), which does not fit in the cache as a whole
+template <size_t N> struct gc_stateful_t : public picogc::gc_object {
+  static size_t counts_[1024];
+  size_t key_;
+  gc_stateful_t(size_t key) : key_(key) {}
+  ~gc_stateful_t() {
+    for (size_t i = 0; i < 1024; i += 8)
+      counts_[(key_ + i) & 1023]++;
+  }
+};
+template <size_t N> size_t gc_stateful_t<N>::counts_[1024];
+
+inline picogc::gc_object* create_gc_stateful(rng_t& rng)
+{
+  size_t key = rng();
+  switch (RND()) {
+#define CASE(n) case n: return new gc_stateful_t<n>(key)
+    CASE(0);
+    CASE(1);
+    CASE(2);
+    CASE(3);
+    CASE(4);
+    CASE(5);
+    CASE(6);
+    CASE(7);
+    CASE(8);
+    CASE(9);
+    CASE(10);
+    CASE(11);
+    CASE(12);
+    CASE(13);
+    CASE(14);
+    CASE(15);
+#undef CASE
+  }
+  return NULL;
+}
+
+static void run_stateful(const char* name, const picogc::config& conf)
+{
+  picogc::gc gc(picogc::config(conf).gc_interval_bytes(64 * 1024 * 1024));
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  rng_t rng;
+  for (int i = 0; i < LOOP_CNT / 100; ++i) {
+    picogc::scope scope;
+    for (int j = 0; j < 100; ++j)
+      create_gc_stateful(rng);
+  }
+  gc.trigger_gc();
+  printf("%s-stateful\tsweep_time\t%g\n", name, log.sweep_time());
+}
+
+int main(int argc, char** argv)
+{
+  { // normal case
+    benchmark_t bench("malloc");
+    rng_t rng;
+
+    malloc_link_t* head = create_malloc_link(rng);
+    malloc_link_t* tail = head;
+    for (int i = 0; i < MARK_CNT; ++i) {
+      tail = tail->next = create_malloc_link(rng);
+    }
+    for (int i = 0; i < LOOP_CNT; ++i) {
+      tail = tail->next = create_malloc_link(rng);
+      malloc_link_t* t = head;
+      head = head->next;
+      delete t;
+    }
+  }
+
+  run_gc("picogc", picogc::config());
+  run_gc("picogc-batched-sweep", picogc::config().batched_sweep(true));
+  run_stateful("picogc", picogc::config());
+  run_stateful("picogc-batched-sweep", picogc::config().batched_sweep(true));
+
+  { // 64-bit pointers and 32-bit offsets, allocated in the same manner
+    picogc::pool_allocator pool;
+    run_nodes<picogc::member>("picogc-pointers", &pool);
+    picogc::cage_allocator cage((size_t)4 * 1024 * 1024 * 1024);
+    run_nodes<picogc::compressed_ptr>("picogc-compressed", &cage);
+  }
 
   return 0;
 }
@@ -2,6 +2,8 @@
 #option -cWall -p -cO2 -cDNDEBUG
 
 #include "benchmark/benchmark.h"
+#include "picogc/allocator.h"
+#include "picogc/util.h"
 
 #define MARK_CNT 100000
 #define LOOP_CNT 10000000
@@ -25,41 +27,23 @@ struct gc_link_t : public picogc::gc_object {
   }
 };
 
-int main(int argc, char** argv)
+template <typename GC> static void run_gc(const char* name, GC& gc)
 {
-  { // normal case
-    benchmark_t bench("malloc");
-
-    malloc_link_t* head = new malloc_link_t;
-    malloc_link_t* tail = head;
-    for (int i = 0; i < MARK_CNT; ++i) {
-      tail = tail->next = new malloc_link_t;
-    }
-    for (int i = 0; i < LOOP_CNT; ++i) {
-      tail = tail->next = new malloc_link_t;
-      malloc_link_t* t = head;
-      head = head->next;
-      delete t;
-    }
-  }
-
-  picogc::gc gc; //(new picogc::config(102400));
-  //gc.emitter(new picogc::gc_log_emitter(stdout));
   picogc::gc_scope gc_scope(&gc);
   { // GC case
-    benchmark_t bench("picogc");
+    benchmark_t bench(name);
     picogc::scope scope;
 
     picogc::local<gc_link_t> head;
     {
       picogc::scope scope;
-      head = new gc_link_t;
+      head = new (gc) gc_link_t;
     }
     picogc::local<gc_link_t> tail = head;
     {
       picogc::scope scope;
       for (int i = 0; i < MARK_CNT; ++i) {
-	tail->next = new gc_link_t;
+	tail->next = new (gc) gc_link_t;
 	tail = tail->next;
       }
     }
@@ -67,7 +51,7 @@ int main(int argc, char** argv)
       picogc::scope scope;
       for (int j = 0; j < 100; ++j) {
 	//printf("%p -> %p\n", &*head, head->next); fflush(stdout);
-	tail->next = new gc_link_t;
+	tail->next = new (gc) gc_link_t;
 	//printf("tail %p -> %p\n", &*tail, tail->next); fflush(stdout);
 	tail = tail->next;
 	head = head->next;
@@ -75,6 +59,102 @@ int main(int argc, char** argv)
     }
     gc.trigger_gc();
   }
+}
+
+// a link also referring to the ones following the next, through the
+// pointers given (full or compressed)
+template <template <typename> class Ptr>
+struct gc_node_t : public picogc::gc_object {
+  Ptr<gc_node_t> next;
+  Ptr<gc_node_t> ahead[3];
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(next);
+    for (size_t i = 0; i != 3; ++i)
+      gc->mark(ahead[i]);
+  }
+};
+
+// the time, the time spent for marking, the bytes of the objects alive,
+// and the peak size of the heap
+template <template <typename> class Ptr>
+static void run_nodes(const char* name, picogc::gc_allocator* allocator)
+{
+  typedef gc_node_t<Ptr> node_t;
+  picogc::gc gc(picogc::config().allocator(allocator));
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  {
+    benchmark_t bench(name);
+    picogc::scope scope;
+
+    picogc::local<node_t> head;
+    picogc::local<node_t> last[4]; // last[0] is the tail
+    {
+      picogc::scope scope;
+      head = new node_t;
+      for (int i = 0; i != 4; ++i)
+	last[i] = head;
+    }
+    for (int i = 0; i < LOOP_CNT / 100; ++i) {
+      picogc::scope scope;
+      for (int j = 0; j < 100; ++j) {
+	node_t* n = new node_t;
+	last[0]->next = n;
+	for (int k = 1; k != 4; ++k)
+	  last[k]->ahead[k - 1] = n;
+	for (int k = 3; k != 0; --k)
+	  last[k] = last[k - 1];
+	last[0] = n;
+	if (i * 100 + j >= MARK_CNT)
+	  head = head->next;
+      }
+    }
+    gc.trigger_gc();
+  }
+  std::cout << name << "-mark-time\t" << log.mark_time() << std::endl
+	    << name << "-live-bytes\t" << gc.metrics().live_bytes << std::endl
+	    << name << "-peak-heap-bytes\t" << gc.metrics().peak_heap_bytes
+	    << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  { // normal case
+    benchmark_t bench("malloc");
+
+    malloc_link_t* head = new malloc_link_t;
+    malloc_link_t* tail = head;
+    for (int i = 0; i < MARK_CNT; ++i) {
+      tail = tail->next = new malloc_link_t;
+    }
+    for (int i = 0; i < LOOP_CNT; ++i) {
+      tail = tail->next = new malloc_link_t;
+      malloc_link_t* t = head;
+      head = head->next;
+      delete t;
+    }
+  }
+
+  {
+    picogc::gc gc; //(new picogc::config(102400));
+    //gc.emitter(new picogc::gc_log_emitter(stdout));
+    run_gc("picogc", gc);
+  }
+  {
+    picogc::basic_gc<picogc::gc_emitter,
+		     picogc::fixed_interval<8 * 1024 * 1024>,
+		     picogc::fixed_allocator<>,
+		     picogc::fixed_tracer<> > gc;
+    run_gc("picogc-basic_gc", gc);
+  }
+
+  { // 64-bit pointers and 32-bit offsets, allocated in the same manner
+    picogc::pool_allocator pool;
+    run_nodes<picogc::member>("picogc-pointers", &pool);
+    picogc::cage_allocator cage((size_t)4 * 1024 * 1024 * 1024);
+    run_nodes<picogc::compressed_ptr>("picogc-compressed", &cage);
+  }
 
   return 0;
 }
@@ -0,0 +1,112 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+#include "benchmark/benchmark.h"
+
+#define LIST_LEN 1000000
+#define TREE_DEPTH 19 // 1M nodes
+#define NUM_TEMPS 3 // temporaries allocated along with each node
+#define LOOP_CNT 10
+
+struct node_t : public picogc::gc_object {
+  node_t* left;
+  node_t* right;
+  long value;
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(left);
+    gc->mark(right);
+  }
+};
+
+struct temp_t : public picogc::gc_object {
+  char buf[48];
+};
+
+enum { PLAIN, NEAR, CLUSTER };
+
+static node_t* alloc_node(int mode, node_t* parent, picogc::cluster& c)
+{
+  for (int i = 0; i < NUM_TEMPS; ++i)
+    new (picogc::IS_ATOMIC) temp_t;
+  switch (mode) {
+  case NEAR:
+    return parent != NULL ? new (picogc::near(parent)) node_t : new node_t;
+  case CLUSTER:
+    return new (picogc::near(c)) node_t;
+  default:
+    return new node_t;
+  }
+}
+
+static node_t* build_list(int mode)
+{
+  picogc::scope scope;
+  picogc::cluster c;
+  node_t* head = alloc_node(mode, NULL, c);
+  node_t* tail = head;
+  for (long i = 1; i < LIST_LEN; ++i) {
+    tail = tail->left = alloc_node(mode, tail, c);
+    tail->value = i;
+  }
+  return scope.close(head);
+}
+
+static node_t* build_tree(int mode, node_t* parent, picogc::cluster& c,
+			  int depth)
+{
+  picogc::scope scope;
+  picogc::local<node_t> n = alloc_node(mode, parent, c);
+  n->value = depth;
+  if (depth != 0) {
+    n->left = build_tree(mode, n, c, depth - 1);
+    n->right = build_tree(mode, n, c, depth - 1);
+  }
+  return scope.close(n.get());
+}
+
+static long sum(node_t* n)
+{
+  long s = 0;
+  for (; n != NULL; n = n->left)
+    s += n->value + (n->right != NULL ? sum(n->right) : 0);
+  return s;
+}
+
+static void run(const char* name, int mode, bool tree)
+{
+  picogc::gc gc(picogc::config().arena_chunk_size(1024 * 1024));
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  picogc::local<node_t> root;
+  if (tree) {
+    picogc::cluster c;
+    root = build_tree(mode, NULL, c, TREE_DEPTH);
+  } else {
+    root = build_list(mode);
+  }
+  gc.trigger_gc(); // collect the temporaries
+  long s = 0;
+  {
+    benchmark_t bench(std::string(name) + "-traverse");
+    for (int i = 0; i < LOOP_CNT; ++i)
+      s += sum(root);
+  }
+  {
+    benchmark_t bench(std::string(name) + "-gc");
+    for (int i = 0; i < LOOP_CNT; ++i)
+      gc.trigger_gc();
+  }
+  if (s == 0)
+    std::cout << "unexpected" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  run("list-plain", PLAIN, false);
+  run("list-near", NEAR, false);
+  run("list-cluster", CLUSTER, false);
+  run("tree-plain", PLAIN, true);
+  run("tree-near", NEAR, true);
+  run("tree-cluster", CLUSTER, true);
+  return 0;
+}
@@ -0,0 +1,61 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+#include "benchmark/benchmark.h"
+#include "picogc/util.h"
+
+#define REQUEST_CNT 100000
+#define OBJECTS_PER_REQUEST 100
+
+struct gc_obj_t : public picogc::gc_object {
+  int i_;
+  gc_obj_t() : i_(0) {}
+};
+
+static void handle_request(int flags)
+{
+  picogc::scope scope;
+  for (int j = 0; j < OBJECTS_PER_REQUEST; ++j) {
+    new (flags) gc_obj_t;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  { // new heap per request
+    benchmark_t bench("new-gc");
+    for (int i = 0; i < REQUEST_CNT; ++i) {
+      picogc::gc gc;
+      picogc::gc_scope gc_scope(&gc);
+      handle_request(picogc::IS_ATOMIC);
+    }
+  }
+
+  { // pooled heaps
+    benchmark_t bench("pooled");
+    picogc::gc_pool pool;
+    for (int i = 0; i < REQUEST_CNT; ++i) {
+      picogc::gc* gc = pool.acquire();
+      {
+	picogc::gc_scope gc_scope(gc);
+	handle_request(picogc::IS_ATOMIC);
+      }
+      pool.release(gc);
+    }
+  }
+
+  { // pooled heaps using arena, with trivially destructible objects
+    benchmark_t bench("pooled-arena");
+    picogc::gc_pool pool(picogc::config().arena_chunk_size(64 * 1024));
+    for (int i = 0; i < REQUEST_CNT; ++i) {
+      picogc::gc* gc = pool.acquire();
+      {
+	picogc::gc_scope gc_scope(gc);
+	handle_request(picogc::IS_ATOMIC | picogc::TRIVIALLY_DESTRUCTIBLE);
+      }
+      pool.release(gc);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,77 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+// usage: recorder.cpp [trace-file]
+// measures the overhead of recording; the trace is kept if the name is given
+// (to be replayed by tools/replay-trace.cpp)
+
+extern "C" {
+#include <sys/stat.h>
+#include <unistd.h>
+}
+#include "benchmark/benchmark.h"
+#include "picogc/recorder.h"
+
+#define REQUEST_CNT 20000
+#define OBJECTS_PER_REQUEST 100
+#define CACHE_SIZE 10000
+
+struct gc_obj_t : public picogc::gc_object {
+  gc_obj_t* next;
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(next);
+  }
+};
+
+// requests allocating temporaries, a few of them replacing the entries of
+// a long-lived cache
+static void run(picogc::gc& gc)
+{
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  picogc::local<picogc::array<gc_obj_t*> > cache =
+    picogc::make_array<gc_obj_t*>(CACHE_SIZE);
+  rng_t rng;
+  for (int i = 0; i < REQUEST_CNT; ++i) {
+    picogc::scope scope;
+    gc_obj_t* o = NULL;
+    for (int j = 0; j < OBJECTS_PER_REQUEST; ++j) {
+      gc_obj_t* n = new (picogc::MAY_TRIGGER_GC) gc_obj_t;
+      n->next = o;
+      o = n;
+    }
+    (*cache)[rng() % CACHE_SIZE] = o;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  {
+    picogc::gc gc;
+    benchmark_t bench("not-recorded");
+    run(gc);
+  }
+  char path[] = "/tmp/picogc-trace-XXXXXX";
+  const char* fn = argc >= 2 ? argv[1] : path;
+  if (argc < 2)
+    close(mkstemp(path));
+  {
+    FILE* fp = fopen(fn, "wb");
+    picogc::gc gc;
+    {
+      picogc::trace_recorder recorder(fp);
+      gc.recorder(&recorder);
+      benchmark_t bench("recorded");
+      run(gc);
+      gc.recorder(NULL);
+    }
+    fclose(fp);
+  }
+  struct stat st;
+  stat(fn, &st);
+  std::cout << "trace-size\t" << (double)st.st_size
+    / (REQUEST_CNT * OBJECTS_PER_REQUEST) << " bytes/object" << std::endl;
+  if (argc < 2)
+    unlink(path);
+  return 0;
+}
@@ -0,0 +1,64 @@
+#! /usr/bin/C
+#option -cWall -p -cO2 -cDNDEBUG
+
+#include "benchmark/benchmark.h"
+
+#define TREE_DEPTH 19 // 1M nodes
+
+struct node_t : public picogc::gc_object {
+  node_t* left;
+  node_t* right;
+  int value;
+  void gc_mark(picogc::gc* gc) {
+    gc->mark(left);
+    gc->mark(right);
+  }
+};
+
+static node_t* build(int depth)
+{
+  picogc::scope scope;
+  picogc::local<node_t> n = new node_t;
+  n->value = depth;
+  if (depth != 0) {
+    n->left = build(depth - 1);
+    n->right = build(depth - 1);
+  }
+  return scope.close(n.get());
+}
+
+static node_t* copy(node_t* src)
+{
+  if (src == NULL)
+    return NULL;
+  picogc::scope scope;
+  picogc::local<node_t> n = new node_t;
+  n->value = src->value;
+  n->left = copy(src->left);
+  n->right = copy(src->right);
+  return scope.close(n.get());
+}
+
+int main(int argc, char** argv)
+{
+  picogc::gc worker, aggregator;
+  node_t* root;
+
+  {
+    picogc::gc_scope gc_scope(&worker);
+    picogc::scope scope;
+    root = build(TREE_DEPTH);
+  }
+  { // deep copy
+    picogc::gc_scope gc_scope(&aggregator);
+    picogc::scope scope;
+    benchmark_t bench("copy");
+    copy(root);
+  }
+  { // transfer
+    benchmark_t bench("transfer");
+    worker.transfer(root, aggregator);
+  }
+
+  return 0;
+}
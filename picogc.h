@@ -30,12 +30,23 @@
 #define picogc_h
 
 extern "C" {
+#include <pthread.h>
 #include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#else
+#include <malloc.h>
+#endif
 }
+#include <algorithm>
+#include <cmath>
 #include <cstddef>
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <new>
 
 namespace picogc {
   
@@ -43,18 +54,38 @@ namespace picogc {
   enum {
     _FLAG_MARKED = 1,
     _FLAG_HAS_GC_MEMBERS = 2,
-    _FLAG_MASK = 3
+    _FLAG_NO_DTOR = 4,
+    _FLAG_MASK = 7
   };
   
   // external flags
   enum {
     IS_ATOMIC = 0x1,
     IMMEDIATELY_TRACEABLE = 0x2,
-    MAY_TRIGGER_GC = 0x4
+    MAY_TRIGGER_GC = 0x4,
+    // the destructor is not called.  Should only be given to the types whose
+    // destructors do nothing; make<T> derives it from the type (see
+    // _is_trivially_destructible), while new (flags) T cannot check it
+    TRIVIALLY_DESTRUCTIBLE = 0x8,
+    // relocatable by the compaction (see movable)
+    MOVABLE = 0x10,
+    // (internal) not zero-filled, being constructed by make
+    _NOT_ZERO_FILLED = 0x20
   };
 
   class gc;
   class gc_object;
+  class root_context;
+  template <typename E> struct trailing;
+  struct gc_emitter;
+  struct gc_allocator;
+  struct gc_oom_handler;
+  struct config_interval;
+  struct config_allocator;
+  struct config_tracer;
+  template <typename Emitter = gc_emitter, typename Pacing = config_interval,
+	    typename Allocator = config_allocator,
+	    typename Tracer = config_tracer> class basic_gc;
   
   template <typename value_type, size_t VALUES_PER_NODE = 2048> class _stack {
     struct node {
@@ -125,6 +156,28 @@ namespace picogc {
     value_type* preserve() {
       return top_;
     }
+    void swap(_stack& x) {
+      node* n = node_, * r = reserved_node_;
+      value_type* t = top_;
+      node_ = x.node_;
+      reserved_node_ = x.reserved_node_;
+      top_ = x.top_;
+      x.node_ = n;
+      x.reserved_node_ = r;
+      x.top_ = t;
+    }
+    void clear() {
+      while (node_->prev != NULL) {
+	node* prev = node_->prev;
+	if (reserved_node_ == NULL) {
+	  reserved_node_ = node_;
+	} else {
+	  delete node_;
+	}
+	node_ = prev;
+      }
+      top_ = node_->values;
+    }
     void restore(value_type* slot) {
       node* n = node_;
       while (! (n->values <= slot && slot <= n->values + VALUES_PER_NODE)) {
@@ -145,42 +198,383 @@ namespace picogc {
 
   struct config {
     size_t gc_interval_bytes_;
-    config() : gc_interval_bytes_(8 * 1024 * 1024) {}
+    double idle_gc_ratio_;
+    size_t arena_chunk_size_;
+    bool atomic_chunks_;
+    bool batched_sweep_;
+    size_t mark_stack_size_;
+    double memory_pressure_ratio_;
+    size_t memory_limit_bytes_;
+    size_t memory_check_interval_bytes_;
+    gc_allocator* allocator_;
+    bool concurrent_marking_;
+    double compaction_threshold_;
+    size_t heap_limit_bytes_;
+    gc_oom_handler* oom_handler_;
+    config()
+      : gc_interval_bytes_(8 * 1024 * 1024), idle_gc_ratio_(0.5),
+	arena_chunk_size_(0), atomic_chunks_(false), batched_sweep_(false),
+	mark_stack_size_(16384), memory_pressure_ratio_(0),
+	memory_limit_bytes_(0), memory_check_interval_bytes_(1024 * 1024),
+	allocator_(NULL), concurrent_marking_(false),
+	compaction_threshold_(0.5), heap_limit_bytes_(0), oom_handler_(NULL) {}
     size_t gc_interval_bytes() const { return gc_interval_bytes_; }
     config& gc_interval_bytes(size_t v) {
       gc_interval_bytes_ = v;
       return *this;
     }
+    // gc::idle_notification starts a collection once this fraction of
+    // gc_interval_bytes has been allocated
+    double idle_gc_ratio() const { return idle_gc_ratio_; }
+    config& idle_gc_ratio(double v) {
+      idle_gc_ratio_ = v;
+      return *this;
+    }
+    // if non-zero, objects are bump-allocated from chunks of given size,
+    // that are released (or recycled by gc::reset) all at once; memory of
+    // the objects being collected is not reused until then
+    size_t arena_chunk_size() const { return arena_chunk_size_; }
+    config& arena_chunk_size(size_t v) {
+      arena_chunk_size_ = v;
+      return *this;
+    }
+    // if set, small atomic objects are stored in chunks segregated by size,
+    // and are not threaded into the object lists
+    bool atomic_chunks() const { return atomic_chunks_; }
+    config& atomic_chunks(bool v) {
+      atomic_chunks_ = v;
+      return *this;
+    }
+    // if set, the sweeper groups dead objects by their type and then runs
+    // the destructors of each group in a row.  Pays off only if the
+    // destructors touch the state of their types (that does not fit in the
+    // cache as a whole); otherwise the grouping costs more than it saves
+    // (see benchmark/mark-many-rndtypes)
+    bool batched_sweep() const { return batched_sweep_; }
+    config& batched_sweep(bool v) {
+      batched_sweep_ = v;
+      return *this;
+    }
+    // number of entries of the mark stack, allocated along with the gc; if
+    // it overflows, the heap is rescanned for objects marked but not scanned
+    size_t mark_stack_size() const { return mark_stack_size_; }
+    config& mark_stack_size(size_t v) {
+      mark_stack_size_ = v;
+      return *this;
+    }
+    // if non-zero (and below 1), collections are started earlier as the
+    // memory usage exceeds this fraction of the limit; the interval
+    // shrinks linearly, down to zero when the limit is reached
+    double memory_pressure_ratio() const { return memory_pressure_ratio_; }
+    config& memory_pressure_ratio(double v) {
+      memory_pressure_ratio_ = v;
+      return *this;
+    }
+    // the limit compared against the RSS; if zero, memory.max and
+    // memory.current of the cgroup (v2) are used
+    size_t memory_limit_bytes() const { return memory_limit_bytes_; }
+    config& memory_limit_bytes(size_t v) {
+      memory_limit_bytes_ = v;
+      return *this;
+    }
+    // the memory usage is checked every given number of bytes allocated
+    size_t memory_check_interval_bytes() const {
+      return memory_check_interval_bytes_;
+    }
+    config& memory_check_interval_bytes(size_t v) {
+      memory_check_interval_bytes_ = v;
+      return *this;
+    }
+    // where the memory of the heap (the objects, and the chunks) is
+    // obtained from; ::operator new if NULL.  should outlive the heap
+    gc_allocator* allocator() const { return allocator_; }
+    config& allocator(gc_allocator* v) {
+      allocator_ = v;
+      return *this;
+    }
+    // if set, the collections started by the allocations (or collect_for)
+    // mark the heap on a background thread while the program runs, between
+    // a pause scanning the roots and another finishing the marking (the
+    // remark); the members of the objects should then be updated through
+    // member<T>.  trigger_gc still collects at once
+    bool concurrent_marking() const { return concurrent_marking_; }
+    config& concurrent_marking(bool v) {
+      concurrent_marking_ = v;
+      return *this;
+    }
+    // trigger_gc compacts the movable objects once this fraction of the
+    // chunks holding them is occupied by dead objects (never if zero)
+    double compaction_threshold() const { return compaction_threshold_; }
+    config& compaction_threshold(double v) {
+      compaction_threshold_ = v;
+      return *this;
+    }
+    // hard limit of heap_bytes (see gc_metrics; 0 for none).  A collection
+    // is run once the heap comes within 1/16 of the limit; an allocation
+    // that would grow the heap beyond it (i.e. does not fit in the chunks
+    // already allocated) runs an emergency collection (if it may trigger
+    // GC), then the oom handler, and throws std::bad_alloc if it still
+    // does.  The collections are not repeated until 1/16 of the limit is
+    // allocated, so that they do not thrash near the limit.  The arena
+    // chunks are released only by gc::reset, so that with arena_chunk_size
+    // the collections do not shrink the heap, and the limit bounds the
+    // memory allocated between the resets
+    size_t heap_limit_bytes() const { return heap_limit_bytes_; }
+    config& heap_limit_bytes(size_t v) {
+      heap_limit_bytes_ = v;
+      return *this;
+    }
+    // should outlive the heap
+    gc_oom_handler* oom_handler() const { return oom_handler_; }
+    config& oom_handler(gc_oom_handler* v) {
+      oom_handler_ = v;
+      return *this;
+    }
   };
   
+  // compile-time policies of basic_gc; the config_* ones read the config at
+  // runtime, the others override the corresponding properties of the config
+
+  // pacing
+  struct config_interval {
+    static size_t gc_interval_bytes(const config& c) {
+      return c.gc_interval_bytes();
+    }
+  };
+  template <size_t BYTES> struct fixed_interval {
+    static size_t gc_interval_bytes(const config&) { return BYTES; }
+  };
+
+  // where the objects are allocated from
+  struct config_allocator {
+    static size_t arena_chunk_size(const config& c) {
+      return c.arena_chunk_size();
+    }
+    static bool atomic_chunks(const config& c) { return c.atomic_chunks(); }
+    static gc_allocator* allocator(const config& c) { return c.allocator(); }
+  };
+  // (always uses ::operator new)
+  template <size_t ARENA_CHUNK_SIZE = 0, bool ATOMIC_CHUNKS = false>
+  struct fixed_allocator {
+    static size_t arena_chunk_size(const config&) { return ARENA_CHUNK_SIZE; }
+    static bool atomic_chunks(const config&) { return ATOMIC_CHUNKS; }
+    static gc_allocator* allocator(const config&) { return NULL; }
+  };
+
+  // how the heap is traced and swept
+  struct config_tracer {
+    static size_t mark_stack_size(const config& c) {
+      return c.mark_stack_size();
+    }
+    static bool batched_sweep(const config& c) { return c.batched_sweep(); }
+  };
+  template <size_t MARK_STACK_SIZE = 16384, bool BATCHED_SWEEP = false>
+  struct fixed_tracer {
+    static size_t mark_stack_size(const config&) { return MARK_STACK_SIZE; }
+    static bool batched_sweep(const config&) { return BATCHED_SWEEP; }
+  };
+
   struct gc_stats {
     size_t on_stack;
     size_t slowly_marked;
     size_t not_collected;
     size_t collected;
-    gc_stats() : on_stack(0), slowly_marked(0), not_collected(0), collected(0)
+    size_t mark_stack_overflows;
+    size_t by_memory_pressure; // 1 if triggered by memory pressure
+    size_t remarked; // slots and objects rescanned by the remark
+    size_t by_heap_limit; // 1 if triggered by config::heap_limit_bytes
+    gc_stats()
+      : on_stack(0), slowly_marked(0), not_collected(0), collected(0),
+	mark_stack_overflows(0), by_memory_pressure(0), remarked(0),
+	by_heap_limit(0)
     {}
   };
   
+  // running counters of the heap, in bytes unless noted; the size of an
+  // object is what it occupies in the heap (including the rounding by the
+  // allocator)
+  struct gc_metrics {
+    size_t bytes_requested; // total, as requested by the allocations
+    size_t bytes_allocated; // total
+    size_t bytes_freed;     // total
+    size_t object_bytes;    // objects not yet freed
+    size_t live_bytes;      // objects found alive by the last collection
+    size_t heap_bytes;      // obtained from the allocator for the objects
+    size_t peak_heap_bytes;
+    size_t overhead_bytes;  // heap_bytes not used by objects (chunk headers,
+			    // free slots, collected objects in the arena)
+    size_t num_gc;
+    size_t num_pressure_gc; // collections triggered by memory pressure
+    double pause_time;      // total seconds spent in collection
+    size_t num_limit_gc;    // collections triggered by the heap limit
+    size_t num_allocation_failures; // std::bad_alloc thrown by the limit
+  };
+
+  // the result of compacting the movable objects; fragmentation is the
+  // fraction of the chunks (up to where allocated) not occupied by live
+  // objects
+  struct gc_compaction {
+    size_t objects_moved;
+    size_t bytes_moved;
+    size_t chunks_released;
+    double fragmentation_before;
+    double fragmentation_after;
+    gc_compaction()
+      : objects_moved(0), bytes_moved(0), chunks_released(0),
+	fragmentation_before(0), fragmentation_after(0)
+    {}
+  };
+
   struct gc_emitter {
     virtual ~gc_emitter() {}
     virtual void gc_start(gc*) {}
     virtual void gc_end(gc*, const gc_stats&) {}
+    // root scanning; the objects allocated within the open scopes, and the
+    // local variables
+    virtual void setup_new_start(gc*) {}
+    virtual void setup_new_end(gc*) {}
+    virtual void setup_local_start(gc*) {}
+    virtual void setup_local_end(gc*) {}
     virtual void mark_start(gc*) {}
     virtual void mark_end(gc*) {}
+    // replace mark_start and mark_end if config::concurrent_marking is set;
+    // concurrent_mark_* are called from the marking thread, while the
+    // program runs
+    virtual void concurrent_mark_start(gc*) {}
+    virtual void concurrent_mark_end(gc*) {}
+    virtual void remark_start(gc*) {}
+    virtual void remark_end(gc*) {}
     virtual void sweep_start(gc*) {}
     virtual void sweep_end(gc*) {}
+    // run by trigger_gc after sweeping, if the movable objects are
+    // fragmented (see config::compaction_threshold)
+    virtual void compact_start(gc*) {}
+    virtual void compact_end(gc*, const gc_compaction&) {}
   };
   
+  struct gc_sampler {
+    virtual ~gc_sampler() {}
+    // returns the number of bytes to be allocated until the next sample
+    virtual size_t next_interval(gc*) = 0;
+    // called with the object just allocated (before its ctor is run)
+    virtual void sample(gc*, gc_object*, size_t) {}
+    // called after marking; sampled objects not marked are being collected
+    virtual void mark_end(gc*) {}
+    // called with a movable object relocated by the compaction
+    virtual void moved(gc*, gc_object*, gc_object*) {}
+    // called with the source heap, each object moved by gc::transfer and
+    // the target heap, on the samplers of both (once if they are the same)
+    virtual void transferred(gc*, gc_object*, gc*) {}
+    // called before all the objects are freed by gc::reset or by the
+    // destructor of the heap (the sampler should outlive the heap, or be
+    // unregistered before)
+    virtual void cleared(gc*) {}
+  };
+
+  // receives the allocations, the frees by the collector, and the scopes
+  // being opened and closed, e.g. to record the workload (see gc::recorder)
+  struct gc_recorder {
+    virtual ~gc_recorder() {}
+    // called with the object just allocated (before its ctor is run), or
+    // moved in from another heap by gc::transfer
+    virtual void allocated(gc*, gc_object*, size_t, int) {}
+    // called with the object being freed (after destruction), or moved out
+    // to another heap by gc::transfer
+    virtual void freed(gc*, gc_object*) {}
+    // called with a movable object relocated by the compaction
+    virtual void moved(gc*, gc_object*, gc_object*) {}
+    virtual void scope_opened(gc*) {}
+    virtual void scope_closed(gc*) {}
+    virtual void collection_started(gc*) {}
+    virtual void collection_ended(gc*, const gc_stats&) {}
+  };
+
+  // handler of the allocations that would exceed config::heap_limit_bytes
+  // even after the emergency collection (see config::oom_handler)
+  struct gc_oom_handler {
+    virtual ~gc_oom_handler() {}
+    // should drop the references to the objects that can be done without
+    // (caches and the like), returning if it did so (then the heap is
+    // collected again).  Also called for the allocations that may not
+    // trigger GC, which then fail regardless (as nothing is collected)
+    virtual bool out_of_memory(gc*, size_t requested) = 0;
+  };
+
+  // backing allocator of the heap (see config::allocator); the blocks are
+  // aligned to 16 bytes
+  struct gc_allocator {
+    virtual ~gc_allocator() {}
+    virtual void* allocate(size_t sz) = 0;
+    // sz is the usable size of the block
+    virtual void free(void* p, size_t sz) = 0;
+    // frees the blocks of the objects collected by a sweep, at once
+    virtual void free_bulk(void* const* blocks, size_t n) {
+      for (size_t i = 0; i != n; ++i)
+	free(blocks[i], usable_size(blocks[i]));
+    }
+    // bytes occupied by the block (accounted as the size of the object)
+    virtual size_t usable_size(void* p) = 0;
+  };
+
+  struct gc_visitor {
+    virtual ~gc_visitor() {}
+    // called for each member reported by gc_object::gc_mark
+    virtual void visit(gc_object*) = 0;
+    // ditto, with where the pointer was read from (NULL for movable and
+    // compressed_ptr, which do not hold the pointer itself)
+    virtual void visit_slot(const void*, gc_object* obj) {
+      visit(obj);
+    }
+    // called by gc::visit_roots for each root; kind is one of gc::ROOT_*,
+    // and index numbers the scopes, the local slots or the gc_roots
+    virtual void visit_root(gc_object* obj, int kind, size_t index) {
+      visit(obj);
+    }
+    // called by gc::visit_heap for each object, with the bytes it occupies
+    virtual void visit_object(gc_object*, size_t) {}
+  };
+
+  // roots outside of the heap (e.g. objects not allocated by it), marked at
+  // the beginning of each collection while registered by gc::add_roots;
+  // weak references are dropped by gc_clear_weak, which is called between
+  // marking and sweeping
+  class gc_roots {
+    friend class gc;
+    gc* gc_;
+    gc_roots* prev_;
+    gc_roots* next_;
+    gc_roots(const gc_roots&); // = delete;
+    gc_roots& operator=(const gc_roots&); // = delete;
+  public:
+    gc_roots() : gc_(NULL), prev_(NULL), next_(NULL) {}
+    virtual ~gc_roots();
+    // calls gc::mark for the roots (or gc::mark_members for the objects)
+    virtual void gc_mark_roots(gc*) {}
+    // forgets the objects not marked (gc_object::gc_is_marked), which are
+    // being collected
+    virtual void gc_clear_weak(gc*) {}
+  };
+
   // global variables
   template <bool T> struct _globals {
     static config default_config;
     static gc_emitter default_emitter;
     static gc* _top_scope;
+    // the heaps marking concurrently (linked through gc::next_marking_),
+    // and the number of heaps alive
+    static gc* marking_heaps;
+    static size_t num_heaps;
+    // the heap cage (see cage_allocator), if any
+    static char* cage_base;
+    static size_t cage_size;
   };
   template <bool T> config _globals<T>::default_config;
   template <bool T> gc_emitter _globals<T>::default_emitter;
   template <bool T> gc* _globals<T>::_top_scope;
+  template <bool T> gc* _globals<T>::marking_heaps;
+  template <bool T> size_t _globals<T>::num_heaps;
+  template <bool T> char* _globals<T>::cage_base;
+  template <bool T> size_t _globals<T>::cage_size;
   typedef _globals<false> globals;
   
   template <typename T> class local {
@@ -195,6 +589,80 @@ namespace picogc {
     T* operator->() const { return get(); }
   };
   
+  // a member of gc_object referring to another, stored through the write
+  // barrier that concurrent marking relies upon (see
+  // config::concurrent_marking).  The pointer is accessed atomically,
+  // since the marker thread reads it
+  template <typename T> class member {
+    gc_object* ptr_;
+  public:
+    member(T* obj = NULL);
+    member(const member<T>& x);
+    member& operator=(const member<T>& x) { return *this = x.get(); }
+    member& operator=(T* obj);
+    T* get() const {
+      return static_cast<T*>(__atomic_load_n(&ptr_, __ATOMIC_ACQUIRE));
+    }
+    operator T*() const { return get(); }
+    T* operator->() const { return get(); }
+  };
+
+  // refers to an object allocated with MOVABLE through its handle, so that
+  // the object can be relocated by the compaction; pointers to the object
+  // (including those returned by get) are valid until the next collection,
+  // except for those held by local<T> (the objects referred to by the
+  // locals, as well as the young objects, are not moved).  The objects
+  // should be relocatable by memcpy
+  template <typename T> class movable {
+    gc_object** handle_;
+  public:
+    movable() : handle_(NULL) {}
+    movable(T* obj);
+    movable(const movable<T>& x);
+    movable& operator=(const movable<T>& x);
+    movable& operator=(T* obj) { return *this = movable<T>(obj); }
+    T* get() const {
+      gc_object** h = __atomic_load_n(&handle_, __ATOMIC_ACQUIRE);
+      return h != NULL ? static_cast<T*>(*h) : NULL;
+    }
+    operator T*() const { return get(); }
+    T* operator->() const { return get(); }
+  };
+
+  // a member referring to an object in the heap cage (see cage_allocator
+  // in picogc/allocator.h), stored as a 32-bit offset from the base of the
+  // cage in 8-byte units (so that the cage can be up to 32GB).  Written
+  // through the write barrier as member is; should not refer to MOVABLE
+  // objects
+  template <typename T> class compressed_ptr {
+    uint32_t offset_; // 0 if null
+  public:
+    enum { SHIFT = 3 };
+    compressed_ptr(T* obj = NULL);
+    compressed_ptr(const compressed_ptr<T>& x);
+    compressed_ptr& operator=(const compressed_ptr<T>& x) {
+      return *this = x.get();
+    }
+    compressed_ptr& operator=(T* obj);
+    T* get() const {
+      uint32_t offset = __atomic_load_n(&offset_, __ATOMIC_ACQUIRE);
+      return offset != 0 ? static_cast<T*>(_decompress(offset)) : NULL;
+    }
+    operator T*() const { return get(); }
+    T* operator->() const { return get(); }
+    static uint32_t _compress(gc_object* obj) {
+      if (obj == NULL)
+	return 0;
+      size_t off = reinterpret_cast<char*>(obj) - globals::cage_base;
+      assert(off < globals::cage_size && off % (1 << SHIFT) == 0);
+      return static_cast<uint32_t>(off >> SHIFT);
+    }
+    static gc_object* _decompress(uint32_t offset) {
+      return reinterpret_cast<gc_object*>(globals::cage_base
+					  + ((size_t)offset << SHIFT));
+    }
+  };
+
   class gc_scope {
     gc* prev_;
   public:
@@ -208,8 +676,12 @@ namespace picogc {
   
   class scope {
     friend class gc;
+    // young objects, marked upon allocation; the ones having GC members
+    // precede the atomic ones, so that only they are traced as roots
     gc_object* new_head_;
     intptr_t* new_tail_slot_;
+    size_t num_new_;
+    size_t new_bytes_;
     scope* prev_;
     gc_object** stack_state_;
     void _destruct(gc* gc);
@@ -218,39 +690,541 @@ namespace picogc {
     ~scope();
     template <typename T> T* close(T* obj);
   };
+
+  // the roots of a coroutine (or a fiber): the locals, and the scopes
+  // opened while it is attached to the heap.  attach() switches the heap to
+  // them as the coroutine is resumed, and detach() switches back as it
+  // suspends (in LIFO order); the collections scan the roots of all the
+  // contexts, attached or not.  Switching does not allocate memory, but
+  // creating a context allocates its stack, so they had better be reused
+  // (e.g. pooled).  The scopes should be closed while attached
+  class root_context {
+    friend class gc;
+    gc* gc_;
+    // the roots of the context while detached, or those it has been
+    // attached over (they are swapped)
+    _stack<gc_object*> stack_;
+    scope* scope_;
+    root_context* prev_;
+    root_context* next_;
+    bool attached_;
+    root_context(const root_context&); // = delete;
+    root_context& operator=(const root_context&); // = delete;
+  public:
+    root_context();
+    explicit root_context(gc& gc);
+    ~root_context();
+    void attach();
+    void detach();
+    bool attached() const { return attached_; }
+  };
+
+  // a region of the arena that the objects allocated by
+  // new (picogc::near(cluster)) T are packed into (e.g. the nodes of a
+  // structure being built within a scope, along with temporaries); the
+  // unused space is abandoned on destruction.  should not be kept across
+  // gc::reset
+  class cluster {
+    friend class gc;
+    char* begin_;
+    char* cur_;
+    char* end_;
+  public:
+    cluster() : begin_(NULL), cur_(NULL), end_(NULL) {}
+  };
+
+  // allocation hint; new (picogc::near(obj)) T places the object next to
+  // the ones allocated near obj, or near the objects that were (when space
+  // allows).  effective with the arena only
+  struct near {
+    gc_object* obj;
+    cluster* region;
+    explicit near(gc_object* obj) : obj(obj), region(NULL) {}
+    explicit near(cluster& c) : obj(NULL), region(&c) {}
+  };
   
   class gc {
     friend class scope;
+    friend class root_context;
+    template <typename> friend class member;
+    template <typename> friend class movable;
+    template <typename> friend class compressed_ptr;
+    template <typename, typename, typename, typename> friend class basic_gc;
+    struct _chunk {
+      _chunk* next;
+      size_t size;
+    };
+    enum { _CHUNK_HEADER_SIZE = (sizeof(_chunk) + 15) & ~15 };
+    // chunk of atomic objects of same size; the objects do not use next_
+    // as a link, and free slots are linked using next_ with
+    // _FLAG_HAS_GC_MEMBERS set (which is never set for atomic objects)
+    struct _atomic_chunk {
+      _atomic_chunk* next;
+      _atomic_chunk* next_avail;
+      gc_object* free_;
+      char* unused_;
+      size_t slot_size;
+      size_t num_used;
+      size_t num_finalizable;
+    };
+    enum {
+      _ATOMIC_CHUNK_SIZE = 65536,
+      _ATOMIC_CHUNK_HEADER_SIZE = (sizeof(_atomic_chunk) + 15) & ~15,
+      // in 8-byte steps, up to 256 bytes; objects that require 16-byte
+      // alignment are 16-byte aligned, since their sizes are multiples of 16
+      _NUM_SIZE_CLASSES = 32
+    };
+    // dead objects of same type (vptr), linked through next_
+    struct _sweep_batch {
+      const void* vptr;
+      gc_object* head;
+    };
+    enum {
+      _NUM_SWEEP_BATCHES = 64,
+      // destroy the batches before they fall out of the cache
+      _MAX_SWEEP_BATCHED = 256
+    };
+    // freed objects handed to gc_allocator::free_bulk at once
+    enum { _NUM_FREE_BLOCKS = 64 };
+    // clusters opened by near(obj), replaced in round robin
+    enum { _NUM_CLUSTERS = 8, _CLUSTER_SIZE = 4096 };
+    // state of the marker thread
+    enum { _MARKER_IDLE, _MARKER_MARKING, _MARKER_DONE, _MARKER_EXIT };
+    // chunk of movable objects, bump-allocated (each object preceded by its
+    // size, as in the arena); next_ of the objects point to their handles,
+    // and is zero once dead.  Emptied by the sweep or by the compaction
+    struct _movable_chunk {
+      _movable_chunk* next;
+      char* cur;
+      char* end;
+      char* limit; // objects below are swept (or rescanned by the marker)
+      size_t size;
+      size_t live_bytes;
+    };
+    enum {
+      _MOVABLE_CHUNK_SIZE = 256 * 1024,
+      _MOVABLE_CHUNK_HEADER_SIZE = (sizeof(_movable_chunk) + 15) & ~15,
+      // the handles are allocated in blocks that are never moved
+      _HANDLE_BLOCK_SIZE = 16384
+    };
     scope* scope_;
     _stack<gc_object*> stack_;
+    root_context* contexts_;
     gc_object* obj_head_;
-    _stack<gc_object*> pending_;
+    // the mark stack (fixed size, so that marking never allocates memory)
+    gc_object** mark_stack_;
+    gc_object** mark_stack_top_;
+    gc_object** mark_stack_end_;
+    bool mark_stack_overflowed_;
     size_t bytes_allocated_since_gc_;
+    size_t num_finalizable_;
     config conf_;
+    // the arena
+    _chunk* chunks_;
+    _chunk* free_chunks_;
+    char* arena_cur_;
+    char* arena_end_;
+    cluster clusters_[_NUM_CLUSTERS];
+    const gc_object* cluster_origins_[_NUM_CLUSTERS];
+    size_t next_cluster_;
+    // chunks of atomic objects, per size class
+    _atomic_chunk* atomic_chunks_[_NUM_SIZE_CLASSES];
+    _atomic_chunk* atomic_avail_[_NUM_SIZE_CLASSES];
     gc_emitter* emitter_;
+    gc_sampler* sampler_;
+    size_t bytes_until_sample_;
+    gc_recorder* recorder_;
+    gc_visitor* visitor_;
+    gc_roots* roots_;
+    // state of the collection being run incrementally
+    bool sweeping_;
+    gc_object* sweep_cur_;
+    gc_object* swept_head_;
+    intptr_t* swept_tail_ref_;
+    size_t sweep_class_;
+    _atomic_chunk* sweep_chunk_;
+    _sweep_batch sweep_batches_[_NUM_SWEEP_BATCHES];
+    unsigned char sweep_batches_used_[_NUM_SWEEP_BATCHES];
+    size_t num_sweep_batches_used_;
+    size_t num_sweep_batched_;
+    void* free_blocks_[_NUM_FREE_BLOCKS];
+    size_t num_free_blocks_;
+    gc_stats cycle_stats_;
+    double last_mark_time_;
+    // concurrent marking; the thread is started by the first cycle.  While
+    // marking_ is set (until the remark), the objects allocated are marked,
+    // and the objects stored by member<T> as well as the young objects
+    // leaving their scopes are logged to be rescanned by the remark
+    bool marking_;
+    gc* next_marking_;
+    // set if other heaps have been alive while marking, so that the
+    // objects logged may be theirs (see _write_barrier)
+    bool foreign_refs_;
+    int marker_state_;
+    bool marker_started_;
+    pthread_t marker_;
+    pthread_mutex_t marker_mutex_;
+    pthread_cond_t marker_cond_;
+    gc_object* mark_snapshot_; // obj_head_ as of the beginning of the cycle
+    _stack<gc_object*>* dirty_objects_;
+    _stack<gc_object*>* dirty_refs_; // stored by the write barrier
+    // movable objects, and their handles (free ones are linked through
+    // themselves; the first slot of each block links the blocks)
+    _movable_chunk* movable_chunks_;
+    _movable_chunk* movable_cur_;
+    _movable_chunk* movable_snapshot_; // as of the beginning of the cycle
+    _movable_chunk* sweep_movable_;
+    gc_object** handle_blocks_;
+    gc_object** free_handles_;
+    // accounting (see gc_metrics)
+    size_t bytes_requested_;
+    size_t bytes_allocated_;
+    size_t bytes_freed_;
+    size_t live_bytes_;
+    size_t cycle_live_bytes_;
+    size_t heap_bytes_;
+    size_t peak_heap_bytes_;
+    size_t num_gc_;
+    size_t num_pressure_gc_;
+    double pause_time_;
+    // memory pressure, and the heap limit (SIZE_MAX if none)
+    size_t next_memory_check_;
+    bool pressure_gc_;
+    size_t heap_limit_;
+    bool limit_gc_;
+    size_t num_limit_gc_;
+    size_t num_allocation_failures_;
+    // objects being constructed by make; the collections are deferred until
+    // they are done
+    size_t num_constructing_;
+    bool gc_deferred_;
   public:
+    enum {
+      ROOT_NEW,     // allocated within the scopes (innermost first)
+      ROOT_LOCAL,   // local variables (top of the stack first)
+      ROOT_EXTERNAL // marked by gc_roots
+    };
     gc(const config& conf = config())
-      : scope_(NULL), stack_(), obj_head_(NULL), pending_(),
-	bytes_allocated_since_gc_(0), conf_(conf),
-	emitter_(&globals::default_emitter)
-    {}
-    ~gc();
+      : scope_(NULL), stack_(), contexts_(NULL), obj_head_(NULL),
+	mark_stack_(new gc_object*[conf.mark_stack_size()]),
+	mark_stack_top_(mark_stack_),
+	mark_stack_end_(mark_stack_ + conf.mark_stack_size()),
+	mark_stack_overflowed_(false), bytes_allocated_since_gc_(0), num_finalizable_(0), conf_(conf),
+	chunks_(NULL), free_chunks_(NULL), arena_cur_(NULL), arena_end_(NULL),
+	next_cluster_(0),
+	emitter_(&globals::default_emitter), sampler_(NULL),
+	bytes_until_sample_(SIZE_MAX), recorder_(NULL), visitor_(NULL),
+	roots_(NULL),
+	sweeping_(false),
+	sweep_cur_(NULL), swept_head_(NULL), swept_tail_ref_(NULL),
+	sweep_class_(0), sweep_chunk_(NULL), num_sweep_batches_used_(0),
+	num_sweep_batched_(0), num_free_blocks_(0),
+	cycle_stats_(), last_mark_time_(0), marking_(false),
+	next_marking_(NULL), foreign_refs_(false),
+	marker_state_(_MARKER_IDLE), marker_started_(false),
+	mark_snapshot_(NULL),
+	dirty_objects_(conf.concurrent_marking() ? new _stack<gc_object*> : NULL),
+	dirty_refs_(conf.concurrent_marking() ? new _stack<gc_object*> : NULL),
+	movable_chunks_(NULL), movable_cur_(NULL), movable_snapshot_(NULL),
+	sweep_movable_(NULL), handle_blocks_(NULL), free_handles_(NULL),
+	bytes_requested_(0),
+	bytes_allocated_(0), bytes_freed_(0), live_bytes_(0),
+	cycle_live_bytes_(0), heap_bytes_(0), peak_heap_bytes_(0), num_gc_(0),
+	num_pressure_gc_(0), pause_time_(0),
+	next_memory_check_(_memory_check_interval(conf)), pressure_gc_(false),
+	heap_limit_(conf.heap_limit_bytes() != 0
+		    ? conf.heap_limit_bytes() : SIZE_MAX),
+	limit_gc_(false), num_limit_gc_(0), num_allocation_failures_(0),
+	num_constructing_(0), gc_deferred_(false)
+    {
+      for (size_t i = 0; i != _NUM_SIZE_CLASSES; ++i)
+	atomic_chunks_[i] = atomic_avail_[i] = NULL;
+      for (size_t i = 0; i != _NUM_CLUSTERS; ++i)
+	cluster_origins_[i] = NULL;
+      for (size_t i = 0; i != _NUM_SWEEP_BATCHES; ++i) {
+	sweep_batches_[i].vptr = NULL;
+	sweep_batches_[i].head = NULL;
+      }
+      ++globals::num_heaps;
+      for (gc* g = globals::marking_heaps; g != NULL; g = g->next_marking_)
+	g->foreign_refs_ = true;
+    }
+    virtual ~gc();
+    void reset();
     void* allocate(size_t sz, int flags);
+    // allocates as hinted (see near)
+    void* allocate_near(size_t sz, int flags, const near& hint);
+    // allocates and default-constructs n objects of T at once (accounted,
+    // checked for GC and linked to the scope as a group)
+    template <typename T> void allocate_batch(size_t n, T** objs,
+					      int flags = 0);
     void trigger_gc();
     void may_trigger_gc();
-    void mark(gc_object* obj);
+    bool collect_for(double deadline);
+    bool idle_notification(double budget);
+    // the members are taken by reference, so that the visitors can be told
+    // where they are held (see gc_visitor::visit_slot)
+    void mark(gc_object* const& obj) {
+      _mark_slot(obj, &obj);
+    }
+    template <typename T> void mark(T* const& obj) {
+      _mark_slot(obj, &obj);
+    }
+    template <typename T> void mark(const member<T>& obj) {
+      _mark_slot(obj.get(), &obj);
+    }
+    template <typename T> void mark(const movable<T>& obj) {
+      _mark_slot(obj.get(), NULL);
+    }
+    template <typename T> void mark(const compressed_ptr<T>& obj) {
+      _mark_slot(obj.get(), NULL);
+    }
+    void visit_members(gc_object* obj, gc_visitor* visitor);
+    // marks the members of an object not allocated from the heap, which
+    // should be kept marked (called by gc_roots::gc_mark_roots)
+    void mark_members(gc_object* obj);
+    void add_roots(gc_roots* roots);
+    void remove_roots(gc_roots* roots);
+    // report the roots, and all the objects (after completing the sweep)
+    void visit_roots(gc_visitor* visitor);
+    void visit_heap(gc_visitor* visitor);
+    bool transfer(gc_object* root, gc& target);
     gc_object** _acquire_local_slot() {
       return stack_.push();
     }
+    void* _begin_construction(size_t sz, int flags) {
+      void* p = allocate(sz, flags | _NOT_ZERO_FILLED);
+      num_constructing_++;
+      return p;
+    }
+    template <typename T> T* _end_construction(T* obj) {
+      if (--num_constructing_ == 0 && gc_deferred_) {
+	gc_deferred_ = false;
+	may_trigger_gc();
+      }
+      return obj;
+    }
+    void _abort_construction(void* p);
+    const config& conf() const { return conf_; }
+    gc_metrics metrics() const;
     gc_emitter* emitter() { return emitter_; }
     void emitter(gc_emitter* emitter) { emitter_ = emitter; }
+    gc_sampler* sampler() { return sampler_; }
+    void sampler(gc_sampler* sampler) {
+      sampler_ = sampler;
+      bytes_until_sample_ =
+	sampler != NULL ? sampler->next_interval(this) : SIZE_MAX;
+    }
+    gc_recorder* recorder() { return recorder_; }
+    void recorder(gc_recorder* recorder) { recorder_ = recorder; }
     static gc* top() {
       assert(globals::_top_scope != NULL);
       return globals::_top_scope;
     }
+    // memory usage and its limit, either the RSS against given limit, or
+    // those of the cgroup (v2) that limits the memory (if any)
+    static bool read_memory_usage(size_t& usage, size_t& limit,
+				  size_t fixed_limit = 0);
+    static double now() {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+    }
   protected:
-    virtual void _mark(gc_stats& stats);
-    virtual void _sweep(gc_stats& stats);
+    // runs a collection at once (replaced by basic_gc with the one
+    // specialized on its policies)
+    virtual void _trigger_gc();
+    template <typename Tracer, typename Emitter> void _collect(Emitter& e);
+    void _mark(gc_stats& stats);
+    void _drain_mark_stack(gc_stats& stats);
+    void _mark_concurrently(gc_stats& stats);
+    static void* _marker_main(void* self);
+    bool _marker_done() const {
+      return __atomic_load_n(&marker_state_, __ATOMIC_ACQUIRE) == _MARKER_DONE;
+    }
+    void _wait_marker();
+    void _stop_marker();
+    // the object stored is logged to be marked by the remark.  The heap
+    // owning it is not known, so it is logged to all the heaps marking
+    // (usually one), each of which skips the ones not found in it
+    static void _write_barrier(gc_object* obj) {
+      for (gc* gc = globals::marking_heaps; gc != NULL; gc = gc->next_marking_)
+	*gc->dirty_refs_->push() = obj;
+    }
+    void _drop_foreign_refs();
+    void _allocate_marked(gc_object* obj);
+    void _mark_slot(gc_object* obj, const void* slot);
+    // out of line, so that the code of gc_mark stays small
+#ifdef __GNUC__
+    __attribute__((noinline))
+#endif
+    void _visit_slot(gc_object* obj, const void* slot) {
+      visitor_->visit_slot(slot, obj);
+    }
+    void _promote_marked(gc_object* head);
+    // the steps of the collection, instantiated on the tracer and the
+    // emitter by basic_gc; the others use the config and emitter_
+    template <typename Tracer> void _sweep(gc_stats& stats) {
+      _sweep_step<Tracer>(stats, HUGE_VAL);
+    }
+    void _sweep(gc_stats& stats) { _sweep<config_tracer>(stats); }
+    template <typename Allocator> void* _allocate(size_t sz, int flags,
+						  cluster* c = NULL);
+    void _check_memory_pressure();
+    // also checks if the heap is nearing the limit
+    static size_t _memory_check_interval(const config& conf) {
+      size_t interval = conf.memory_pressure_ratio() > 0
+	? conf.memory_check_interval_bytes() : SIZE_MAX;
+      if (conf.heap_limit_bytes() != 0
+	  && conf.heap_limit_bytes() / 16 < interval)
+	interval = conf.heap_limit_bytes() / 16;
+      return interval;
+    }
+    bool _exceeds_limit(size_t sz) const {
+      return heap_bytes_ + sz > heap_limit_;
+    }
+    void _heap_limit_reached(size_t sz, int flags);
+    // called before the heap grows by sz; the collection run if it would
+    // exceed the limit changes the free space
+    void _heap_reserve(size_t sz, int flags) {
+      if (_exceeds_limit(sz))
+	_heap_limit_reached(sz, flags);
+    }
+    void _limit_gc() {
+      limit_gc_ = true;
+      trigger_gc();
+    }
+    static bool _read_size(const char* fn, size_t& v);
+    void _heap_grow(size_t sz) {
+      heap_bytes_ += sz;
+      if (heap_bytes_ > peak_heap_bytes_)
+	peak_heap_bytes_ = heap_bytes_;
+    }
+    // memory for the objects and the chunks
+    void* _heap_alloc(size_t sz) {
+      return conf_.allocator() != NULL
+	? conf_.allocator()->allocate(sz) : ::operator new(sz);
+    }
+    void _heap_free(void* p, size_t sz) {
+      if (conf_.allocator() != NULL)
+	conf_.allocator()->free(p, sz);
+      else
+	::operator delete(p);
+    }
+    // frees an object linked to the lists (after destruction)
+    void _free_object(gc_object* obj) {
+      if (recorder_ != NULL)
+	recorder_->freed(this, obj);
+      size_t size = _object_size(obj);
+      bytes_freed_ += size;
+      if (conf_.arena_chunk_size() == 0) {
+	heap_bytes_ -= size;
+	if (conf_.allocator() == NULL) {
+	  ::operator delete(static_cast<void*>(obj));
+	} else {
+	  free_blocks_[num_free_blocks_++] = obj;
+	  if (num_free_blocks_ == _NUM_FREE_BLOCKS)
+	    _flush_free_blocks();
+	}
+      }
+    }
+    void _flush_free_blocks() {
+      if (num_free_blocks_ != 0) {
+	conf_.allocator()->free_bulk(free_blocks_, num_free_blocks_);
+	num_free_blocks_ = 0;
+      }
+    }
+    // size of an object linked to the lists (those in the arena are
+    // preceded by their size)
+    size_t _object_size(gc_object* obj) const {
+      if (conf_.arena_chunk_size() != 0)
+	return reinterpret_cast<size_t*>(obj)[-1];
+      if (conf_.allocator() != NULL)
+	return conf_.allocator()->usable_size(obj);
+      return _malloc_size(obj);
+    }
+    static size_t _malloc_size(void* p) {
+#ifdef __APPLE__
+      return malloc_size(p);
+#else
+      return malloc_usable_size(p);
+#endif
+    }
+    void _sample(gc_object* obj, size_t sz);
+    void* _arena_allocate(size_t sz, int flags);
+    void _arena_new_chunk(int flags);
+    void _arena_reserve(size_t sz, size_t n, int flags);
+    cluster* _find_cluster(const gc_object* obj);
+    void* _cluster_allocate(cluster& c, size_t sz, int flags);
+    gc_object* _allocate_batch(size_t sz, size_t n, int flags);
+    gc_object* _atomic_chunk_allocate(size_t sz, int flags);
+    void _sweep_atomic_chunk(_atomic_chunk* c, gc_stats& stats);
+    void _free_atomic_chunks(bool recycle_chunks);
+    gc_object* _movable_allocate(size_t sz, int flags);
+    char* _movable_bump(size_t step);
+    size_t _movable_chunk_size(size_t step) const;
+    _movable_chunk* _movable_new_chunk(size_t size);
+    static char* _movable_first(_movable_chunk* c) {
+      return reinterpret_cast<char*>(c) + _MOVABLE_CHUNK_HEADER_SIZE + 16;
+    }
+    static gc_object** _handle_of(gc_object* obj);
+    static gc_object** _movable_handle(gc_object* obj);
+    gc_object** _handle_allocate();
+    void _handle_free(gc_object** h) {
+      *h = reinterpret_cast<gc_object*>(free_handles_);
+      free_handles_ = h;
+    }
+    void _link_handles(gc_object** block);
+    void _rescan_movable(_movable_chunk* c, char* end, gc_stats& stats);
+    void _sweep_movable_chunk(_movable_chunk* c, gc_stats& stats);
+    void _release_movable_chunks();
+    double _movable_fragmentation() const;
+    void _pin_locals(bool pin);
+    void _pin_locals(_stack<gc_object*>& stack, bool pin);
+    gc_compaction _compact();
+    void _free_movable(bool recycle);
+    intptr_t* _transfer_marked(gc_object** head, gc& target);
+    size_t _count_marked(gc_object* head, gc_visitor* visitor);
+    void _link_young(gc_object* head, gc_object* last, size_t n, size_t bytes);
+    // the roots of the running context (if c is NULL), or of a context
+    // (see root_context)
+    scope* _scopes_of(root_context* c) {
+      return c == NULL ? scope_ : c->scope_;
+    }
+    _stack<gc_object*>& _locals_of(root_context* c) {
+      return c == NULL ? stack_ : c->stack_;
+    }
+    root_context* _next_context(root_context* c) {
+      return c == NULL ? contexts_ : c->next_;
+    }
+    void _mark_young(bool marked);
+    void _mark_young(scope* scope, bool marked);
+    void _trace_young(scope* scope, bool count);
+    size_t _mark_locals(_stack<gc_object*>& stack);
+    void _rescan_list(gc_object* head, gc_stats& stats);
+    static void _clear_marks(gc_object* head);
+    void _free_all(bool recycle_chunks);
+    template <typename Tracer, typename Emitter> void _begin_cycle(Emitter& e);
+    void _begin_cycle() { _begin_cycle<config_tracer>(*emitter_); }
+    template <typename Emitter> void _scan_roots(Emitter& e);
+    void _scan_roots() { _scan_roots(*emitter_); }
+    void _marked();
+    void _begin_concurrent_cycle();
+    void _remark();
+    void _finish_concurrent_cycle();
+    void _start_gc();
+    template <typename Emitter> void _end_cycle(Emitter& e, bool compact);
+    void _end_cycle(bool compact = false) { _end_cycle(*emitter_, compact); }
+    void _sweep_start();
+    template <typename Tracer>
+    bool _sweep_step(gc_stats& stats, double deadline);
+    bool _sweep_step(gc_stats& stats, double deadline) {
+      return _sweep_step<config_tracer>(stats, deadline);
+    }
+    template <typename Tracer>
+    bool _sweep_list_step(gc_stats& stats, double deadline);
+    bool _sweep_batch_add(gc_object* obj);
+    void _sweep_batch_flush();
   };
   
   class gc_object {
@@ -266,200 +1240,2474 @@ namespace picogc {
     bool gc_is_marked() const { return (next_ & _FLAG_MARKED) != 0; }
     static void* operator new(size_t sz);
     static void* operator new(size_t sz, int flags);
+    // allocates from given heap instead of gc::top(), with its fast path
+    // (the heap should have a scope open unless IMMEDIATELY_TRACEABLE)
+    static void* operator new(size_t sz, gc& gc, int flags = 0);
+    template <typename E, typename P, typename A, typename T>
+    static void* operator new(size_t sz, basic_gc<E, P, A, T>& gc,
+			      int flags = 0) {
+      return gc.allocate(sz, flags);
+    }
+    // allocates the object followed by the elements (see trailing)
+    template <typename E>
+    static void* operator new(size_t sz, const trailing<E>& t,
+			      int flags = 0);
+    static void* operator new(size_t sz, const near& hint, int flags = 0);
     static void operator delete(void* p);
     static void operator delete(void* p, int flags);
+    static void operator delete(void* p, gc&, int);
+    static void operator delete(void* p, const near&, int);
+    template <typename E, typename P, typename A, typename T>
+    static void operator delete(void* p, basic_gc<E, P, A, T>&, int) {
+      operator delete(p);
+    }
+    template <typename E>
+    static void operator delete(void* p, const trailing<E>&, int) {
+      operator delete(p);
+    }
   private:
     static void* operator new(size_t, void* buf) { return buf; }
   };
   
-  template <typename T>
-  inline local<T>::local(T* obj) : slot_(gc::top()->_acquire_local_slot())
+  // calls the hooks of Emitter without the virtual dispatch, so that the
+  // empty ones compile to nothing
+  template <typename Emitter> class _static_emitter {
+    Emitter& e_;
+  public:
+    _static_emitter(Emitter& e) : e_(e) {}
+    void gc_start(gc* gc) { e_.Emitter::gc_start(gc); }
+    void gc_end(gc* gc, const gc_stats& stats) {
+      e_.Emitter::gc_end(gc, stats);
+    }
+    void setup_new_start(gc* gc) { e_.Emitter::setup_new_start(gc); }
+    void setup_new_end(gc* gc) { e_.Emitter::setup_new_end(gc); }
+    void setup_local_start(gc* gc) { e_.Emitter::setup_local_start(gc); }
+    void setup_local_end(gc* gc) { e_.Emitter::setup_local_end(gc); }
+    void mark_start(gc* gc) { e_.Emitter::mark_start(gc); }
+    void mark_end(gc* gc) { e_.Emitter::mark_end(gc); }
+    void sweep_start(gc* gc) { e_.Emitter::sweep_start(gc); }
+    void sweep_end(gc* gc) { e_.Emitter::sweep_end(gc); }
+    void compact_start(gc* gc) { e_.Emitter::compact_start(gc); }
+    void compact_end(gc* gc, const gc_compaction& r) {
+      e_.Emitter::compact_end(gc, r);
+    }
+  };
+
+  // collector with the policies fixed at compile time; objects are
+  // allocated from it by new (gc) T or new (gc, flags) T.  The allocation
+  // and the pacing are inlined, and trigger_gc (also run by may_trigger_gc,
+  // the heap limit and the memory pressure) is instantiated on Tracer and
+  // Emitter, whose hooks (those of gc_emitter; the default ones are empty)
+  // are called statically.  gc_mark still receives the heap as gc*, so the
+  // tracing of the objects is shared with gc.  collect_for and the
+  // concurrent cycles are not specialized, and report to the emitter
+  // registered by gc::emitter
+  template <typename Emitter, typename Pacing, typename Allocator,
+	    typename Tracer>
+  class basic_gc : public gc {
+    Emitter emitter_policy_;
+  public:
+    basic_gc(const config& conf = config(),
+	     const Emitter& emitter_policy = Emitter())
+      : gc(_configure(conf)), emitter_policy_(emitter_policy) {}
+    void* allocate(size_t sz, int flags) {
+      if ((flags & MAY_TRIGGER_GC) != 0)
+	may_trigger_gc();
+      return _allocate<Allocator>(sz, flags);
+    }
+    void trigger_gc() {
+      _static_emitter<Emitter> e(emitter_policy_);
+      _collect<Tracer>(e);
+    }
+    void may_trigger_gc() {
+      if (num_constructing_ != 0) {
+	gc_deferred_ = true;
+	return;
+      }
+      if (marking_ && _marker_done())
+	_finish_concurrent_cycle();
+      if (bytes_allocated_since_gc_ >= Pacing::gc_interval_bytes(conf_)) {
+	if (conf_.concurrent_marking())
+	  _start_gc();
+	else
+	  trigger_gc();
+      } else if (bytes_allocated_since_gc_ >= next_memory_check_) {
+	_check_memory_pressure();
+      }
+    }
+    Emitter& emitter_policy() { return emitter_policy_; }
+  private:
+    virtual void _trigger_gc() { trigger_gc(); }
+    // so that the code paths not specialized agree with the policies
+    static config _configure(config conf) {
+      return conf
+	.gc_interval_bytes(Pacing::gc_interval_bytes(conf))
+	.arena_chunk_size(Allocator::arena_chunk_size(conf))
+	.atomic_chunks(Allocator::atomic_chunks(conf))
+	.allocator(Allocator::allocator(conf))
+	.mark_stack_size(Tracer::mark_stack_size(conf))
+	.batched_sweep(Tracer::batched_sweep(conf));
+    }
+  };
+
+  // variable-length objects: new (picogc::trailing<E>(n)) T allocates an
+  // object of T followed by n elements of E, that are reached by
+  // trailing_elements<E>(obj)
+  template <typename E> struct trailing {
+    size_t n;
+    explicit trailing(size_t n) : n(n) {}
+    // offset of the elements from the object of given size
+    static size_t offset(size_t sz) {
+      struct probe {
+	char c;
+	E e;
+      };
+      size_t align = sizeof(probe) - sizeof(E);
+      return (sz + align - 1) / align * align;
+    }
+  };
+
+  template <typename E>
+  inline void* gc_object::operator new(size_t sz, const trailing<E>& t,
+				       int flags)
   {
-    *slot_ = obj;
+    return gc::top()->allocate(trailing<E>::offset(sz) + t.n * sizeof(E),
+			       flags);
   }
 
-  template <typename T>
-  inline local<T>::local(const local<T>& x)
-  : slot_(gc::top()->_acquire_local_slot())
+  template <typename E, typename T> inline E* trailing_elements(T* obj)
   {
-    *slot_ = *x.slot_;
+    return reinterpret_cast<E*>(reinterpret_cast<char*>(obj)
+				+ trailing<E>::offset(sizeof(T)));
   }
 
-  inline scope::scope() : new_head_(NULL), new_tail_slot_(NULL)
+  template <typename E> struct _is_gc_pointer {
+    static char test(const volatile gc_object*);
+    static long test(...);
+    static E& make();
+    enum { value = sizeof(test(make())) == 1 };
+  };
+
+  template <typename E, bool = _is_gc_pointer<E>::value>
+  struct _array_marker {
+    static void mark(gc*, E*, size_t) {}
+  };
+
+  template <typename E> struct _array_marker<E, true> {
+    static void mark(gc* gc, E* elements, size_t n) {
+      for (size_t i = 0; i != n; ++i)
+	gc->mark(elements[i]);
+    }
+  };
+
+  // an array allocated in one block by make_array; the elements should be
+  // trivially copyable, and are zero-filled.  Pointers to gc_object are
+  // marked; arrays of other types are atomic.
+  template <typename E> class array : public gc_object {
+    size_t size_;
+  public:
+    explicit array(size_t n) : size_(n) {
+      if (! _is_gc_pointer<E>::value) // atomic objects are not zero-filled
+	memset(static_cast<void*>(elements()), 0, n * sizeof(E));
+    }
+    size_t size() const { return size_; }
+    E* elements() { return trailing_elements<E>(this); }
+    const E* elements() const {
+      return trailing_elements<E>(const_cast<array*>(this));
+    }
+    E& operator[](size_t i) { return elements()[i]; }
+    const E& operator[](size_t i) const { return elements()[i]; }
+    virtual void gc_mark(gc* gc) {
+      _array_marker<E>::mark(gc, elements(), size_);
+    }
+  };
+
+  template <typename E> inline array<E>* make_array(size_t n, int flags = 0)
   {
-    gc* gc = gc::top();
-    prev_ = gc->scope_;
-    gc->scope_ = this;
-    stack_state_ = gc->stack_.preserve();
+    if (! _is_gc_pointer<E>::value)
+      flags |= IS_ATOMIC;
+    return new (trailing<E>(n), flags | TRIVIALLY_DESTRUCTIBLE) array<E>(n);
   }
-  
-  inline void scope::_destruct(gc* gc)
+
+  // if T overrides gc_mark; &T::gc_mark points to a member of the class
+  // declaring it.  Named through a subclass, so that a protected gc_mark is
+  // accessible (a private one fails to compile here, by its name)
+  template <typename T> struct _gc_mark_should_not_be_private : T {
+    static char test(void (gc_object::*)(gc*));
+    static long test(...);
+    enum {
+      value = sizeof(test(&_gc_mark_should_not_be_private::gc_mark)) != 1
+    };
+  };
+
+  template <typename T> struct _has_gc_members {
+    enum { value = _gc_mark_should_not_be_private<T>::value };
+  };
+
+  template <typename A, typename B> struct _is_same {};
+  template <typename A> struct _is_same<A, A> {
+    typedef char yes;
+  };
+
+  // if T declares that its destructor does nothing, by
+  // typedef T gc_trivially_destructible; (the destructors of the types
+  // deriving from it are not, as the typedef names another type)
+  template <typename T> struct _is_trivially_destructible {
+    template <typename U> static typename _is_same<
+      typename U::gc_trivially_destructible, U>::yes test(int);
+    template <typename U> static long test(...);
+    enum { value = sizeof(test<T>(0)) == 1 };
+  };
+
+  template <typename T> inline int _make_flags(int flags)
   {
-    gc->stack_.restore(stack_state_);
-    gc->scope_ = prev_;
-    if (new_head_ != NULL) {
-      *new_tail_slot_ |= reinterpret_cast<intptr_t>(gc->obj_head_);
-      gc->obj_head_ = new_head_;
-    }
+    // the destructor of T may not be skipped unless declared so
+    assert((flags & TRIVIALLY_DESTRUCTIBLE) == 0
+	   || _is_trivially_destructible<T>::value);
+    if (_is_trivially_destructible<T>::value)
+      flags |= TRIVIALLY_DESTRUCTIBLE;
+    return _has_gc_members<T>::value ? flags : flags | IS_ATOMIC;
   }
 
-  inline scope::~scope()
+  // make<T>(flags, args...) allocates an object of T from gc::top() and
+  // constructs it with up to 4 arguments; atomic unless T overrides gc_mark,
+  // and trivially destructible if T declares so.  The object is not
+  // zero-filled, since gc_mark is not called while it is being constructed
+  // (the collections triggered by the constructor are deferred until the
+  // outermost make returns, and gc::trigger_gc should not be called).
+  // member, movable and compressed_ptr initialize themselves; raw pointers
+  // marked by gc_mark should be set by the constructor
+  template <typename T> inline T* make(int flags = 0)
   {
     gc* gc = gc::top();
-    if (stack_state_ != NULL)
-      _destruct(gc);
-    gc->may_trigger_gc();
+    void* p = gc->_begin_construction(sizeof(T), _make_flags<T>(flags));
+    try {
+      ::new (p) T;
+    } catch (...) {
+      gc->_abort_construction(p);
+      throw;
+    }
+    return gc->_end_construction(static_cast<T*>(p));
   }
-  
-  template <typename T> inline T* scope::close(T* obj) {
+
+  template <typename T, typename A1>
+  inline T* make(int flags, const A1& a1)
+  {
     gc* gc = gc::top();
-    // destruct the frame, and push the returning value on the prev frame
-    _destruct(gc);
-    stack_state_ = NULL;
-    *gc->stack_.push() = static_cast<gc_object*>(obj);
-    return obj;
+    void* p = gc->_begin_construction(sizeof(T), _make_flags<T>(flags));
+    try {
+      ::new (p) T(a1);
+    } catch (...) {
+      gc->_abort_construction(p);
+      throw;
+    }
+    return gc->_end_construction(static_cast<T*>(p));
   }
-  
-  inline gc::~gc()
+
+  template <typename T, typename A1, typename A2>
+  inline T* make(int flags, const A1& a1, const A2& a2)
   {
-    // free all objs
-    for (gc_object* o = obj_head_; o != NULL; ) {
-      gc_object* next = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK);
-      o->~gc_object();
-      ::operator delete(static_cast<void*>(o));
-      o = next;
+    gc* gc = gc::top();
+    void* p = gc->_begin_construction(sizeof(T), _make_flags<T>(flags));
+    try {
+      ::new (p) T(a1, a2);
+    } catch (...) {
+      gc->_abort_construction(p);
+      throw;
     }
+    return gc->_end_construction(static_cast<T*>(p));
   }
-  
-  inline void* gc::allocate(size_t sz, int flags)
+
+  template <typename T, typename A1, typename A2, typename A3>
+  inline T* make(int flags, const A1& a1, const A2& a2, const A3& a3)
   {
-    bytes_allocated_since_gc_ += sz;
-    if ((flags & MAY_TRIGGER_GC) != 0) {
-      may_trigger_gc();
-    }
-    gc_object* p = static_cast<gc_object*>(::operator new(sz));
-    // GC might walk through the object during construction
-    if ((flags & IS_ATOMIC) == 0) {
-      memset(static_cast<void*>(p), 0, sz);
-    }
-    // register to GC list
-    if ((flags & IMMEDIATELY_TRACEABLE) != 0) {
-      p->next_ = reinterpret_cast<intptr_t>(obj_head_)
-          | ((flags & IS_ATOMIC) != 0 ? 0 : _FLAG_HAS_GC_MEMBERS);
-      obj_head_ = p;
-    } else {
-      scope* scope = scope_;
-      if (scope->new_head_ == NULL)
-        scope->new_tail_slot_ = &p->next_;
-      p->next_ = reinterpret_cast<intptr_t>(scope->new_head_)
-          | ((flags & IS_ATOMIC) != 0 ? 0 : _FLAG_HAS_GC_MEMBERS);
-      scope->new_head_ = p;
+    gc* gc = gc::top();
+    void* p = gc->_begin_construction(sizeof(T), _make_flags<T>(flags));
+    try {
+      ::new (p) T(a1, a2, a3);
+    } catch (...) {
+      gc->_abort_construction(p);
+      throw;
     }
-    return p;
+    return gc->_end_construction(static_cast<T*>(p));
   }
-  
-  inline void gc::_mark(gc_stats& stats)
+
+  template <typename T, typename A1, typename A2, typename A3, typename A4>
+  inline T* make(int flags, const A1& a1, const A2& a2, const A3& a3,
+		 const A4& a4)
   {
-    // mark all the objects
-    gc_object** slot;
-    while ((slot = pending_.pop()) != NULL) {
-      // request deferred marking of the properties
-      stats.slowly_marked++;
-      (*slot)->gc_mark(this);
+    gc* gc = gc::top();
+    void* p = gc->_begin_construction(sizeof(T), _make_flags<T>(flags));
+    try {
+      ::new (p) T(a1, a2, a3, a4);
+    } catch (...) {
+      gc->_abort_construction(p);
+      throw;
+    }
+    return gc->_end_construction(static_cast<T*>(p));
+  }
+
+  template <typename T>
+  inline void gc::allocate_batch(size_t n, T** objs, int flags)
+  {
+    assert((flags & MOVABLE) == 0);
+    if (n == 0)
+      return;
+    if ((flags & MAY_TRIGGER_GC) != 0)
+      may_trigger_gc();
+    gc_object* p = _allocate_batch(sizeof(T), n, flags);
+    size_t i = 0;
+    try {
+      for (; i != n; ++i) {
+	gc_object* next = reinterpret_cast<gc_object*>(p->next_ & ~_FLAG_MASK);
+	objs[i] = new (static_cast<void*>(p)) T;
+	p = next;
+      }
+    } catch (...) {
+      // vtbl should point to an empty dtor (as do the ones not constructed)
+      new (static_cast<void*>(p)) gc_object;
+      throw;
+    }
+  }
+
+  template <typename T>
+  inline local<T>::local(T* obj) : slot_(gc::top()->_acquire_local_slot())
+  {
+    *slot_ = obj;
+  }
+
+  template <typename T>
+  inline local<T>::local(const local<T>& x)
+  : slot_(gc::top()->_acquire_local_slot())
+  {
+    *slot_ = *x.slot_;
+  }
+
+  template <typename T> inline member<T>::member(T* obj)
+  {
+    __atomic_store_n(&ptr_, static_cast<gc_object*>(obj), __ATOMIC_RELEASE);
+    if (obj != NULL)
+      gc::_write_barrier(obj);
+  }
+
+  template <typename T> inline member<T>::member(const member<T>& x)
+  {
+    T* obj = x.get();
+    __atomic_store_n(&ptr_, static_cast<gc_object*>(obj), __ATOMIC_RELEASE);
+    if (obj != NULL)
+      gc::_write_barrier(obj);
+  }
+
+  template <typename T> inline member<T>& member<T>::operator=(T* obj)
+  {
+    __atomic_store_n(&ptr_, static_cast<gc_object*>(obj), __ATOMIC_RELEASE);
+    if (obj != NULL)
+      gc::_write_barrier(obj);
+    return *this;
+  }
+
+  template <typename T> inline compressed_ptr<T>::compressed_ptr(T* obj)
+  {
+    __atomic_store_n(&offset_, _compress(obj), __ATOMIC_RELEASE);
+    if (obj != NULL)
+      gc::_write_barrier(obj);
+  }
+
+  template <typename T>
+  inline compressed_ptr<T>::compressed_ptr(const compressed_ptr<T>& x)
+  {
+    uint32_t offset = __atomic_load_n(&x.offset_, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&offset_, offset, __ATOMIC_RELEASE);
+    if (offset != 0)
+      gc::_write_barrier(_decompress(offset));
+  }
+
+  template <typename T>
+  inline compressed_ptr<T>& compressed_ptr<T>::operator=(T* obj)
+  {
+    __atomic_store_n(&offset_, _compress(obj), __ATOMIC_RELEASE);
+    if (obj != NULL)
+      gc::_write_barrier(obj);
+    return *this;
+  }
+
+  template <typename T> inline movable<T>::movable(T* obj)
+    : handle_(obj != NULL ? gc::_handle_of(obj) : NULL)
+  {
+    assert(handle_ == NULL || *handle_ == obj);
+    if (handle_ != NULL)
+      gc::_write_barrier(obj);
+  }
+
+  template <typename T> inline movable<T>::movable(const movable<T>& x)
+    : handle_(x.handle_)
+  {
+    if (handle_ != NULL)
+      gc::_write_barrier(*handle_);
+  }
+
+  template <typename T>
+  inline movable<T>& movable<T>::operator=(const movable<T>& x)
+  {
+    __atomic_store_n(&handle_, x.handle_, __ATOMIC_RELEASE);
+    if (x.handle_ != NULL)
+      gc::_write_barrier(*x.handle_);
+    return *this;
+  }
+
+  inline scope::scope()
+    : new_head_(NULL), new_tail_slot_(NULL), num_new_(0), new_bytes_(0)
+  {
+    gc* gc = gc::top();
+    prev_ = gc->scope_;
+    gc->scope_ = this;
+    stack_state_ = gc->stack_.preserve();
+    if (gc->recorder_ != NULL)
+      gc->recorder_->scope_opened(gc);
+  }
+  
+  inline void scope::_destruct(gc* gc)
+  {
+    if (gc->recorder_ != NULL)
+      gc->recorder_->scope_closed(gc);
+    gc->stack_.restore(stack_state_);
+    gc->scope_ = prev_;
+    if (new_head_ != NULL) {
+      // the objects become old; the marks given at allocation are cleared
+      // here rather than by every collection run while the scope is alive
+      // (or by the sweep, if they leave while marking concurrently)
+      if (gc->marking_) {
+	gc->_promote_marked(new_head_);
+	// the marker thread may be reading the tail (that is marked, so that
+	// the marker does not write it)
+	__atomic_store_n(new_tail_slot_,
+			 *new_tail_slot_
+			 | reinterpret_cast<intptr_t>(gc->obj_head_),
+			 __ATOMIC_RELAXED);
+      } else {
+	gc->_clear_marks(new_head_);
+	*new_tail_slot_ |= reinterpret_cast<intptr_t>(gc->obj_head_);
+      }
+      gc->obj_head_ = new_head_;
+    }
+  }
+
+  inline scope::~scope()
+  {
+    gc* gc = gc::top();
+    if (stack_state_ != NULL)
+      _destruct(gc);
+    gc->may_trigger_gc();
+  }
+  
+  template <typename T> inline T* scope::close(T* obj) {
+    gc* gc = gc::top();
+    // destruct the frame, and push the returning value on the prev frame
+    _destruct(gc);
+    stack_state_ = NULL;
+    *gc->stack_.push() = static_cast<gc_object*>(obj);
+    return obj;
+  }
+
+  inline root_context::root_context()
+    : gc_(gc::top()), stack_(), scope_(NULL), prev_(NULL),
+      next_(gc_->contexts_), attached_(false)
+  {
+    if (next_ != NULL)
+      next_->prev_ = this;
+    gc_->contexts_ = this;
+  }
+
+  inline root_context::root_context(gc& gc)
+    : gc_(&gc), stack_(), scope_(NULL), prev_(NULL), next_(gc.contexts_),
+      attached_(false)
+  {
+    if (next_ != NULL)
+      next_->prev_ = this;
+    gc.contexts_ = this;
+  }
+
+  inline root_context::~root_context()
+  {
+    assert(! attached_);
+    assert(scope_ == NULL);
+    if (gc_ == NULL)
+      return;
+    if (prev_ != NULL)
+      prev_->next_ = next_;
+    else
+      gc_->contexts_ = next_;
+    if (next_ != NULL)
+      next_->prev_ = prev_;
+  }
+
+  inline void root_context::attach()
+  {
+    assert(! attached_);
+    gc_->stack_.swap(stack_);
+    std::swap(gc_->scope_, scope_);
+    attached_ = true;
+  }
+
+  inline void root_context::detach()
+  {
+    assert(attached_);
+    gc_->stack_.swap(stack_);
+    std::swap(gc_->scope_, scope_);
+    attached_ = false;
+  }
+  
+  inline gc::~gc()
+  {
+    // finish the collection in progress so that the list is reconnected
+    if (marking_)
+      _remark();
+    if (sweeping_)
+      _sweep(cycle_stats_);
+    _stop_marker();
+    --globals::num_heaps;
+    delete dirty_objects_;
+    delete dirty_refs_;
+    if (sampler_ != NULL)
+      sampler_->cleared(this);
+    _free_all(false);
+    while (free_chunks_ != NULL) {
+      _chunk* next = free_chunks_->next;
+      _heap_free(free_chunks_, free_chunks_->size);
+      free_chunks_ = next;
+    }
+    delete [] mark_stack_;
+    for (gc_roots* r = roots_; r != NULL; r = r->next_)
+      r->gc_ = NULL;
+    for (root_context* c = contexts_; c != NULL; c = c->next_)
+      c->gc_ = NULL;
+  }
+
+  inline void gc::reset()
+  {
+    assert(scope_ == NULL);
+    if (marking_)
+      _remark();
+    if (sweeping_) {
+      _sweep(cycle_stats_);
+      sweeping_ = false;
+    }
+    // nothing is marked; all the samples are reported as being collected,
+    // and the weak references are cleared
+    if (sampler_ != NULL) {
+      sampler_->mark_end(this);
+      sampler_->cleared(this);
+    }
+    for (gc_roots* r = roots_; r != NULL; r = r->next_)
+      r->gc_clear_weak(this);
+    _free_all(true);
+    stack_.clear();
+    for (root_context* c = contexts_; c != NULL; c = c->next_) {
+      assert(c->scope_ == NULL);
+      c->stack_.clear();
+    }
+    bytes_allocated_since_gc_ = 0;
+  }
+
+  inline void gc::_free_all(bool recycle_chunks)
+  {
+    bool in_arena = conf_.arena_chunk_size() != 0;
+    // free all objs; objects in the arena are not visited once all the
+    // objects that require destruction are destroyed
+    for (gc_object* o = obj_head_;
+	 o != NULL && ! (in_arena && num_finalizable_ == 0); ) {
+      gc_object* next = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK);
+      if ((o->next_ & _FLAG_NO_DTOR) == 0) {
+	o->~gc_object();
+	num_finalizable_--;
+      }
+      if (! in_arena)
+	_free_object(o);
+      o = next;
+    }
+    if (num_free_blocks_ != 0)
+      _flush_free_blocks();
+    obj_head_ = NULL;
+    num_finalizable_ = 0;
+    bytes_freed_ = bytes_allocated_;
+    _free_atomic_chunks(recycle_chunks);
+    _free_movable(recycle_chunks);
+    // release the chunks; those of the standard size are kept for reuse
+    while (chunks_ != NULL) {
+      _chunk* next = chunks_->next;
+      if (recycle_chunks && chunks_->size == conf_.arena_chunk_size()) {
+	chunks_->next = free_chunks_;
+	free_chunks_ = chunks_;
+      } else {
+	heap_bytes_ -= chunks_->size;
+	_heap_free(chunks_, chunks_->size);
+      }
+      chunks_ = next;
+    }
+    arena_cur_ = arena_end_ = NULL;
+    for (size_t i = 0; i != _NUM_CLUSTERS; ++i) {
+      clusters_[i] = cluster();
+      cluster_origins_[i] = NULL;
+    }
+  }
+  
+  inline void* gc::allocate(size_t sz, int flags)
+  {
+    if ((flags & MAY_TRIGGER_GC) != 0) {
+      may_trigger_gc();
+    }
+    return _allocate<config_allocator>(sz, flags);
+  }
+
+  inline void* gc::allocate_near(size_t sz, int flags, const near& hint)
+  {
+    if ((flags & MAY_TRIGGER_GC) != 0) {
+      may_trigger_gc();
+    }
+    cluster* c = NULL;
+    if (conf_.arena_chunk_size() != 0)
+      c = hint.region != NULL ? hint.region : _find_cluster(hint.obj);
+    return _allocate<config_allocator>(sz, flags, c);
+  }
+
+  template <typename Allocator>
+  inline void* gc::_allocate(size_t sz, int flags, cluster* c)
+  {
+    gc_object* p;
+    if ((flags & IS_ATOMIC) != 0 && Allocator::atomic_chunks(conf_)
+	&& sz <= _NUM_SIZE_CLASSES * 8) {
+      // not linked; young objects are kept alive by the local stack
+      p = _atomic_chunk_allocate(sz, flags);
+      if ((flags & IMMEDIATELY_TRACEABLE) == 0)
+	*stack_.push() = p;
+    } else if ((flags & MOVABLE) != 0) {
+      // neither; not moved while young, since it is on the local stack
+      p = _movable_allocate(sz, flags);
+      if ((flags & IMMEDIATELY_TRACEABLE) == 0)
+	*stack_.push() = p;
+    } else {
+      size_t allocated;
+      if (Allocator::arena_chunk_size(conf_) != 0) {
+	p = static_cast<gc_object*>(c != NULL
+				    ? _cluster_allocate(*c, sz, flags)
+				    : _arena_allocate(sz, flags));
+	allocated = reinterpret_cast<size_t*>(p)[-1];
+      } else {
+	_heap_reserve(sz, flags);
+	gc_allocator* a = Allocator::allocator(conf_);
+	if (a == NULL) {
+	  p = static_cast<gc_object*>(::operator new(sz));
+	  allocated = _malloc_size(p);
+	} else {
+	  p = static_cast<gc_object*>(a->allocate(sz));
+	  allocated = a->usable_size(p);
+	}
+	bytes_allocated_ += allocated;
+	_heap_grow(allocated);
+      }
+      // GC might walk through the object during construction
+      if ((flags & (IS_ATOMIC | _NOT_ZERO_FILLED)) == 0) {
+	memset(static_cast<void*>(p), 0, sz);
+      }
+      intptr_t obj_flags = ((flags & IS_ATOMIC) != 0 ? 0 : _FLAG_HAS_GC_MEMBERS)
+	| ((flags & TRIVIALLY_DESTRUCTIBLE) != 0 ? _FLAG_NO_DTOR : 0);
+      num_finalizable_ += (flags & TRIVIALLY_DESTRUCTIBLE) == 0;
+      // register to GC list
+      if ((flags & IMMEDIATELY_TRACEABLE) != 0) {
+	p->next_ = reinterpret_cast<intptr_t>(obj_head_) | obj_flags;
+	obj_head_ = p;
+	if (marking_)
+	  _allocate_marked(p);
+      } else {
+	p->next_ = obj_flags | _FLAG_MARKED;
+	_link_young(p, p, 1, allocated);
+      }
+    }
+    // accounted once the heap has room for it (the collection run if not
+    // clears the counter)
+    bytes_requested_ += sz;
+    bytes_allocated_since_gc_ += sz;
+    // sampling is disabled by setting the counter to SIZE_MAX
+    if (sz < bytes_until_sample_) {
+      bytes_until_sample_ -= sz;
+    } else {
+      _sample(p, sz);
+    }
+    if (recorder_ != NULL)
+      recorder_->allocated(this, p, sz, flags);
+#ifdef __GNUC__
+    // the header is written before the ctor runs; keep the compiler from
+    // discarding the stores as dead (-flifetime-dse)
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+#endif
+    return p;
+  }
+  
+  // returns the objects linked (in the order they are put on the list),
+  // zero-filled (unless atomic) and initialized as gc_object
+  inline gc_object* gc::_allocate_batch(size_t sz, size_t n, int flags)
+  {
+    intptr_t obj_flags = ((flags & IS_ATOMIC) != 0 ? 0 : _FLAG_HAS_GC_MEMBERS)
+      | ((flags & TRIVIALLY_DESTRUCTIBLE) != 0 ? _FLAG_NO_DTOR : 0);
+    if ((flags & IMMEDIATELY_TRACEABLE) == 0)
+      obj_flags |= _FLAG_MARKED;
+    if ((flags & TRIVIALLY_DESTRUCTIBLE) == 0)
+      num_finalizable_ += n;
+    gc_object* head = NULL, * last = NULL;
+    size_t bytes;
+    // batches are always linked to the lists (even if atomic), so that
+    // they can be spliced at once
+    if (conf_.arena_chunk_size() != 0) {
+      size_t step = (sz + sizeof(size_t) + 15) & ~(size_t)15;
+      bytes = step * n;
+      _arena_reserve(sz, n, flags);
+      // no collection while the objects are not linked
+      flags &= ~MAY_TRIGGER_GC;
+      for (size_t i = 0; i != n; ) {
+	// take as many as the current chunk has room for
+	size_t k = (arena_end_ - arena_cur_) / step;
+	if (k > n - i)
+	  k = n - i;
+	char* p;
+	if (k != 0) {
+	  p = arena_cur_;
+	  arena_cur_ += k * step;
+	  bytes_allocated_ += k * step;
+	  if ((flags & IS_ATOMIC) == 0)
+	    memset(p, 0, k * step - sizeof(size_t));
+	  for (size_t j = 0; j != k; ++j)
+	    reinterpret_cast<size_t*>(p + j * step)[-1] = step;
+	} else {
+	  // new chunk
+	  p = static_cast<char*>(_arena_allocate(sz, flags));
+	  if ((flags & IS_ATOMIC) == 0)
+	    memset(p, 0, sz);
+	  k = 1;
+	}
+	for (size_t j = 0; j != k; ++j, p += step) {
+	  gc_object* obj = new (static_cast<void*>(p)) gc_object;
+	  obj->next_ = reinterpret_cast<intptr_t>(head) | obj_flags;
+	  if (last == NULL)
+	    last = obj;
+	  head = obj;
+	}
+	i += k;
+      }
+    } else {
+      size_t allocated = 0;
+      _heap_reserve(sz * n, flags);
+      for (size_t i = 0; i != n; ++i) {
+	void* p = _heap_alloc(sz);
+	allocated += _object_size(static_cast<gc_object*>(p));
+	if ((flags & IS_ATOMIC) == 0)
+	  memset(p, 0, sz);
+	gc_object* obj = new (p) gc_object;
+	obj->next_ = reinterpret_cast<intptr_t>(head) | obj_flags;
+	if (last == NULL)
+	  last = obj;
+	head = obj;
+      }
+      bytes_allocated_ += allocated;
+      _heap_grow(allocated);
+      bytes = allocated;
+    }
+    // splice
+    if ((flags & IMMEDIATELY_TRACEABLE) != 0) {
+      last->next_ |= reinterpret_cast<intptr_t>(obj_head_);
+      obj_head_ = head;
+      for (gc_object* o = head; marking_; o = reinterpret_cast<gc_object*>(
+	     o->next_ & ~_FLAG_MASK)) {
+	_allocate_marked(o);
+	if (o == last)
+	  break;
+      }
+    } else {
+      _link_young(head, last, n, bytes);
+    }
+    bytes_requested_ += sz * n;
+    bytes_allocated_since_gc_ += sz * n;
+    // sampled as one
+    if (sz * n < bytes_until_sample_) {
+      bytes_until_sample_ -= sz * n;
+    } else {
+      _sample(head, sz * n);
+    }
+    if (recorder_ != NULL) {
+      for (gc_object* o = head; o != NULL;
+	   o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
+	recorder_->allocated(this, o, sz, flags);
+	if (o == last)
+	  break;
+      }
+    }
+#ifdef __GNUC__
+    __asm__ __volatile__("" : : "r"(head) : "memory");
+#endif
+    return head;
+  }
+
+  inline void gc::_link_young(gc_object* head, gc_object* last, size_t n,
+				size_t bytes)
+  {
+    scope* scope = scope_;
+    if (scope->new_head_ == NULL) {
+      scope->new_head_ = head;
+      scope->new_tail_slot_ = &last->next_;
+    } else if ((head->next_ & _FLAG_HAS_GC_MEMBERS) != 0) {
+      last->next_ |= reinterpret_cast<intptr_t>(scope->new_head_);
+      scope->new_head_ = head;
+    } else {
+      *scope->new_tail_slot_ |= reinterpret_cast<intptr_t>(head);
+      scope->new_tail_slot_ = &last->next_;
+    }
+    scope->num_new_ += n;
+    scope->new_bytes_ += bytes;
+  }
+
+  // sets (and recounts) or clears the marks of all the young objects
+  inline void gc::_mark_young(bool marked)
+  {
+    _mark_young(scope_, marked);
+    for (root_context* c = contexts_; c != NULL; c = c->next_)
+      _mark_young(c->scope_, marked);
+  }
+
+  inline void gc::_mark_young(scope* scope, bool marked)
+  {
+    for (; scope != NULL; scope = scope->prev_) {
+      if (! marked) {
+	_clear_marks(scope->new_head_);
+	continue;
+      }
+      scope->num_new_ = 0;
+      scope->new_bytes_ = 0;
+      for (gc_object* o = scope->new_head_;
+	   o != NULL;
+	   o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
+	o->next_ |= _FLAG_MARKED;
+	scope->num_new_++;
+	scope->new_bytes_ += _object_size(o);
+      }
+    }
+  }
+
+  // logs the young objects (having GC members) leaving the scope while
+  // marking concurrently, to be rescanned by the remark
+  inline void gc::_promote_marked(gc_object* head)
+  {
+    for (gc_object* o = head;
+	 o != NULL && (o->next_ & _FLAG_HAS_GC_MEMBERS) != 0;
+	 o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK))
+      *dirty_objects_->push() = o;
+  }
+
+  inline void gc::_allocate_marked(gc_object* obj)
+  {
+    obj->next_ |= _FLAG_MARKED;
+    if ((obj->next_ & _FLAG_HAS_GC_MEMBERS) != 0)
+      *dirty_objects_->push() = obj;
+  }
+
+  inline void gc::_clear_marks(gc_object* head)
+  {
+    for (gc_object* o = head;
+	 o != NULL;
+	 o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK))
+      o->next_ &= ~_FLAG_MARKED;
+  }
+
+  inline void* gc::_arena_allocate(size_t sz, int flags)
+  {
+    // each object is preceded by its size, so that the objects are 16 bytes
+    // apart from the chunk header
+    size_t step = (sz + sizeof(size_t) + 15) & ~(size_t)15;
+    if (arena_end_ - arena_cur_ < (ptrdiff_t)step) {
+      size_t chunk_size = conf_.arena_chunk_size();
+      _chunk* c;
+      if (_CHUNK_HEADER_SIZE + 16 + step > chunk_size) {
+	// too large, allocate a dedicated chunk (the current one is retained)
+	_heap_reserve(_CHUNK_HEADER_SIZE + 16 + sz, flags);
+	c = static_cast<_chunk*>(_heap_alloc(_CHUNK_HEADER_SIZE + 16 + sz));
+	c->size = _CHUNK_HEADER_SIZE + 16 + sz;
+	c->next = chunks_;
+	chunks_ = c;
+	_heap_grow(c->size);
+	char* p = reinterpret_cast<char*>(c) + _CHUNK_HEADER_SIZE + 16;
+	reinterpret_cast<size_t*>(p)[-1] = 16 + sz;
+	bytes_allocated_ += 16 + sz;
+	return p;
+      }
+      _arena_new_chunk(flags);
+    }
+    char* p = arena_cur_;
+    reinterpret_cast<size_t*>(p)[-1] = step;
+    bytes_allocated_ += step;
+    arena_cur_ += step;
+    return p;
+  }
+
+  inline void gc::_arena_new_chunk(int flags)
+  {
+    size_t chunk_size = conf_.arena_chunk_size();
+    if (free_chunks_ == NULL)
+      _heap_reserve(chunk_size, flags);
+    _chunk* c;
+    if (free_chunks_ != NULL) {
+      c = free_chunks_;
+      free_chunks_ = c->next;
+    } else {
+      c = static_cast<_chunk*>(_heap_alloc(chunk_size));
+      c->size = chunk_size;
+      _heap_grow(chunk_size);
+    }
+    c->next = chunks_;
+    chunks_ = c;
+    arena_cur_ = reinterpret_cast<char*>(c) + _CHUNK_HEADER_SIZE + 16;
+    arena_end_ = reinterpret_cast<char*>(c) + chunk_size;
+  }
+
+  // checks the limit for the chunks n objects would take beyond the current
+  // one, as _allocate_batch lays them out
+  inline void gc::_arena_reserve(size_t sz, size_t n, int flags)
+  {
+    size_t step = (sz + sizeof(size_t) + 15) & ~(size_t)15;
+    size_t chunk_size = conf_.arena_chunk_size();
+    size_t room = (arena_end_ - arena_cur_) / step;
+    if (n <= room)
+      return;
+    n -= room;
+    if (_CHUNK_HEADER_SIZE + 16 + step > chunk_size) {
+      // dedicated chunks
+      _heap_reserve((_CHUNK_HEADER_SIZE + 16 + sz) * n, flags);
+      return;
+    }
+    size_t per_chunk = (chunk_size - _CHUNK_HEADER_SIZE - 16) / step,
+      num_chunks = (n + per_chunk - 1) / per_chunk;
+    for (_chunk* c = free_chunks_; c != NULL && num_chunks != 0; c = c->next)
+      --num_chunks;
+    _heap_reserve(chunk_size * num_chunks, flags);
+  }
+
+  // the cluster holding obj, or the one given to it; otherwise the oldest
+  // one is given to obj (keeping its region, so that no space is wasted)
+  inline cluster* gc::_find_cluster(const gc_object* obj)
+  {
+    const char* p = reinterpret_cast<const char*>(obj);
+    for (size_t i = 0; i != _NUM_CLUSTERS; ++i) {
+      if ((clusters_[i].begin_ <= p && p < clusters_[i].end_)
+	  || cluster_origins_[i] == obj)
+	return clusters_ + i;
+    }
+    cluster* c = clusters_ + next_cluster_;
+    cluster_origins_[next_cluster_] = obj;
+    next_cluster_ = (next_cluster_ + 1) % _NUM_CLUSTERS;
+    return c;
+  }
+
+  inline void* gc::_cluster_allocate(cluster& c, size_t sz, int flags)
+  {
+    size_t step = (sz + sizeof(size_t) + 15) & ~(size_t)15;
+    if (c.end_ - c.cur_ < (ptrdiff_t)step) {
+      // large objects (or chunks too small to hold a cluster) are not
+      // clustered
+      if (step > _CLUSTER_SIZE / 4
+	  || _CHUNK_HEADER_SIZE + 16 + _CLUSTER_SIZE > conf_.arena_chunk_size())
+	return _arena_allocate(sz, flags);
+      // reserve the region from the arena; the objects are laid out as
+      // the arena does
+      if (arena_end_ - arena_cur_ < (ptrdiff_t)_CLUSTER_SIZE)
+	_arena_new_chunk(flags);
+      c.begin_ = c.cur_ = arena_cur_;
+      c.end_ = arena_cur_ += _CLUSTER_SIZE;
+    }
+    char* p = c.cur_;
+    reinterpret_cast<size_t*>(p)[-1] = step;
+    bytes_allocated_ += step;
+    c.cur_ += step;
+    return p;
+  }
+
+  inline gc_object* gc::_atomic_chunk_allocate(size_t sz, int flags)
+  {
+    size_t size_class = (sz - 1) / 8;
+    _atomic_chunk* c = atomic_avail_[size_class];
+    if (c == NULL) {
+      // the collection may free slots
+      _heap_reserve(_ATOMIC_CHUNK_SIZE, flags);
+      c = atomic_avail_[size_class];
+    }
+    if (c == NULL) {
+      c = static_cast<_atomic_chunk*>(_heap_alloc(_ATOMIC_CHUNK_SIZE));
+      _heap_grow(_ATOMIC_CHUNK_SIZE);
+      c->next = atomic_chunks_[size_class];
+      c->next_avail = NULL;
+      c->free_ = NULL;
+      c->unused_ = reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_HEADER_SIZE;
+      c->slot_size = (size_class + 1) * 8;
+      c->num_used = 0;
+      c->num_finalizable = 0;
+      atomic_chunks_[size_class] = atomic_avail_[size_class] = c;
+    }
+    gc_object* p;
+    if (c->free_ != NULL) {
+      p = c->free_;
+      c->free_ = reinterpret_cast<gc_object*>(p->next_ & ~_FLAG_MASK);
+    } else {
+      p = reinterpret_cast<gc_object*>(c->unused_);
+      c->unused_ += c->slot_size;
+    }
+    if (c->free_ == NULL && c->unused_ + c->slot_size
+	> reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_SIZE)
+      atomic_avail_[size_class] = c->next_avail;
+    c->num_used++;
+    c->num_finalizable += (flags & TRIVIALLY_DESTRUCTIBLE) == 0;
+    bytes_allocated_ += c->slot_size;
+    // allocated as marked while sweeping, since the chunk might not have
+    // been swept yet (or while marking concurrently)
+    p->next_ = (sweeping_ || marking_ ? _FLAG_MARKED : 0)
+      | ((flags & TRIVIALLY_DESTRUCTIBLE) != 0 ? _FLAG_NO_DTOR : 0);
+    return p;
+  }
+
+  inline void gc::_sweep_atomic_chunk(_atomic_chunk* c, gc_stats& stats)
+  {
+    for (char* slot = reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_HEADER_SIZE;
+	 slot != c->unused_;
+	 slot += c->slot_size) {
+      gc_object* obj = reinterpret_cast<gc_object*>(slot);
+      intptr_t flags = obj->next_;
+      if ((flags & _FLAG_HAS_GC_MEMBERS) != 0) {
+	// free slot
+      } else if ((flags & _FLAG_MARKED) != 0) {
+	obj->next_ = flags & ~_FLAG_MARKED;
+	cycle_live_bytes_ += c->slot_size;
+	stats.not_collected++;
+      } else {
+	if ((flags & _FLAG_NO_DTOR) == 0) {
+	  obj->~gc_object();
+	  c->num_finalizable--;
+	}
+	if (recorder_ != NULL)
+	  recorder_->freed(this, obj);
+	obj->next_ = reinterpret_cast<intptr_t>(c->free_) | _FLAG_HAS_GC_MEMBERS;
+	c->free_ = obj;
+	c->num_used--;
+	bytes_freed_ += c->slot_size;
+	stats.collected++;
+      }
+    }
+  }
+
+  inline void gc::_free_atomic_chunks(bool recycle_chunks)
+  {
+    for (size_t i = 0; i != _NUM_SIZE_CLASSES; ++i) {
+      atomic_avail_[i] = NULL;
+      for (_atomic_chunk* c = atomic_chunks_[i], * next; c != NULL; c = next) {
+	next = c->next;
+	char* slot = reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_HEADER_SIZE;
+	// chunks without objects requiring destruction are not walked
+	if (c->num_finalizable != 0) {
+	  for (char* p = slot; p != c->unused_; p += c->slot_size) {
+	    gc_object* obj = reinterpret_cast<gc_object*>(p);
+	    if ((obj->next_ & (_FLAG_HAS_GC_MEMBERS | _FLAG_NO_DTOR)) == 0)
+	      obj->~gc_object();
+	  }
+	}
+	if (recycle_chunks) {
+	  c->next_avail = atomic_avail_[i];
+	  c->free_ = NULL;
+	  c->unused_ = slot;
+	  c->num_used = 0;
+	  c->num_finalizable = 0;
+	  atomic_avail_[i] = c;
+	} else {
+	  _heap_free(c, _ATOMIC_CHUNK_SIZE);
+	  heap_bytes_ -= _ATOMIC_CHUNK_SIZE;
+	}
+      }
+      if (! recycle_chunks)
+	atomic_chunks_[i] = NULL;
+    }
+  }
+
+  inline gc_object* gc::_movable_allocate(size_t sz, int flags)
+  {
+    size_t step = (sz + sizeof(size_t) + 15) & ~(size_t)15;
+    // the chunk and the handle block to be allocated (the collection may
+    // compact the chunks and free the handles)
+    size_t growth = _movable_chunk_size(step)
+      + (free_handles_ == NULL ? _HANDLE_BLOCK_SIZE : 0);
+    if (growth != 0)
+      _heap_reserve(growth, flags);
+    gc_object* p = reinterpret_cast<gc_object*>(_movable_bump(step));
+    bytes_allocated_ += step;
+    // GC might walk through the object during construction
+    if ((flags & (IS_ATOMIC | _NOT_ZERO_FILLED)) == 0)
+      memset(static_cast<void*>(p), 0, sz);
+    gc_object** h = _handle_allocate();
+    *h = p;
+    p->next_ = reinterpret_cast<intptr_t>(h)
+      | ((flags & IS_ATOMIC) != 0 ? 0 : _FLAG_HAS_GC_MEMBERS)
+      | ((flags & TRIVIALLY_DESTRUCTIBLE) != 0 ? _FLAG_NO_DTOR : 0);
+    if (marking_)
+      _allocate_marked(p);
+    return p;
+  }
+
+  // size of the chunk to be allocated for an object occupying step bytes,
+  // or 0 if it fits in the current one
+  inline size_t gc::_movable_chunk_size(size_t step) const
+  {
+    const _movable_chunk* c = movable_cur_;
+    if (c != NULL && static_cast<size_t>(c->end - c->cur) >= step)
+      return 0;
+    // large objects are given chunks of their own
+    return step > _MOVABLE_CHUNK_SIZE / 4
+      ? _MOVABLE_CHUNK_HEADER_SIZE + 16 + step : _MOVABLE_CHUNK_SIZE;
+  }
+
+  // returns space for an object occupying step bytes (including the size)
+  inline char* gc::_movable_bump(size_t step)
+  {
+    _movable_chunk* c = movable_cur_;
+    size_t chunk_size = _movable_chunk_size(step);
+    if (chunk_size != 0) {
+      c = _movable_new_chunk(chunk_size);
+      // large objects are not followed by others
+      if (step <= _MOVABLE_CHUNK_SIZE / 4)
+	movable_cur_ = c;
+    }
+    char* p = c->cur;
+    c->cur += step;
+    c->live_bytes += step;
+    reinterpret_cast<size_t*>(p)[-1] = step;
+    return p;
+  }
+
+  inline gc::_movable_chunk* gc::_movable_new_chunk(size_t size)
+  {
+    _movable_chunk* c = static_cast<_movable_chunk*>(_heap_alloc(size));
+    _heap_grow(size);
+    c->next = movable_chunks_;
+    c->cur = c->limit = _movable_first(c);
+    c->end = reinterpret_cast<char*>(c) + size;
+    c->size = size;
+    c->live_bytes = 0;
+    movable_chunks_ = c;
+    return c;
+  }
+
+  // the handle of an object allocated with MOVABLE
+  inline gc_object** gc::_handle_of(gc_object* obj)
+  {
+    return reinterpret_cast<gc_object**>(obj->next_ & ~_FLAG_MASK);
+  }
+
+  // the handle if obj is movable, or NULL (next_ of the other objects
+  // refers to an object or to nothing, which never refers back to obj)
+  inline gc_object** gc::_movable_handle(gc_object* obj)
+  {
+    gc_object** h = _handle_of(obj);
+    return h != NULL && *h == obj ? h : NULL;
+  }
+
+  inline gc_object** gc::_handle_allocate()
+  {
+    if (free_handles_ == NULL) {
+      gc_object** block =
+	static_cast<gc_object**>(_heap_alloc(_HANDLE_BLOCK_SIZE));
+      _heap_grow(_HANDLE_BLOCK_SIZE);
+      *block = reinterpret_cast<gc_object*>(handle_blocks_);
+      handle_blocks_ = block;
+      _link_handles(block);
+    }
+    gc_object** h = free_handles_;
+    free_handles_ = reinterpret_cast<gc_object**>(*h);
+    return h;
+  }
+
+  inline void gc::_link_handles(gc_object** block)
+  {
+    for (size_t i = _HANDLE_BLOCK_SIZE / sizeof(gc_object*) - 1; i != 0; --i)
+      _handle_free(block + i);
+  }
+
+  inline void gc::_sweep_movable_chunk(_movable_chunk* c, gc_stats& stats)
+  {
+    for (char* p = _movable_first(c); p != c->limit; ) {
+      gc_object* obj = reinterpret_cast<gc_object*>(p);
+      intptr_t flags = obj->next_;
+      size_t size = reinterpret_cast<size_t*>(p)[-1];
+      p += size;
+      if (flags == 0) {
+	// dead
+      } else if ((flags & _FLAG_MARKED) != 0) {
+	obj->next_ = flags & ~_FLAG_MARKED;
+	cycle_live_bytes_ += size;
+	stats.not_collected++;
+      } else {
+	if ((flags & _FLAG_NO_DTOR) == 0)
+	  obj->~gc_object();
+	if (recorder_ != NULL)
+	  recorder_->freed(this, obj);
+	_handle_free(_handle_of(obj));
+	obj->next_ = 0;
+	c->live_bytes -= size;
+	bytes_freed_ += size;
+	stats.collected++;
+      }
+    }
+  }
+
+  // releases the chunks left without live objects (except the one being
+  // allocated from)
+  inline void gc::_release_movable_chunks()
+  {
+    for (_movable_chunk** ref = &movable_chunks_; *ref != NULL; ) {
+      _movable_chunk* c = *ref;
+      if (c->live_bytes == 0 && c != movable_cur_) {
+	*ref = c->next;
+	heap_bytes_ -= c->size;
+	_heap_free(c, c->size);
+      } else {
+	ref = &c->next;
+      }
+    }
+  }
+
+  inline double gc::_movable_fragmentation() const
+  {
+    size_t used = 0, live = 0;
+    for (_movable_chunk* c = movable_chunks_; c != NULL; c = c->next) {
+      used += c->cur - _movable_first(c);
+      live += c->live_bytes;
+    }
+    return used != 0 ? 1 - (double)live / used : 0;
+  }
+
+  // marks (or unmarks) the movable objects referred to by the locals, which
+  // may be referred to directly by the program; nothing is marked between
+  // the collections
+  inline void gc::_pin_locals(bool pin)
+  {
+    _pin_locals(stack_, pin);
+    for (root_context* c = contexts_; c != NULL; c = c->next_)
+      _pin_locals(c->stack_, pin);
+  }
+
+  inline void gc::_pin_locals(_stack<gc_object*>& stack, bool pin)
+  {
+    _stack<gc_object*>::iterator iter(stack);
+    gc_object** o;
+    while ((o = iter.get()) != NULL) {
+      if (*o != NULL && _movable_handle(*o) != NULL) {
+	if (pin)
+	  (*o)->next_ |= _FLAG_MARKED;
+	else
+	  (*o)->next_ &= ~_FLAG_MARKED;
+      }
+    }
+  }
+
+  // evacuates the live objects of the fragmented chunks (not having pinned
+  // objects) into the chunk being allocated from, releasing the chunks
+  inline gc_compaction gc::_compact()
+  {
+    gc_compaction result;
+    result.fragmentation_before = _movable_fragmentation();
+    _pin_locals(true);
+    _movable_chunk* evacuated = NULL;
+    for (_movable_chunk** ref = &movable_chunks_; *ref != NULL; ) {
+      _movable_chunk* c = *ref;
+      size_t used = c->cur - _movable_first(c);
+      bool move = used != 0
+	&& 1 - (double)c->live_bytes / used > conf_.compaction_threshold();
+      for (char* p = _movable_first(c); move && p != c->cur;
+	   p += reinterpret_cast<size_t*>(p)[-1])
+	move = (reinterpret_cast<gc_object*>(p)->next_ & _FLAG_MARKED) == 0;
+      if (! move) {
+	ref = &c->next;
+	continue;
+      }
+      *ref = c->next;
+      c->next = evacuated;
+      evacuated = c;
+      if (c == movable_cur_)
+	movable_cur_ = NULL;
+    }
+    _pin_locals(false);
+    while (evacuated != NULL) {
+      _movable_chunk* c = evacuated;
+      evacuated = c->next;
+      for (char* p = _movable_first(c); p != c->cur; ) {
+	gc_object* obj = reinterpret_cast<gc_object*>(p);
+	size_t size = reinterpret_cast<size_t*>(p)[-1];
+	p += size;
+	if (obj->next_ == 0)
+	  continue;
+	gc_object* to = reinterpret_cast<gc_object*>(_movable_bump(size));
+	memcpy(static_cast<void*>(to), static_cast<void*>(obj),
+	       size - sizeof(size_t));
+	*_handle_of(to) = to;
+	if (recorder_ != NULL)
+	  recorder_->moved(this, obj, to);
+	if (sampler_ != NULL)
+	  sampler_->moved(this, obj, to);
+	result.objects_moved++;
+	result.bytes_moved += size;
+      }
+      heap_bytes_ -= c->size;
+      _heap_free(c, c->size);
+      result.chunks_released++;
+    }
+    result.fragmentation_after = _movable_fragmentation();
+    return result;
+  }
+
+  inline void gc::_free_movable(bool recycle)
+  {
+    for (_movable_chunk* c = movable_chunks_, * next; c != NULL; c = next) {
+      next = c->next;
+      for (char* p = _movable_first(c); p != c->cur;
+	   p += reinterpret_cast<size_t*>(p)[-1]) {
+	gc_object* obj = reinterpret_cast<gc_object*>(p);
+	if (obj->next_ != 0 && (obj->next_ & _FLAG_NO_DTOR) == 0)
+	  obj->~gc_object();
+      }
+      heap_bytes_ -= c->size;
+      _heap_free(c, c->size);
+    }
+    movable_chunks_ = movable_cur_ = NULL;
+    // the blocks of the handles are kept for reuse
+    free_handles_ = NULL;
+    for (gc_object** b = handle_blocks_, ** next; b != NULL; b = next) {
+      next = reinterpret_cast<gc_object**>(*b);
+      if (recycle) {
+	_link_handles(b);
+      } else {
+	heap_bytes_ -= _HANDLE_BLOCK_SIZE;
+	_heap_free(b, _HANDLE_BLOCK_SIZE);
+      }
+    }
+    if (! recycle)
+      handle_blocks_ = NULL;
+  }
+
+  inline void gc::_sample(gc_object* obj, size_t sz)
+  {
+    if (sampler_ == NULL) {
+      bytes_until_sample_ = SIZE_MAX;
+      return;
+    }
+    sampler_->sample(this, obj, sz);
+    bytes_until_sample_ = sampler_->next_interval(this);
+  }
+
+  inline void gc::_mark(gc_stats& stats)
+  {
+    // mark all the objects
+    _drain_mark_stack(stats);
+    while (mark_stack_overflowed_) {
+      // some objects were marked without being pushed; rescan the heap for
+      // marked objects (scanning an object twice does no harm)
+      mark_stack_overflowed_ = false;
+      stats.mark_stack_overflows++;
+      for (scope* scope = scope_; scope != NULL; scope = scope->prev_)
+	_rescan_list(scope->new_head_, stats);
+      for (root_context* c = contexts_; c != NULL; c = c->next_)
+	for (scope* scope = c->scope_; scope != NULL; scope = scope->prev_)
+	  _rescan_list(scope->new_head_, stats);
+      _rescan_list(obj_head_, stats);
+      for (_movable_chunk* c = movable_chunks_; c != NULL; c = c->next)
+	_rescan_movable(c, c->cur, stats);
+    }
+  }
+
+  // run by the marker thread.  The objects marked here are those in the
+  // list as of the beginning of the cycle (the young ones, and the ones
+  // allocated meanwhile are marked already), so the overflows are recovered
+  // by rescanning that part of the list, which is not modified until the
+  // sweep
+  inline void gc::_mark_concurrently(gc_stats& stats)
+  {
+    _drain_mark_stack(stats);
+    while (mark_stack_overflowed_) {
+      mark_stack_overflowed_ = false;
+      stats.mark_stack_overflows++;
+      _rescan_list(mark_snapshot_, stats);
+      for (_movable_chunk* c = movable_snapshot_; c != NULL; c = c->next)
+	_rescan_movable(c, c->limit, stats);
+    }
+  }
+
+  // traces the marked objects of the list (scanning an object twice does
+  // no harm)
+  inline void gc::_rescan_list(gc_object* head, gc_stats& stats)
+  {
+    for (gc_object* o = head;
+	 o != NULL;
+	 o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
+      if ((o->next_ & (_FLAG_MARKED | _FLAG_HAS_GC_MEMBERS))
+	  == (_FLAG_MARKED | _FLAG_HAS_GC_MEMBERS)) {
+	o->gc_mark(this);
+	_drain_mark_stack(stats);
+      }
+    }
+  }
+
+  inline void gc::_rescan_movable(_movable_chunk* c, char* end,
+				  gc_stats& stats)
+  {
+    for (char* p = _movable_first(c); p != end;
+	 p += reinterpret_cast<size_t*>(p)[-1]) {
+      gc_object* o = reinterpret_cast<gc_object*>(p);
+      if ((o->next_ & (_FLAG_MARKED | _FLAG_HAS_GC_MEMBERS))
+	  == (_FLAG_MARKED | _FLAG_HAS_GC_MEMBERS)) {
+	o->gc_mark(this);
+	_drain_mark_stack(stats);
+      }
+    }
+  }
+
+  inline void gc::_drain_mark_stack(gc_stats& stats)
+  {
+    while (mark_stack_top_ != mark_stack_) {
+      // request deferred marking of the properties
+      stats.slowly_marked++;
+      (*--mark_stack_top_)->gc_mark(this);
     }
   }
   
-  inline void gc::_sweep(gc_stats& stats)
+  inline void gc::_sweep_start()
+  {
+    // detach the list, so that the objects allocated while sweeping is in
+    // progress are not walked
+    sweep_cur_ = obj_head_;
+    obj_head_ = NULL;
+    swept_head_ = NULL;
+    swept_tail_ref_ = reinterpret_cast<intptr_t*>(&swept_head_);
+    sweep_class_ = 0;
+    sweep_chunk_ = atomic_chunks_[0];
+    // the objects allocated from now on are not swept
+    sweep_movable_ = movable_chunks_;
+    for (_movable_chunk* c = movable_chunks_; c != NULL; c = c->next)
+      c->limit = c->cur;
+  }
+
+  template <typename Tracer>
+  inline bool gc::_sweep_step(gc_stats& stats, double deadline)
+  {
+    if (swept_tail_ref_ != NULL
+	&& ! _sweep_list_step<Tracer>(stats, deadline))
+      return false;
+    // sweep the chunks of atomic objects; the list of chunks having free
+    // slots is rebuilt once all the chunks of the size class are swept
+    for (; sweep_class_ != _NUM_SIZE_CLASSES; ++sweep_class_) {
+      for (; sweep_chunk_ != NULL; sweep_chunk_ = sweep_chunk_->next) {
+	if (deadline != HUGE_VAL && now() >= deadline)
+	  return false;
+	_sweep_atomic_chunk(sweep_chunk_, stats);
+      }
+      atomic_avail_[sweep_class_] = NULL;
+      _atomic_chunk** ref = atomic_chunks_ + sweep_class_;
+      bool empty_kept = false;
+      while (*ref != NULL) {
+	_atomic_chunk* c = *ref;
+	// release empty chunks, but keep one to avoid thrashing
+	if (c->num_used == 0) {
+	  if (empty_kept) {
+	    *ref = c->next;
+	    _heap_free(c, _ATOMIC_CHUNK_SIZE);
+	    heap_bytes_ -= _ATOMIC_CHUNK_SIZE;
+	    continue;
+	  }
+	  empty_kept = true;
+	}
+	if (c->free_ != NULL || c->unused_ + c->slot_size
+	    <= reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_SIZE) {
+	  c->next_avail = atomic_avail_[sweep_class_];
+	  atomic_avail_[sweep_class_] = c;
+	}
+	ref = &c->next;
+      }
+      if (sweep_class_ + 1 != _NUM_SIZE_CLASSES)
+	sweep_chunk_ = atomic_chunks_[sweep_class_ + 1];
+    }
+    // and those of the movable objects
+    for (; sweep_movable_ != NULL; sweep_movable_ = sweep_movable_->next) {
+      if (deadline != HUGE_VAL && now() >= deadline)
+	return false;
+      _sweep_movable_chunk(sweep_movable_, stats);
+    }
+    _release_movable_chunks();
+    return true;
+  }
+
+  template <typename Tracer>
+  inline bool gc::_sweep_list_step(gc_stats& stats, double deadline)
   {
     // collect unmarked objects, as well as clearing the mark of live objects
-    intptr_t* ref = reinterpret_cast<intptr_t*>(&obj_head_);
-    for (gc_object* obj = obj_head_; obj != NULL; ) {
+    intptr_t* ref = swept_tail_ref_;
+    gc_object* obj = sweep_cur_;
+    for (size_t n = 1; obj != NULL; ++n) {
       intptr_t next = obj->next_;
       if ((next & _FLAG_MARKED) != 0) {
 	// alive, clear the mark and connect to the list
-	*ref = reinterpret_cast<intptr_t>(obj) | (*ref & _FLAG_HAS_GC_MEMBERS);
+	*ref = reinterpret_cast<intptr_t>(obj)
+	  | (*ref & _FLAG_MASK & ~_FLAG_MARKED);
 	ref = &obj->next_;
+	cycle_live_bytes_ += _object_size(obj);
 	stats.not_collected++;
+      } else if ((next & _FLAG_NO_DTOR) == 0 && Tracer::batched_sweep(conf_)
+		 && _sweep_batch_add(obj)) {
+	// dead, destroyed later together with the objects of same type
+	stats.collected++;
       } else {
 	// dead, destroy
-	obj->~gc_object();
-	::operator delete(static_cast<void*>(obj));
+	if ((next & _FLAG_NO_DTOR) == 0) {
+	  obj->~gc_object();
+	  num_finalizable_--;
+	}
+	_free_object(obj);
 	stats.collected++;
       }
       obj = reinterpret_cast<gc_object*>(next & ~_FLAG_MASK);
+      // check the clock once in a while
+      if ((n & 255) == 0 && obj != NULL && now() >= deadline) {
+	if (Tracer::batched_sweep(conf_))
+	  _sweep_batch_flush();
+	if (num_free_blocks_ != 0)
+	  _flush_free_blocks();
+	sweep_cur_ = obj;
+	swept_tail_ref_ = ref;
+	return false;
+      }
     }
-    *ref &= _FLAG_HAS_GC_MEMBERS;
+    if (Tracer::batched_sweep(conf_))
+      _sweep_batch_flush();
+    if (num_free_blocks_ != 0)
+      _flush_free_blocks();
+    // reattach the survivors in front of the objects allocated meanwhile
+    *ref = reinterpret_cast<intptr_t>(obj_head_)
+      | (*ref & _FLAG_MASK & ~_FLAG_MARKED);
+    obj_head_ = swept_head_;
+    sweep_cur_ = NULL;
+    swept_tail_ref_ = NULL;
+    return true;
   }
   
-  inline void gc::trigger_gc()
+  template <typename Tracer, typename Emitter>
+  inline void gc::_begin_cycle(Emitter& e)
+  {
+    _scan_roots(e);
+
+    // mark (cannot be split into steps, since there is no write barrier)
+    e.mark_start(this);
+    double mark_start = now();
+    _mark(cycle_stats_);
+    last_mark_time_ = now() - mark_start;
+    _marked();
+    e.mark_end(this);
+
+    bytes_allocated_since_gc_ = 0;
+    next_memory_check_ = _memory_check_interval(conf_);
+
+    // start sweeping, which may be run in steps
+    e.sweep_start(this);
+    _sweep_start();
+    sweeping_ = true;
+  }
+
+  // marks the roots, pushing the objects to be traced to the mark stack
+  template <typename Emitter> inline void gc::_scan_roots(Emitter& e)
   {
-    assert(pending_.empty());
+    assert(mark_stack_top_ == mark_stack_);
     
-    emitter_->gc_start(this);
-    gc_stats stats;
+    e.gc_start(this);
+    if (recorder_ != NULL)
+      recorder_->collection_started(this);
+    cycle_stats_ = gc_stats();
+    cycle_live_bytes_ = 0;
+    num_gc_++;
+    if (pressure_gc_) {
+      cycle_stats_.by_memory_pressure = 1;
+      num_pressure_gc_++;
+      pressure_gc_ = false;
+    }
+    if (limit_gc_) {
+      cycle_stats_.by_heap_limit = 1;
+      num_limit_gc_++;
+      limit_gc_ = false;
+    }
     
-    // setup new
-    for (scope* scope = scope_; scope != NULL; scope = scope->prev_) {
-      for (gc_object* o = scope_->new_head_;
-	   o != NULL;
-	   o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
-	mark(o);
-	stats.on_stack++;
+    // setup new (of the running context, and of the others)
+    e.setup_new_start(this);
+    _trace_young(scope_, true);
+    for (root_context* c = contexts_; c != NULL; c = c->next_)
+      _trace_young(c->scope_, true);
+    e.setup_new_end(this);
+    // setup local
+    e.setup_local_start(this);
+    cycle_stats_.on_stack += _mark_locals(stack_);
+    for (root_context* c = contexts_; c != NULL; c = c->next_)
+      cycle_stats_.on_stack += _mark_locals(c->stack_);
+    for (gc_roots* r = roots_; r != NULL; r = r->next_)
+      r->gc_mark_roots(this);
+    e.setup_local_end(this);
+  }
+
+  // traces the young objects of the scopes (counting them as alive), which
+  // are marked already; the ones having GC members precede the atomic ones
+  inline void gc::_trace_young(scope* scope, bool count)
+  {
+    for (; scope != NULL; scope = scope->prev_) {
+      for (gc_object* o = scope->new_head_;
+	   o != NULL && (o->next_ & _FLAG_HAS_GC_MEMBERS) != 0;
+	   o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK))
+	o->gc_mark(this);
+      if (count) {
+	cycle_stats_.on_stack += scope->num_new_;
+	cycle_stats_.not_collected += scope->num_new_;
+	cycle_live_bytes_ += scope->new_bytes_;
       }
     }
-    { // setup local
-      _stack<gc_object*>::iterator iter(stack_);
-      gc_object** o;
-      while ((o = iter.get()) != NULL) {
-	mark(*o);
-	stats.on_stack++;
+  }
+
+  // marks the objects referred to by the locals, returning the number of
+  // the slots
+  inline size_t gc::_mark_locals(_stack<gc_object*>& stack)
+  {
+    _stack<gc_object*>::iterator iter(stack);
+    size_t n = 0;
+    for (gc_object** o; (o = iter.get()) != NULL; ++n)
+      mark(*o);
+    return n;
+  }
+
+  // notifies the end of marking to those referring to the objects weakly
+  inline void gc::_marked()
+  {
+    if (sampler_ != NULL)
+      sampler_->mark_end(this);
+    for (gc_roots* r = roots_; r != NULL; r = r->next_)
+      r->gc_clear_weak(this);
+  }
+
+  // the pause starting a concurrent cycle; the objects reachable from the
+  // roots are marked by the marker thread
+  inline void gc::_begin_concurrent_cycle()
+  {
+    _scan_roots();
+    bytes_allocated_since_gc_ = 0;
+    next_memory_check_ = _memory_check_interval(conf_);
+    mark_snapshot_ = obj_head_;
+    movable_snapshot_ = movable_chunks_;
+    for (_movable_chunk* c = movable_chunks_; c != NULL; c = c->next)
+      c->limit = c->cur;
+    marking_ = true;
+    foreign_refs_ = globals::num_heaps > 1;
+    next_marking_ = globals::marking_heaps;
+    globals::marking_heaps = this;
+    if (! marker_started_) {
+      pthread_mutex_init(&marker_mutex_, NULL);
+      pthread_cond_init(&marker_cond_, NULL);
+      if (pthread_create(&marker_, NULL, _marker_main, this) != 0) {
+	// mark here instead
+	pthread_mutex_destroy(&marker_mutex_);
+	pthread_cond_destroy(&marker_cond_);
+	emitter_->concurrent_mark_start(this);
+	_mark_concurrently(cycle_stats_);
+	emitter_->concurrent_mark_end(this);
+	marker_state_ = _MARKER_DONE;
+	return;
       }
+      marker_started_ = true;
     }
-    
-    // mark
-    emitter_->mark_start(this);
-    _mark(stats);
-    emitter_->mark_end(this);
-    // sweep
+    pthread_mutex_lock(&marker_mutex_);
+    marker_state_ = _MARKER_MARKING;
+    pthread_cond_broadcast(&marker_cond_);
+    pthread_mutex_unlock(&marker_mutex_);
+  }
+
+  inline void* gc::_marker_main(void* self)
+  {
+    gc* gc = static_cast<picogc::gc*>(self);
+    pthread_mutex_lock(&gc->marker_mutex_);
+    while (true) {
+      while (gc->marker_state_ == _MARKER_IDLE
+	     || gc->marker_state_ == _MARKER_DONE)
+	pthread_cond_wait(&gc->marker_cond_, &gc->marker_mutex_);
+      if (gc->marker_state_ == _MARKER_EXIT)
+	break;
+      pthread_mutex_unlock(&gc->marker_mutex_);
+      gc->emitter_->concurrent_mark_start(gc);
+      gc->_mark_concurrently(gc->cycle_stats_);
+      gc->emitter_->concurrent_mark_end(gc);
+      pthread_mutex_lock(&gc->marker_mutex_);
+      __atomic_store_n(&gc->marker_state_, _MARKER_DONE, __ATOMIC_RELEASE);
+      pthread_cond_broadcast(&gc->marker_cond_);
+    }
+    pthread_mutex_unlock(&gc->marker_mutex_);
+    return NULL;
+  }
+
+  inline void gc::_wait_marker()
+  {
+    if (! marker_started_) {
+      marker_state_ = _MARKER_IDLE;
+      return;
+    }
+    pthread_mutex_lock(&marker_mutex_);
+    while (marker_state_ != _MARKER_DONE)
+      pthread_cond_wait(&marker_cond_, &marker_mutex_);
+    marker_state_ = _MARKER_IDLE;
+    pthread_mutex_unlock(&marker_mutex_);
+  }
+
+  inline void gc::_stop_marker()
+  {
+    if (! marker_started_)
+      return;
+    pthread_mutex_lock(&marker_mutex_);
+    marker_state_ = _MARKER_EXIT;
+    pthread_cond_broadcast(&marker_cond_);
+    pthread_mutex_unlock(&marker_mutex_);
+    pthread_join(marker_, NULL);
+    pthread_mutex_destroy(&marker_mutex_);
+    pthread_cond_destroy(&marker_cond_);
+    marker_started_ = false;
+  }
+
+  // the pause finishing the marking of a concurrent cycle; the roots, and
+  // the slots and objects logged meanwhile are rescanned.  Starts the sweep
+  inline void gc::_remark()
+  {
+    // (including the wait for the marker thread)
+    double remark_start = now();
+    _wait_marker();
+    // reported after the marker thread has reported its end, so that the
+    // events of the cycle are emitted in order
+    emitter_->remark_start(this);
+    marking_ = false;
+    gc** link = &globals::marking_heaps;
+    while (*link != this)
+      link = &(*link)->next_marking_;
+    *link = next_marking_;
+    // (counted by the pause starting the cycle)
+    _trace_young(scope_, false);
+    _mark_locals(stack_);
+    for (root_context* c = contexts_; c != NULL; c = c->next_) {
+      _trace_young(c->scope_, false);
+      _mark_locals(c->stack_);
+    }
+    for (gc_roots* r = roots_; r != NULL; r = r->next_)
+      r->gc_mark_roots(this);
+    for (gc_object** o; (o = dirty_objects_->pop()) != NULL; ) {
+      (*o)->gc_mark(this);
+      cycle_stats_.remarked++;
+    }
+    if (foreign_refs_)
+      _drop_foreign_refs();
+    for (gc_object** o; (o = dirty_refs_->pop()) != NULL; ) {
+      mark(*o);
+      cycle_stats_.remarked++;
+    }
+    _mark(cycle_stats_);
+    last_mark_time_ = now() - remark_start;
+    _marked();
+    emitter_->remark_end(this);
+
     emitter_->sweep_start(this);
-    _sweep(stats);
-    emitter_->sweep_end(this);
-    
-    // clear the marks in new (as well as count the number)
-    for (scope* scope = scope_; scope != NULL; scope = scope->prev_) {
-      for (gc_object* o = scope_->new_head_;
-	   o != NULL;
-	   o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
-	o->next_ &= ~_FLAG_MARKED;
-	stats.not_collected++;
+    _sweep_start();
+    sweeping_ = true;
+  }
+
+  // drops the objects logged by the write barrier that are not found in
+  // this heap (they were stored to the objects of other heaps, which may
+  // have freed them since); the heap is walked once for all of them
+  inline void gc::_drop_foreign_refs()
+  {
+    size_t n = 0;
+    {
+      _stack<gc_object*>::iterator iter(*dirty_refs_);
+      while (iter.get() != NULL)
+	++n;
+    }
+    if (n == 0)
+      return;
+    gc_object** refs = new gc_object*[n];
+    for (size_t i = 0; i != n; ++i)
+      refs[i] = *dirty_refs_->pop();
+    std::sort(refs, refs + n);
+    n = std::unique(refs, refs + n) - refs;
+    bool* owned = new bool[n];
+    std::fill(owned, owned + n, false);
+    struct finder {
+      gc_object** refs_;
+      bool* owned_;
+      size_t n_;
+      // the objects in [begin, end)
+      void find(const void* begin, const void* end) {
+	for (gc_object** r = std::lower_bound(refs_, refs_ + n_,
+					       static_cast<const void*>(begin));
+	     r != refs_ + n_ && static_cast<const void*>(*r) < end;
+	     ++r)
+	  owned_[r - refs_] = true;
+      }
+      void find_list(gc_object* head) {
+	for (gc_object* o = head;
+	     o != NULL;
+	     o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
+	  gc_object** r = std::lower_bound(refs_, refs_ + n_, o);
+	  if (r != refs_ + n_ && *r == o)
+	    owned_[r - refs_] = true;
+	}
+      }
+    } f = { refs, owned, n };
+    root_context* c = NULL;
+    do {
+      for (scope* scope = _scopes_of(c); scope != NULL; scope = scope->prev_)
+	f.find_list(scope->new_head_);
+    } while ((c = _next_context(c)) != NULL);
+    f.find_list(obj_head_);
+    for (size_t i = 0; i != _NUM_SIZE_CLASSES; ++i) {
+      for (_atomic_chunk* c = atomic_chunks_[i]; c != NULL; c = c->next)
+	f.find(reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_HEADER_SIZE,
+	       c->unused_);
+    }
+    for (_movable_chunk* c = movable_chunks_; c != NULL; c = c->next)
+      f.find(_movable_first(c), c->cur);
+    for (size_t i = 0; i != n; ++i)
+      if (owned[i])
+	*dirty_refs_->push() = refs[i];
+    delete [] owned;
+    delete [] refs;
+  }
+
+  inline void gc::_finish_concurrent_cycle()
+  {
+    double start = now();
+    _remark();
+    _sweep(cycle_stats_);
+    _end_cycle(true);
+    pause_time_ += now() - start;
+  }
+
+  // collects at once, or starts a concurrent cycle
+  inline void gc::_start_gc()
+  {
+    if (! conf_.concurrent_marking()) {
+      trigger_gc();
+      return;
+    }
+    // waits for the marker, if an interval has been allocated meanwhile
+    if (marking_)
+      _finish_concurrent_cycle();
+    double start = now();
+    if (sweeping_) {
+      _sweep(cycle_stats_);
+      _end_cycle();
+    }
+    _begin_concurrent_cycle();
+    pause_time_ += now() - start;
+  }
+
+  template <typename Emitter>
+  inline void gc::_end_cycle(Emitter& e, bool compact)
+  {
+    sweeping_ = false;
+    live_bytes_ = cycle_live_bytes_;
+    e.sweep_end(this);
+    if (compact && movable_chunks_ != NULL
+	&& conf_.compaction_threshold() > 0
+	&& _movable_fragmentation() > conf_.compaction_threshold()) {
+      e.compact_start(this);
+      gc_compaction result = _compact();
+      e.compact_end(this, result);
+    }
+    e.gc_end(this, cycle_stats_);
+    if (recorder_ != NULL)
+      recorder_->collection_ended(this, cycle_stats_);
+  }
+
+  inline void gc::trigger_gc()
+  {
+    _trigger_gc();
+  }
+
+  inline void gc::_trigger_gc()
+  {
+    _collect<config_tracer>(*emitter_);
+  }
+
+  template <typename Tracer, typename Emitter>
+  inline void gc::_collect(Emitter& e)
+  {
+    assert(num_constructing_ == 0);
+    double start = now();
+    // complete the collection in progress, if any (started by emitter_)
+    if (marking_)
+      _remark();
+    if (sweeping_) {
+      _sweep(cycle_stats_);
+      _end_cycle();
+    }
+    _begin_cycle<Tracer>(e);
+    _sweep<Tracer>(cycle_stats_);
+    _end_cycle(e, true);
+    pause_time_ += now() - start;
+  }
+
+  inline bool gc::collect_for(double deadline)
+  {
+    assert(num_constructing_ == 0);
+    double start = now();
+    if (marking_) {
+      // the remark awaits the marker thread
+      if (! _marker_done())
+	return false;
+      _remark();
+    } else if (! sweeping_) {
+      if (conf_.concurrent_marking()) {
+	_begin_concurrent_cycle();
+	pause_time_ += now() - start;
+	return false;
       }
+      // do not start unless marking is likely to fit within the deadline
+      if (start + last_mark_time_ > deadline)
+	return false;
+      _begin_cycle();
     }
+    bool done = _sweep_step(cycle_stats_, deadline);
+    if (done)
+      _end_cycle();
+    pause_time_ += now() - start;
+    return done;
+  }
+
+  inline gc_metrics gc::metrics() const
+  {
+    gc_metrics m;
+    m.bytes_requested = bytes_requested_;
+    m.bytes_allocated = bytes_allocated_;
+    m.bytes_freed = bytes_freed_;
+    m.object_bytes = bytes_allocated_ - bytes_freed_;
+    m.live_bytes = live_bytes_;
+    m.heap_bytes = heap_bytes_;
+    m.peak_heap_bytes = peak_heap_bytes_;
+    m.overhead_bytes = heap_bytes_ - m.object_bytes;
+    m.num_gc = num_gc_;
+    m.num_pressure_gc = num_pressure_gc_;
+    m.pause_time = pause_time_;
+    m.num_limit_gc = num_limit_gc_;
+    m.num_allocation_failures = num_allocation_failures_;
+    return m;
+  }
 
-    emitter_->gc_end(this, stats);
+  inline bool gc::idle_notification(double budget)
+  {
+    // start collection early, so that the threshold would not be hit
+    // while handling the next request
+    if (! sweeping_
+	&& bytes_allocated_since_gc_
+	< conf_.gc_interval_bytes() * conf_.idle_gc_ratio())
+      return true;
+    return collect_for(now() + budget);
   }
   
+  inline bool gc::_sweep_batch_add(gc_object* obj)
+  {
+    if (num_sweep_batched_ == _MAX_SWEEP_BATCHED)
+      _sweep_batch_flush();
+    const void* vptr = *reinterpret_cast<const void* const*>(obj);
+    size_t i = (reinterpret_cast<uintptr_t>(vptr) >> 4) % _NUM_SWEEP_BATCHES;
+    for (size_t n = 0; n != 8; ++n, i = (i + 1) % _NUM_SWEEP_BATCHES) {
+      _sweep_batch& batch = sweep_batches_[i];
+      if (batch.vptr == vptr || batch.vptr == NULL) {
+	if (batch.vptr == NULL) {
+	  batch.vptr = vptr;
+	  sweep_batches_used_[num_sweep_batches_used_++] = i;
+	}
+	// the object is dead, so next_ can be reused as the link
+	obj->next_ = reinterpret_cast<intptr_t>(batch.head);
+	batch.head = obj;
+	num_sweep_batched_++;
+	return true;
+      }
+    }
+    // too many types, destroy immediately
+    return false;
+  }
+
+  inline void gc::_sweep_batch_flush()
+  {
+    for (size_t i = 0; i != num_sweep_batches_used_; ++i) {
+      _sweep_batch& batch = sweep_batches_[sweep_batches_used_[i]];
+      for (gc_object* o = batch.head; o != NULL; ) {
+	gc_object* next = reinterpret_cast<gc_object*>(o->next_);
+	o->~gc_object();
+	_free_object(o);
+	o = next;
+      }
+      batch.vptr = NULL;
+      batch.head = NULL;
+    }
+    num_finalizable_ -= num_sweep_batched_;
+    num_sweep_batches_used_ = 0;
+    num_sweep_batched_ = 0;
+  }
+
   inline void gc::may_trigger_gc()
   {
+    if (num_constructing_ != 0) {
+      gc_deferred_ = true;
+      return;
+    }
+    if (marking_ && _marker_done())
+      _finish_concurrent_cycle();
     if (bytes_allocated_since_gc_ >= conf_.gc_interval_bytes()) {
+      _start_gc();
+    } else if (bytes_allocated_since_gc_ >= next_memory_check_) {
+      _check_memory_pressure();
+    }
+  }
+
+  inline void gc::_check_memory_pressure()
+  {
+    next_memory_check_ =
+      bytes_allocated_since_gc_ + _memory_check_interval(conf_);
+    // collect before reaching the heap limit (this is checked after 1/16
+    // of the limit is allocated)
+    if (heap_bytes_ > heap_limit_ - heap_limit_ / 16
+	&& bytes_allocated_since_gc_ >= heap_limit_ / 16) {
+      _limit_gc();
+      return;
+    }
+    if (conf_.memory_pressure_ratio() == 0)
+      return;
+    size_t usage, limit;
+    if (! read_memory_usage(usage, limit, conf_.memory_limit_bytes()))
+      return;
+    double pressure = (double)usage / limit,
+      ratio = conf_.memory_pressure_ratio();
+    if (pressure < ratio)
+      return;
+    // shrink the interval as the usage approaches the limit
+    double interval = conf_.gc_interval_bytes() * (1 - pressure) / (1 - ratio);
+    if (bytes_allocated_since_gc_ >= interval) {
+      pressure_gc_ = true;
       trigger_gc();
-      bytes_allocated_since_gc_ = 0;
     }
   }
 
-  inline void gc::mark(gc_object* obj)
+  // the allocation would grow the heap beyond the limit.  The collection is
+  // run only if the allocation may trigger GC, and unless it has been run
+  // within the last 1/16 of the limit (then it would free little, on
+  // every allocation); the handler is consulted either way
+  inline void gc::_heap_limit_reached(size_t sz, int flags)
+  {
+    bool may_collect = (flags & MAY_TRIGGER_GC) != 0 && num_constructing_ == 0;
+    if (may_collect && bytes_allocated_since_gc_ >= heap_limit_ / 16) {
+      _limit_gc();
+      if (! _exceeds_limit(sz))
+	return;
+    }
+    gc_oom_handler* handler = conf_.oom_handler();
+    if (handler != NULL && handler->out_of_memory(this, sz) && may_collect) {
+      _limit_gc();
+      if (! _exceeds_limit(sz))
+	return;
+    }
+    num_allocation_failures_++;
+    throw std::bad_alloc();
+  }
+
+  inline bool gc::_read_size(const char* fn, size_t& v)
+  {
+    FILE* fp = fopen(fn, "r");
+    if (fp == NULL)
+      return false;
+    unsigned long long n;
+    bool ok = fscanf(fp, "%llu", &n) == 1; // fails for "max"
+    fclose(fp);
+    if (ok)
+      v = (size_t)n;
+    return ok;
+  }
+
+  inline bool gc::read_memory_usage(size_t& usage, size_t& limit,
+				    size_t fixed_limit)
+  {
+    if (fixed_limit != 0) {
+      FILE* fp = fopen("/proc/self/statm", "r");
+      if (fp == NULL)
+	return false;
+      unsigned long size, resident;
+      bool ok = fscanf(fp, "%lu %lu", &size, &resident) == 2;
+      fclose(fp);
+      if (! ok)
+	return false;
+      usage = resident * sysconf(_SC_PAGESIZE);
+      limit = fixed_limit;
+      return true;
+    }
+    // find the cgroup, and walk up until a limit is found
+    char dir[4096] = "/sys/fs/cgroup", line[4096];
+    FILE* fp = fopen("/proc/self/cgroup", "r");
+    if (fp == NULL)
+      return false;
+    bool found = false;
+    while (! found && fgets(line, sizeof(line), fp) != NULL) {
+      if (strncmp(line, "0::", 3) == 0) {
+	line[strcspn(line, "\n")] = '\0';
+	if (strlen(dir) + strlen(line + 3) < sizeof(dir)) {
+	  strcat(dir, line + 3);
+	  found = true;
+	}
+      }
+    }
+    fclose(fp);
+    if (! found)
+      return false;
+    while (true) {
+      size_t dirlen = strlen(dir);
+      if (dirlen + sizeof("/memory.current") > sizeof(dir))
+	return false;
+      strcpy(dir + dirlen, "/memory.max");
+      if (_read_size(dir, limit)) {
+	strcpy(dir + dirlen, "/memory.current");
+	return _read_size(dir, usage);
+      }
+      dir[dirlen] = '\0';
+      char* slash = strrchr(dir, '/');
+      if (slash == NULL || strcmp(dir, "/sys/fs/cgroup") == 0)
+	return false;
+      *slash = '\0';
+    }
+  }
+
+  inline void gc::_mark_slot(gc_object* obj, const void* slot)
   {
     if (obj == NULL)
       return;
-    // return if already marked
-    if ((obj->next_ & _FLAG_MARKED) != 0)
+    if (visitor_ != NULL) {
+      _visit_slot(obj, slot);
+      return;
+    }
+    // return if already marked (accessed atomically, since the mutator
+    // links the young objects while the marker thread runs)
+    intptr_t next = __atomic_load_n(&obj->next_, __ATOMIC_RELAXED);
+    if ((next & _FLAG_MARKED) != 0)
       return;
     // mark
-    obj->next_ |= _FLAG_MARKED;
+    __atomic_store_n(&obj->next_, next | _FLAG_MARKED, __ATOMIC_RELAXED);
     // push to the mark stack
-    if ((obj->next_ & _FLAG_HAS_GC_MEMBERS) != 0)
-      *pending_.push() = obj;
+    if ((next & _FLAG_HAS_GC_MEMBERS) != 0) {
+      if (mark_stack_top_ != mark_stack_end_) {
+	*mark_stack_top_++ = obj;
+      } else {
+	// left to be found by _mark rescanning the heap
+	mark_stack_overflowed_ = true;
+      }
+    }
   }
   
+  inline void gc::visit_members(gc_object* obj, gc_visitor* visitor)
+  {
+    // the marker thread should not see the visitor
+    if (marking_)
+      _remark();
+    gc_visitor* saved = visitor_;
+    visitor_ = visitor;
+    obj->gc_mark(this);
+    visitor_ = saved;
+  }
+
+  inline void gc::mark_members(gc_object* obj)
+  {
+    if ((obj->next_ & _FLAG_HAS_GC_MEMBERS) != 0) {
+      obj->gc_mark(this);
+      if (visitor_ == NULL)
+	_drain_mark_stack(cycle_stats_);
+    }
+  }
+
+  inline void gc::add_roots(gc_roots* roots)
+  {
+    assert(roots->gc_ == NULL);
+    roots->gc_ = this;
+    roots->prev_ = NULL;
+    roots->next_ = roots_;
+    if (roots_ != NULL)
+      roots_->prev_ = roots;
+    roots_ = roots;
+  }
+
+  inline void gc::remove_roots(gc_roots* roots)
+  {
+    assert(roots->gc_ == this);
+    if (roots->prev_ != NULL)
+      roots->prev_->next_ = roots->next_;
+    else
+      roots_ = roots->next_;
+    if (roots->next_ != NULL)
+      roots->next_->prev_ = roots->prev_;
+    roots->gc_ = NULL;
+  }
+
+  inline void gc::visit_roots(gc_visitor* visitor)
+  {
+    if (marking_)
+      _remark();
+    // those of the running context first, followed by the others
+    size_t index = 0;
+    root_context* c = NULL;
+    do {
+      for (scope* scope = _scopes_of(c); scope != NULL;
+	   scope = scope->prev_, ++index) {
+	for (gc_object* o = scope->new_head_;
+	     o != NULL;
+	     o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK))
+	  visitor->visit_root(o, ROOT_NEW, index);
+      }
+    } while ((c = _next_context(c)) != NULL);
+    index = 0;
+    do {
+      _stack<gc_object*>::iterator iter(_locals_of(c));
+      for (gc_object** o; (o = iter.get()) != NULL; ++index) {
+	if (*o != NULL)
+	  visitor->visit_root(*o, ROOT_LOCAL, index);
+      }
+    } while ((c = _next_context(c)) != NULL);
+    struct forwarder : public gc_visitor {
+      gc_visitor* visitor_;
+      size_t index_;
+      forwarder(gc_visitor* visitor) : visitor_(visitor), index_(0) {}
+      virtual void visit(gc_object* obj) {
+	visitor_->visit_root(obj, ROOT_EXTERNAL, index_);
+      }
+    } fwd(visitor);
+    gc_visitor* saved = visitor_;
+    visitor_ = &fwd;
+    for (gc_roots* r = roots_; r != NULL; r = r->next_, ++fwd.index_)
+      r->gc_mark_roots(this);
+    visitor_ = saved;
+  }
+
+  inline void gc::visit_heap(gc_visitor* visitor)
+  {
+    if (marking_)
+      _remark();
+    if (sweeping_) {
+      _sweep(cycle_stats_);
+      _end_cycle();
+    }
+    root_context* c = NULL;
+    do {
+      for (scope* scope = _scopes_of(c); scope != NULL; scope = scope->prev_) {
+	for (gc_object* o = scope->new_head_;
+	     o != NULL;
+	     o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK))
+	  visitor->visit_object(o, _object_size(o));
+      }
+    } while ((c = _next_context(c)) != NULL);
+    for (gc_object* o = obj_head_;
+	 o != NULL;
+	 o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK))
+      visitor->visit_object(o, _object_size(o));
+    for (size_t i = 0; i != _NUM_SIZE_CLASSES; ++i) {
+      for (_atomic_chunk* c = atomic_chunks_[i]; c != NULL; c = c->next) {
+	for (char* p = reinterpret_cast<char*>(c) + _ATOMIC_CHUNK_HEADER_SIZE;
+	     p != c->unused_;
+	     p += c->slot_size) {
+	  gc_object* obj = reinterpret_cast<gc_object*>(p);
+	  // free slots are flagged
+	  if ((obj->next_ & _FLAG_HAS_GC_MEMBERS) == 0)
+	    visitor->visit_object(obj, c->slot_size);
+	}
+      }
+    }
+    for (_movable_chunk* c = movable_chunks_; c != NULL; c = c->next) {
+      for (char* p = _movable_first(c); p != c->cur;
+	   p += reinterpret_cast<size_t*>(p)[-1]) {
+	gc_object* obj = reinterpret_cast<gc_object*>(p);
+	if (obj->next_ != 0)
+	  visitor->visit_object(obj, reinterpret_cast<size_t*>(p)[-1]);
+      }
+    }
+  }
+
+  inline gc_roots::~gc_roots()
+  {
+    if (gc_ != NULL)
+      gc_->remove_roots(this);
+  }
+
+  // moves the objects reachable from root to target without copying them;
+  // the locals of this heap referring to them (including the slot pushed by
+  // scope::close) are cleared, so they should be referred to from target
+  // before it collects.  Refused, moving nothing, if any other object or
+  // gc_roots of this heap refers to them, if they refer to objects not
+  // owned by this heap, if any of them lives in a chunk (IS_ATOMIC with
+  // config::atomic_chunks, MOVABLE, or config::arena_chunk_size of either
+  // heap), if the heaps use different allocators, or if target would
+  // exceed config::heap_limit_bytes (it is not collected then)
+  inline bool gc::transfer(gc_object* root, gc& target)
+  {
+    assert(&target != this);
+    if (root == NULL)
+      return true;
+    // objects in the arena cannot leave the chunks they are allocated from
+    if (conf_.arena_chunk_size() != 0 || target.conf_.arena_chunk_size() != 0)
+      return false;
+    // nor can they be freed by another allocator
+    if (conf_.allocator() != target.conf_.allocator())
+      return false;
+    if (marking_)
+      _remark();
+    if (sweeping_) {
+      _sweep(cycle_stats_);
+      _end_cycle();
+    }
+    // the young objects are marked for the collector; they are not here
+    _mark_young(false);
+
+    // collect (and mark) the objects reachable from root
+    struct collector : public gc_visitor {
+      _stack<gc_object*> found_;
+      _stack<gc_object*> pending_;
+      size_t num_found_;
+      collector() : found_(), pending_(), num_found_(0) {}
+      virtual void visit(gc_object* obj) {
+	if ((obj->next_ & _FLAG_MARKED) != 0)
+	  return;
+	obj->next_ |= _FLAG_MARKED;
+	*found_.push() = obj;
+	num_found_++;
+	if ((obj->next_ & _FLAG_HAS_GC_MEMBERS) != 0)
+	  *pending_.push() = obj;
+      }
+    } moved;
+    moved.visit(root);
+    for (gc_object** slot; (slot = moved.pending_.pop()) != NULL; )
+      visit_members(*slot, &moved);
+
+    // check that no other objects or roots refer to the objects, and that
+    // all of them belong to this heap (the ones in the chunks are not on
+    // the lists)
+    struct referrer_checker : public gc_visitor {
+      size_t num_refs_;
+      referrer_checker() : num_refs_(0) {}
+      virtual void visit(gc_object* obj) {
+	if ((obj->next_ & _FLAG_MARKED) != 0)
+	  num_refs_++;
+      }
+    } checker;
+    size_t num_owned = 0;
+    _stack<gc_object**> locals;
+    root_context* c = NULL;
+    do {
+      for (scope* scope = _scopes_of(c); scope != NULL; scope = scope->prev_)
+	num_owned += _count_marked(scope->new_head_, &checker);
+      _stack<gc_object*>::iterator iter(_locals_of(c));
+      for (gc_object** o; (o = iter.get()) != NULL; ) {
+	if (*o != NULL && ((*o)->next_ & _FLAG_MARKED) != 0)
+	  *locals.push() = o;
+      }
+    } while ((c = _next_context(c)) != NULL);
+    num_owned += _count_marked(obj_head_, &checker);
+    if (roots_ != NULL) {
+      gc_visitor* saved = visitor_;
+      visitor_ = &checker;
+      for (gc_roots* r = roots_; r != NULL; r = r->next_)
+	r->gc_mark_roots(this);
+      visitor_ = saved;
+    }
+    size_t bytes = 0;
+    if (checker.num_refs_ == 0 && num_owned == moved.num_found_) {
+      _stack<gc_object*>::iterator iter(moved.found_);
+      for (gc_object** o; (o = iter.get()) != NULL; )
+	bytes += _object_size(*o);
+    }
+    if (checker.num_refs_ != 0 || num_owned != moved.num_found_
+	|| target._exceeds_limit(bytes)) {
+      for (gc_object** slot; (slot = moved.found_.pop()) != NULL; )
+	(*slot)->next_ &= ~_FLAG_MARKED;
+      _mark_young(true);
+      return false;
+    }
+
+    // relink the objects to target
+    for (gc_object*** slot; (slot = locals.pop()) != NULL; )
+      **slot = NULL;
+    do {
+      for (scope* scope = _scopes_of(c); scope != NULL; scope = scope->prev_) {
+	intptr_t* tail = _transfer_marked(&scope->new_head_, target);
+	if (scope->new_head_ != NULL)
+	  scope->new_tail_slot_ = tail;
+      }
+    } while ((c = _next_context(c)) != NULL);
+    _transfer_marked(&obj_head_, target);
+    _mark_young(true);
+    return true;
+  }
+
+  // counts the marked objects of the list, passing the members of the
+  // others to the visitor
+  inline size_t gc::_count_marked(gc_object* head, gc_visitor* visitor)
+  {
+    size_t n = 0;
+    for (gc_object* o = head;
+	 o != NULL;
+	 o = reinterpret_cast<gc_object*>(o->next_ & ~_FLAG_MASK)) {
+      if ((o->next_ & _FLAG_MARKED) != 0) {
+	n++;
+      } else if ((o->next_ & _FLAG_HAS_GC_MEMBERS) != 0) {
+	visit_members(o, visitor);
+      }
+    }
+    return n;
+  }
+
+  inline intptr_t* gc::_transfer_marked(gc_object** head, gc& target)
+  {
+    intptr_t* ref = reinterpret_cast<intptr_t*>(head);
+    for (gc_object* o = *head; o != NULL; ) {
+      intptr_t next = o->next_;
+      if ((next & _FLAG_MARKED) != 0) {
+	o->next_ = reinterpret_cast<intptr_t>(target.obj_head_)
+	  | (next & _FLAG_MASK & ~_FLAG_MARKED);
+	target.obj_head_ = o;
+	if ((next & _FLAG_NO_DTOR) == 0) {
+	  num_finalizable_--;
+	  target.num_finalizable_++;
+	}
+	size_t size = _object_size(o);
+	bytes_freed_ += size;
+	heap_bytes_ -= size;
+	target.bytes_allocated_ += size;
+	target._heap_grow(size);
+	if (recorder_ != NULL)
+	  recorder_->freed(this, o);
+	if (target.recorder_ != NULL)
+	  target.recorder_->allocated(
+	    &target, o, size, IMMEDIATELY_TRACEABLE
+	    | ((next & _FLAG_HAS_GC_MEMBERS) == 0 ? IS_ATOMIC : 0)
+	    | ((next & _FLAG_NO_DTOR) != 0 ? TRIVIALLY_DESTRUCTIBLE : 0));
+	if (sampler_ != NULL)
+	  sampler_->transferred(this, o, &target);
+	if (target.sampler_ != NULL && target.sampler_ != sampler_)
+	  target.sampler_->transferred(this, o, &target);
+      } else {
+	*ref = reinterpret_cast<intptr_t>(o) | (*ref & _FLAG_MASK);
+	ref = &o->next_;
+      }
+      o = reinterpret_cast<gc_object*>(next & ~_FLAG_MASK);
+    }
+    *ref &= _FLAG_MASK;
+    return ref;
+  }
+
   inline void* gc_object::operator new(size_t sz)
   {
     return gc::top()->allocate(sz, 0);
@@ -470,6 +3718,18 @@ namespace picogc {
     return gc::top()->allocate(sz, flags);
   }
 
+  inline void* gc_object::operator new(size_t sz, gc& gc, int flags)
+  {
+    return gc.allocate(sz, flags);
+  }
+
+  // the object is left as an empty gc_object, to be collected
+  inline void gc::_abort_construction(void* p)
+  {
+    new (p) gc_object;
+    _end_construction(p);
+  }
+
   // only called when an exception is raised within ctor
   inline void gc_object::operator delete(void* p)
   {
@@ -481,6 +3741,21 @@ namespace picogc {
   {
     gc_object::operator delete(p);
   }
+
+  inline void gc_object::operator delete(void* p, gc&, int)
+  {
+    gc_object::operator delete(p);
+  }
+
+  inline void* gc_object::operator new(size_t sz, const near& hint, int flags)
+  {
+    return gc::top()->allocate_near(sz, flags, hint);
+  }
+
+  inline void gc_object::operator delete(void* p, const near&, int)
+  {
+    gc_object::operator delete(p);
+  }
   
 }
 
@@ -0,0 +1,379 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_allocator_h
+#define picogc_allocator_h
+
+#include <cstdlib>
+#include <new>
+extern "C" {
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/mman.h>
+}
+
+// please include picogc.h by yourself
+
+namespace picogc {
+
+  // bump-pointer allocator; blocks are carved from chunks (aligned to their
+  // size, so that the chunk of a block can be found), and a chunk is reused
+  // once all of its blocks are freed.  not thread-safe
+  class pool_allocator : public gc_allocator {
+  protected:
+    struct chunk {
+      chunk* next;
+      size_t size; // 0 unless the chunk holds a single large block
+      size_t num_used;
+    };
+    // each block is preceded by its size, as are the objects of the arena
+    enum { _FIRST_BLOCK = 32 };
+    size_t chunk_size_;
+    chunk* cur_;
+    char* top_;
+    chunk* free_;
+  private:
+    pool_allocator(const pool_allocator&); // = delete;
+    pool_allocator& operator=(const pool_allocator&); // = delete;
+  public:
+    // chunk_size should be a power of 2
+    pool_allocator(size_t chunk_size = 1024 * 1024)
+      : chunk_size_(chunk_size), cur_(NULL), top_(NULL), free_(NULL) {}
+    ~pool_allocator() {
+      // all the blocks should have been freed by now
+      if (cur_ != NULL)
+	::free(cur_);
+      while (free_ != NULL) {
+	chunk* next = free_->next;
+	::free(free_);
+	free_ = next;
+      }
+    }
+    virtual void* allocate(size_t sz) {
+      size_t step = (sz + sizeof(size_t) + 15) & ~(size_t)15;
+      if (_FIRST_BLOCK + step > chunk_size_)
+	return _allocate_large(sz, step);
+      if (cur_ == NULL
+	  || top_ + step > reinterpret_cast<char*>(cur_) + chunk_size_ + 8) {
+	cur_ = _new_chunk();
+	top_ = reinterpret_cast<char*>(cur_) + _FIRST_BLOCK;
+      }
+      char* p = top_;
+      reinterpret_cast<size_t*>(p)[-1] = step;
+      top_ += step;
+      cur_->num_used++;
+      return p;
+    }
+    virtual void free(void* p, size_t) {
+      chunk* c = _chunk_of(p);
+      if (--c->num_used != 0)
+	return;
+      if (c->size != 0) {
+	_unmap(c, c->size);
+      } else if (c == cur_) {
+	top_ = reinterpret_cast<char*>(c) + _FIRST_BLOCK;
+      } else {
+	c->next = free_;
+	free_ = c;
+      }
+    }
+    virtual void free_bulk(void* const* blocks, size_t n) {
+      for (size_t i = 0; i != n; ++i)
+	pool_allocator::free(blocks[i], 0);
+    }
+    // (the step includes the size of the next block)
+    virtual size_t usable_size(void* p) {
+      return static_cast<size_t*>(p)[-1] - sizeof(size_t);
+    }
+  protected:
+    chunk* _chunk_of(void* p) const {
+      return reinterpret_cast<chunk*>(reinterpret_cast<uintptr_t>(p)
+				      & ~(uintptr_t)(chunk_size_ - 1));
+    }
+    // memory for the chunks, aligned to chunk_size (the chunks are
+    // released by the destructor without calling _unmap)
+    virtual void* _map(size_t sz) {
+      void* p;
+      if (posix_memalign(&p, chunk_size_, sz) != 0)
+	throw std::bad_alloc();
+      return p;
+    }
+    // called for the chunks of the large blocks
+    virtual void _unmap(void* p, size_t) {
+      ::free(p);
+    }
+    chunk* _new_chunk() {
+      chunk* c = free_;
+      if (c != NULL) {
+	free_ = c->next;
+      } else {
+	c = static_cast<chunk*>(_map(chunk_size_));
+	c->size = 0;
+	c->num_used = 0;
+      }
+      return c;
+    }
+    void* _allocate_large(size_t sz, size_t step) {
+      void* p = _map(_FIRST_BLOCK + step);
+      chunk* c = static_cast<chunk*>(p);
+      c->size = _FIRST_BLOCK + step;
+      c->num_used = 1;
+      char* b = static_cast<char*>(p) + _FIRST_BLOCK;
+      reinterpret_cast<size_t*>(b)[-1] = step;
+      return b;
+    }
+  };
+
+  // pool_allocator carving the chunks from the heap cage, a contiguous
+  // range of the address space reserved up front (the pages are committed
+  // as they are touched), so that the objects can be referred to by
+  // compressed_ptr.  The cage can be up to 32GB, and is one per process;
+  // the allocator should outlive the heaps using it.  The chunks of the
+  // large blocks are reused as those of the small ones once freed
+  class cage_allocator : public pool_allocator {
+    char* unused_;
+    char* end_;
+  public:
+    cage_allocator(size_t cage_size, size_t chunk_size = 1024 * 1024)
+      : pool_allocator(chunk_size) {
+      assert(globals::cage_base == NULL);
+      assert(cage_size + chunk_size
+	     <= (size_t)1 << (32 + compressed_ptr<gc_object>::SHIFT));
+      void* p = mmap(NULL, cage_size + chunk_size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (p == MAP_FAILED)
+	throw std::bad_alloc();
+      // (an extra chunk is reserved for the alignment); no object is at
+      // the base, since the blocks follow the chunk headers, so that 0
+      // stands for null
+      globals::cage_base = static_cast<char*>(p);
+      globals::cage_size = cage_size + chunk_size;
+      unused_ = reinterpret_cast<char*>(
+	(reinterpret_cast<uintptr_t>(p) + chunk_size - 1)
+	& ~(uintptr_t)(chunk_size - 1));
+      end_ = static_cast<char*>(p) + cage_size + chunk_size;
+    }
+    ~cage_allocator() {
+      munmap(globals::cage_base, globals::cage_size);
+      globals::cage_base = NULL;
+      globals::cage_size = 0;
+      cur_ = NULL;
+      free_ = NULL;
+    }
+  protected:
+    virtual void* _map(size_t sz) {
+      sz = (sz + chunk_size_ - 1) & ~(chunk_size_ - 1);
+      if (static_cast<size_t>(end_ - unused_) < sz)
+	throw std::bad_alloc();
+      void* p = unused_;
+      unused_ += sz;
+      return p;
+    }
+    virtual void _unmap(void* p, size_t sz) {
+      sz = (sz + chunk_size_ - 1) & ~(chunk_size_ - 1);
+      madvise(p, sz, MADV_DONTNEED);
+      for (char* q = static_cast<char*>(p); q != static_cast<char*>(p) + sz;
+	   q += chunk_size_) {
+	chunk* c = reinterpret_cast<chunk*>(q);
+	c->size = 0;
+	c->num_used = 0;
+	c->next = free_;
+	free_ = c;
+      }
+    }
+  };
+
+  // segregated free lists cached per thread; the lists are refilled from
+  // (and overflow to) central ones shared under a lock, which are in turn
+  // refilled by carving slabs.  larger blocks are obtained one by one
+  class freelist_allocator : public gc_allocator {
+    enum {
+      _SLAB_SIZE = 65536,
+      _SLAB_HEADER_SIZE = 16,
+      // in 16-byte steps, up to 512 bytes
+      _NUM_CLASSES = 32,
+      // number of blocks moved between the caches and the central lists
+      _BATCH = 64
+    };
+    struct slab {
+      size_t slot_size;
+      slab* next;
+    };
+    struct block {
+      block* next;
+    };
+    struct cache {
+      block* heads[_NUM_CLASSES];
+      size_t counts[_NUM_CLASSES];
+      freelist_allocator* owner;
+    };
+    pthread_key_t key_;
+    pthread_mutex_t mutex_;
+    block* central_[_NUM_CLASSES];
+    slab* slabs_;
+    freelist_allocator(const freelist_allocator&); // = delete;
+    freelist_allocator& operator=(const freelist_allocator&); // = delete;
+  public:
+    freelist_allocator() : slabs_(NULL) {
+      pthread_key_create(&key_, _release_cache);
+      pthread_mutex_init(&mutex_, NULL);
+      for (size_t i = 0; i != _NUM_CLASSES; ++i)
+	central_[i] = NULL;
+    }
+    // should be destroyed after the other threads using it exit
+    ~freelist_allocator() {
+      delete static_cast<cache*>(pthread_getspecific(key_));
+      pthread_key_delete(key_);
+      pthread_mutex_destroy(&mutex_);
+      while (slabs_ != NULL) {
+	slab* next = slabs_->next;
+	::free(slabs_);
+	slabs_ = next;
+      }
+    }
+    virtual void* allocate(size_t sz) {
+      if (sz > _NUM_CLASSES * 16)
+	return _allocate_large(sz);
+      size_t c = sz != 0 ? (sz - 1) / 16 : 0;
+      cache* tc = _cache();
+      block* b = tc->heads[c];
+      if (b == NULL)
+	b = _refill(tc, c);
+      tc->heads[c] = b->next;
+      tc->counts[c]--;
+      return b;
+    }
+    virtual void free(void* p, size_t) {
+      _free(_cache(), p);
+    }
+    virtual void free_bulk(void* const* blocks, size_t n) {
+      cache* tc = _cache();
+      for (size_t i = 0; i != n; ++i)
+	_free(tc, blocks[i]);
+    }
+    virtual size_t usable_size(void* p) {
+      return _slab_of(p)->slot_size;
+    }
+  protected:
+    static slab* _slab_of(void* p) {
+      return reinterpret_cast<slab*>(reinterpret_cast<uintptr_t>(p)
+				     & ~(uintptr_t)(_SLAB_SIZE - 1));
+    }
+    cache* _cache() {
+      cache* tc = static_cast<cache*>(pthread_getspecific(key_));
+      if (tc == NULL) {
+	tc = new cache;
+	for (size_t i = 0; i != _NUM_CLASSES; ++i) {
+	  tc->heads[i] = NULL;
+	  tc->counts[i] = 0;
+	}
+	tc->owner = this;
+	pthread_setspecific(key_, tc);
+      }
+      return tc;
+    }
+    void _free(cache* tc, void* p) {
+      slab* s = _slab_of(p);
+      if (s->slot_size > _NUM_CLASSES * 16) {
+	::free(s);
+	return;
+      }
+      size_t c = s->slot_size / 16 - 1;
+      block* b = static_cast<block*>(p);
+      b->next = tc->heads[c];
+      tc->heads[c] = b;
+      if (++tc->counts[c] == _BATCH * 2)
+	_flush(tc, c, _BATCH);
+    }
+    // takes a batch from the central list, or carves a new slab
+    block* _refill(cache* tc, size_t c) {
+      pthread_mutex_lock(&mutex_);
+      block* head = central_[c];
+      size_t n = 0;
+      if (head != NULL) {
+	block* last = head;
+	for (n = 1; n != _BATCH && last->next != NULL; ++n)
+	  last = last->next;
+	central_[c] = last->next;
+	last->next = NULL;
+      }
+      pthread_mutex_unlock(&mutex_);
+      if (head == NULL) {
+	void* p;
+	if (posix_memalign(&p, _SLAB_SIZE, _SLAB_SIZE) != 0)
+	  throw std::bad_alloc();
+	slab* s = static_cast<slab*>(p);
+	s->slot_size = (c + 1) * 16;
+	for (char* b = static_cast<char*>(p) + _SLAB_SIZE - s->slot_size;
+	     b >= static_cast<char*>(p) + _SLAB_HEADER_SIZE;
+	     b -= s->slot_size, ++n) {
+	  reinterpret_cast<block*>(b)->next = head;
+	  head = reinterpret_cast<block*>(b);
+	}
+	pthread_mutex_lock(&mutex_);
+	s->next = slabs_;
+	slabs_ = s;
+	pthread_mutex_unlock(&mutex_);
+      }
+      tc->heads[c] = head;
+      tc->counts[c] = n;
+      return head;
+    }
+    // returns n blocks of the cache to the central list
+    void _flush(cache* tc, size_t c, size_t n) {
+      block* head = tc->heads[c];
+      block* last = head;
+      for (size_t i = 1; i != n; ++i)
+	last = last->next;
+      tc->heads[c] = last->next;
+      tc->counts[c] -= n;
+      pthread_mutex_lock(&mutex_);
+      last->next = central_[c];
+      central_[c] = head;
+      pthread_mutex_unlock(&mutex_);
+    }
+    void* _allocate_large(size_t sz) {
+      void* p;
+      if (posix_memalign(&p, _SLAB_SIZE, _SLAB_HEADER_SIZE + sz) != 0)
+	throw std::bad_alloc();
+      static_cast<slab*>(p)->slot_size = (sz + 15) & ~(size_t)15;
+      return static_cast<char*>(p) + _SLAB_HEADER_SIZE;
+    }
+    static void _release_cache(void* p) {
+      cache* tc = static_cast<cache*>(p);
+      for (size_t c = 0; c != _NUM_CLASSES; ++c) {
+	if (tc->counts[c] != 0)
+	  tc->owner->_flush(tc, c, tc->counts[c]);
+      }
+      delete tc;
+    }
+  };
+
+}
+
+#endif
@@ -0,0 +1,462 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_heapdump_h
+#define picogc_heapdump_h
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#include <cxxabi.h>
+extern "C" {
+#include <stdint.h>
+}
+
+// please include picogc.h by yourself
+
+namespace picogc {
+
+  // layout of the dump: the header, the type names (each preceded by its
+  // length), the objects, the edges (indexes of the objects referred to,
+  // in the order of the objects) and the roots
+  struct _heap_dump_header {
+    char magic[8];
+    uint64_t num_types;
+    uint64_t num_objects;
+    uint64_t num_edges;
+    uint64_t num_roots;
+  };
+
+  struct _heap_dump_object {
+    uint32_t type;
+    uint32_t num_edges;
+    uint64_t size;
+  };
+
+  struct _heap_dump_root {
+    uint32_t kind;  // gc::ROOT_*
+    uint32_t object;
+    uint64_t index;
+  };
+
+  // writes all the objects of the heap with their edges (as reported by
+  // gc_mark) and the roots; references to objects not in the heap (e.g. in
+  // images) are omitted
+  inline bool write_heap_dump(FILE* fp, gc& gc)
+  {
+    struct recorder : public gc_visitor {
+      std::vector<std::pair<gc_object*, uint64_t> > objects_;
+      std::vector<uint32_t> edges_;
+      std::vector<_heap_dump_root> roots_;
+      uint32_t index_of(gc_object* obj) const {
+	std::vector<std::pair<gc_object*, uint64_t> >::const_iterator i =
+	  std::lower_bound(objects_.begin(), objects_.end(),
+			   std::make_pair(obj, (uint64_t)0));
+	return i != objects_.end() && i->first == obj
+	  ? (uint32_t)(i - objects_.begin()) : UINT32_MAX;
+      }
+      virtual void visit_object(gc_object* obj, size_t size) {
+	objects_.push_back(std::make_pair(obj, (uint64_t)size));
+      }
+      virtual void visit(gc_object* obj) {
+	uint32_t i = index_of(obj);
+	if (i != UINT32_MAX)
+	  edges_.push_back(i);
+      }
+      virtual void visit_root(gc_object* obj, int kind, size_t index) {
+	_heap_dump_root r;
+	r.kind = kind;
+	r.object = index_of(obj);
+	r.index = index;
+	if (r.object != UINT32_MAX)
+	  roots_.push_back(r);
+      }
+    } rec;
+    gc.visit_heap(&rec);
+    std::sort(rec.objects_.begin(), rec.objects_.end());
+
+    std::vector<std::string> types;
+    std::map<std::string, uint32_t> type_index;
+    std::vector<_heap_dump_object> objects(rec.objects_.size());
+    for (size_t i = 0; i != rec.objects_.size(); ++i) {
+      gc_object* obj = rec.objects_[i].first;
+      std::string name = typeid(*obj).name();
+      std::map<std::string, uint32_t>::iterator ti = type_index.find(name);
+      if (ti == type_index.end()) {
+	ti = type_index.insert(std::make_pair(name, (uint32_t)types.size()))
+	  .first;
+	types.push_back(name);
+      }
+      size_t num_edges = rec.edges_.size();
+      gc.visit_members(obj, &rec);
+      objects[i].type = ti->second;
+      objects[i].num_edges = (uint32_t)(rec.edges_.size() - num_edges);
+      objects[i].size = rec.objects_[i].second;
+    }
+    gc.visit_roots(&rec);
+
+    _heap_dump_header header;
+    memcpy(header.magic, "picogcd1", 8);
+    header.num_types = types.size();
+    header.num_objects = objects.size();
+    header.num_edges = rec.edges_.size();
+    header.num_roots = rec.roots_.size();
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+      return false;
+    for (size_t i = 0; i != types.size(); ++i) {
+      uint32_t len = types[i].size();
+      if (fwrite(&len, sizeof(len), 1, fp) != 1
+	  || fwrite(types[i].data(), 1, len, fp) != len)
+	return false;
+    }
+    return (objects.empty()
+	    || fwrite(&objects[0], sizeof(objects[0]), objects.size(), fp)
+	    == objects.size())
+      && (rec.edges_.empty()
+	  || fwrite(&rec.edges_[0], sizeof(uint32_t), rec.edges_.size(), fp)
+	  == rec.edges_.size())
+      && (rec.roots_.empty()
+	  || fwrite(&rec.roots_[0], sizeof(_heap_dump_root), rec.roots_.size(),
+		    fp) == rec.roots_.size())
+      && fflush(fp) == 0;
+  }
+
+  // reads a heap dump, and computes the dominator tree and the retained
+  // sizes.  The roots are the immediate successors of a virtual super root
+  // (node 0); node 1 + i is the root i, and node 1 + num_roots() + i is the
+  // object i.
+  class heap_dump {
+  public:
+    enum {
+      UNREACHABLE = UINT32_MAX
+    };
+    struct type_summary {
+      std::string name;
+      size_t count;
+      uint64_t shallow_size;
+      // sum of the objects not dominated by another of the same type
+      uint64_t retained_size;
+      type_summary() : name(), count(0), shallow_size(0), retained_size(0) {}
+    };
+  protected:
+    std::vector<std::string> types_;
+    std::vector<_heap_dump_object> objects_;
+    std::vector<uint64_t> edge_offsets_; // per object
+    std::vector<uint32_t> edges_;
+    std::vector<_heap_dump_root> roots_;
+    // per node
+    std::vector<uint32_t> idom_;
+    std::vector<uint64_t> retained_;
+  public:
+    heap_dump() {}
+    bool read(FILE* fp);
+    void analyze();
+    size_t num_types() const { return types_.size(); }
+    // demangled
+    std::string type_name(size_t i) const;
+    size_t num_objects() const { return objects_.size(); }
+    uint32_t object_type(size_t i) const { return objects_[i].type; }
+    uint64_t object_size(size_t i) const { return objects_[i].size; }
+    size_t num_edges(size_t i) const { return objects_[i].num_edges; }
+    uint32_t edge(size_t i, size_t j) const {
+      return edges_[edge_offsets_[i] + j];
+    }
+    size_t num_roots() const { return roots_.size(); }
+    int root_kind(size_t i) const { return roots_[i].kind; }
+    size_t root_index(size_t i) const { return roots_[i].index; }
+    uint32_t root_object(size_t i) const { return roots_[i].object; }
+    // the following are available after analyze
+    size_t num_nodes() const { return 1 + roots_.size() + objects_.size(); }
+    size_t object_node(size_t i) const { return 1 + roots_.size() + i; }
+    uint32_t idom(size_t node) const { return idom_[node]; }
+    uint64_t retained_size(size_t node) const { return retained_[node]; }
+    uint64_t object_retained_size(size_t i) const {
+      return retained_[object_node(i)];
+    }
+    uint64_t root_retained_size(size_t i) const { return retained_[1 + i]; }
+    bool is_reachable(size_t i) const {
+      return idom_[object_node(i)] != UNREACHABLE;
+    }
+    std::vector<type_summary> type_summaries() const;
+  protected:
+    template <typename T> static bool _read(FILE* fp, std::vector<T>& v,
+					    size_t n) {
+      v.resize(n);
+      return n == 0 || fread(&v[0], sizeof(T), n, fp) == n;
+    }
+    void _successors(size_t node, const uint32_t*& first,
+		     const uint32_t*& last, uint32_t& single) const;
+  };
+
+  inline bool heap_dump::read(FILE* fp)
+  {
+    _heap_dump_header header;
+    if (fread(&header, sizeof(header), 1, fp) != 1
+	|| memcmp(header.magic, "picogcd1", 8) != 0)
+      return false;
+    types_.clear();
+    for (size_t i = 0; i != header.num_types; ++i) {
+      uint32_t len;
+      if (fread(&len, sizeof(len), 1, fp) != 1)
+	return false;
+      std::vector<char> buf;
+      if (! _read(fp, buf, len))
+	return false;
+      types_.push_back(std::string(buf.begin(), buf.end()));
+    }
+    if (! _read(fp, objects_, header.num_objects)
+	|| ! _read(fp, edges_, header.num_edges)
+	|| ! _read(fp, roots_, header.num_roots))
+      return false;
+    // validate, and index the edges
+    edge_offsets_.resize(objects_.size());
+    uint64_t offset = 0;
+    for (size_t i = 0; i != objects_.size(); ++i) {
+      if (objects_[i].type >= types_.size())
+	return false;
+      edge_offsets_[i] = offset;
+      offset += objects_[i].num_edges;
+    }
+    if (offset != edges_.size())
+      return false;
+    for (size_t i = 0; i != edges_.size(); ++i)
+      if (edges_[i] >= objects_.size())
+	return false;
+    for (size_t i = 0; i != roots_.size(); ++i)
+      if (roots_[i].object >= objects_.size())
+	return false;
+    idom_.clear();
+    retained_.clear();
+    return true;
+  }
+
+  inline std::string heap_dump::type_name(size_t i) const
+  {
+    int status;
+    char* demangled =
+      abi::__cxa_demangle(types_[i].c_str(), NULL, NULL, &status);
+    if (demangled == NULL)
+      return types_[i];
+    std::string name(demangled);
+    free(demangled);
+    return name;
+  }
+
+  inline void heap_dump::_successors(size_t node, const uint32_t*& first,
+				     const uint32_t*& last,
+				     uint32_t& single) const
+  {
+    // successors of the super root and the roots are computed on the fly
+    // (as node numbers), those of the objects are the edges (as indexes)
+    if (node == 0) {
+      first = last = NULL;
+    } else if (node <= roots_.size()) {
+      single = roots_[node - 1].object;
+      first = &single;
+      last = first + 1;
+    } else {
+      size_t i = node - 1 - roots_.size();
+      first = edges_.empty() ? NULL : &edges_[0] + edge_offsets_[i];
+      last = first + objects_[i].num_edges;
+    }
+  }
+
+  // the iterative algorithm by Cooper, Harvey and Kennedy
+  inline void heap_dump::analyze()
+  {
+    size_t n = num_nodes(), base = 1 + roots_.size();
+    // number the nodes in post order, by depth-first search
+    std::vector<uint32_t> post(n, UNREACHABLE), order;
+    order.reserve(n);
+    {
+      std::vector<uint8_t> visited(n, 0);
+      std::vector<std::pair<uint32_t, uint32_t> > stack; // node, next child
+      stack.push_back(std::make_pair(0, 0));
+      visited[0] = 1;
+      while (! stack.empty()) {
+	uint32_t node = stack.back().first, child = stack.back().second;
+	uint32_t next;
+	if (node == 0) {
+	  if (child == roots_.size()) {
+	    next = UNREACHABLE;
+	  } else {
+	    next = 1 + child;
+	  }
+	} else {
+	  const uint32_t* first, * last;
+	  uint32_t single;
+	  _successors(node, first, last, single);
+	  next = first + child == last ? UNREACHABLE : base + first[child];
+	}
+	if (next == UNREACHABLE) {
+	  post[node] = order.size();
+	  order.push_back(node);
+	  stack.pop_back();
+	} else {
+	  ++stack.back().second;
+	  if (! visited[next]) {
+	    visited[next] = 1;
+	    stack.push_back(std::make_pair(next, 0));
+	  }
+	}
+      }
+    }
+    // predecessors of the reachable nodes
+    std::vector<uint64_t> pred_offsets(n + 1, 0);
+    std::vector<uint32_t> preds;
+    for (int pass = 0; pass != 2; ++pass) {
+      if (pass == 1) {
+	for (size_t i = 0; i != n; ++i)
+	  pred_offsets[i + 1] += pred_offsets[i];
+	preds.resize(pred_offsets[n]);
+      }
+      std::vector<uint64_t> fill(pred_offsets.begin(), pred_offsets.end() - 1);
+      for (size_t i = 0; i != order.size(); ++i) {
+	uint32_t node = order[i];
+	if (node == 0) {
+	  for (size_t r = 0; r != roots_.size(); ++r) {
+	    if (pass == 0)
+	      ++pred_offsets[1 + r + 1];
+	    else
+	      preds[fill[1 + r]++] = 0;
+	  }
+	  continue;
+	}
+	const uint32_t* first, * last;
+	uint32_t single;
+	_successors(node, first, last, single);
+	for (; first != last; ++first) {
+	  size_t succ = base + *first;
+	  if (pass == 0)
+	    ++pred_offsets[succ + 1];
+	  else
+	    preds[fill[succ]++] = node;
+	}
+      }
+    }
+    // compute the immediate dominators, in reverse post order
+    idom_.assign(n, UNREACHABLE);
+    idom_[0] = 0;
+    for (bool changed = true; changed; ) {
+      changed = false;
+      for (size_t i = order.size() - 1; i-- != 0; ) {
+	uint32_t node = order[i], new_idom = UNREACHABLE;
+	for (uint64_t p = pred_offsets[node]; p != pred_offsets[node + 1];
+	     ++p) {
+	  uint32_t pred = preds[p];
+	  if (idom_[pred] == UNREACHABLE)
+	    continue;
+	  if (new_idom == UNREACHABLE) {
+	    new_idom = pred;
+	    continue;
+	  }
+	  // intersect
+	  uint32_t a = pred, b = new_idom;
+	  while (a != b) {
+	    while (post[a] < post[b])
+	      a = idom_[a];
+	    while (post[b] < post[a])
+	      b = idom_[b];
+	  }
+	  new_idom = a;
+	}
+	if (idom_[node] != new_idom) {
+	  idom_[node] = new_idom;
+	  changed = true;
+	}
+      }
+    }
+    // the retained size of a node is the sum of the nodes it dominates;
+    // children appear before their dominators in post order
+    retained_.assign(n, 0);
+    for (size_t i = 0; i != order.size(); ++i) {
+      uint32_t node = order[i];
+      if (node >= base)
+	retained_[node] += objects_[node - base].size;
+      if (node != 0)
+	retained_[idom_[node]] += retained_[node];
+    }
+  }
+
+  inline std::vector<heap_dump::type_summary> heap_dump::type_summaries() const
+  {
+    std::vector<type_summary> summaries(types_.size());
+    for (size_t i = 0; i != types_.size(); ++i)
+      summaries[i].name = type_name(i);
+    size_t base = 1 + roots_.size();
+    for (size_t i = 0; i != objects_.size(); ++i) {
+      summaries[objects_[i].type].count++;
+      summaries[objects_[i].type].shallow_size += objects_[i].size;
+    }
+    // walk the dominator tree, counting the objects of each type being
+    // entered, so that the retained sizes are not counted twice
+    std::vector<uint64_t> child_offsets(num_nodes() + 1, 0);
+    std::vector<uint32_t> children;
+    for (size_t node = 1; node != num_nodes(); ++node)
+      if (idom_[node] != UNREACHABLE)
+	++child_offsets[idom_[node] + 1];
+    for (size_t i = 0; i != num_nodes(); ++i)
+      child_offsets[i + 1] += child_offsets[i];
+    children.resize(child_offsets[num_nodes()]);
+    {
+      std::vector<uint64_t> fill(child_offsets.begin(),
+				 child_offsets.end() - 1);
+      for (size_t node = 1; node != num_nodes(); ++node)
+	if (idom_[node] != UNREACHABLE)
+	  children[fill[idom_[node]]++] = node;
+    }
+    std::vector<size_t> active(types_.size(), 0);
+    std::vector<std::pair<uint32_t, uint64_t> > stack; // node, next child
+    stack.push_back(std::make_pair(0, child_offsets[0]));
+    while (! stack.empty()) {
+      uint32_t node = stack.back().first;
+      if (stack.back().second == child_offsets[node + 1]) {
+	if (node >= base)
+	  --active[objects_[node - base].type];
+	stack.pop_back();
+	continue;
+      }
+      uint32_t child = children[stack.back().second++];
+      if (child >= base) {
+	uint32_t type = objects_[child - base].type;
+	if (active[type]++ == 0)
+	  summaries[type].retained_size += retained_[child];
+      }
+      stack.push_back(std::make_pair(child, child_offsets[child]));
+    }
+    return summaries;
+  }
+
+}
+
+#endif
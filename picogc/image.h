@@ -0,0 +1,440 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_image_h
+#define picogc_image_h
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <new>
+#include <vector>
+extern "C" {
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+// please include picogc.h by yourself
+
+namespace picogc {
+
+  // maps the types of the objects stored in images to stable ids.  The
+  // types should derive from gc_object by single inheritance, be default
+  // constructible (a temporary is created to obtain the vtable), and should
+  // not hold pointers other than the members reported by gc_mark (which
+  // should be passed to gc::mark as they are held, as raw pointers or
+  // member; movable and compressed_ptr are not supported).
+  class image_types {
+  public:
+    struct type {
+      uint32_t id;
+      size_t size;
+      const void* vptr;
+    };
+  protected:
+    std::map<const void*, type> by_vptr_;
+    std::map<uint32_t, type> by_id_;
+  public:
+    template <typename T> image_types& add(uint32_t id) {
+      union {
+	char buf[sizeof(T)];
+	long double align1;
+	long long align2;
+	void* align3;
+      } u;
+      T* t = ::new (static_cast<void*>(u.buf)) T();
+      assert(static_cast<void*>(static_cast<gc_object*>(t)) == t);
+      type ty;
+      ty.id = id;
+      ty.size = sizeof(T);
+      ty.vptr = *reinterpret_cast<const void* const*>(t);
+      t->~T();
+      by_vptr_[ty.vptr] = ty;
+      by_id_[id] = ty;
+      return *this;
+    }
+    const type* find(const gc_object* obj) const {
+      std::map<const void*, type>::const_iterator i =
+	by_vptr_.find(*reinterpret_cast<const void* const*>(obj));
+      return i != by_vptr_.end() ? &i->second : NULL;
+    }
+    const type* find(uint32_t id) const {
+      std::map<uint32_t, type>::const_iterator i = by_id_.find(id);
+      return i != by_id_.end() ? &i->second : NULL;
+    }
+  };
+
+  // layout of the image (64-bit only): the header, the types (id and
+  // size), the roots, the fixups and the objects (all offsets are relative
+  // to the objects).
+  // The objects are laid out as in the arena (each preceded by its step),
+  // with the vptr replaced by the index of the type and the pointers
+  // replaced by the offsets of the objects they refer to.
+  struct _image_header {
+    char magic[8];
+    uint64_t num_types;
+    uint64_t num_roots;
+    uint64_t num_fixups;
+    uint64_t data_size;
+  };
+
+  struct _image_type {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t size;
+  };
+
+  // pointer-keyed hash table (open addressing), mapping the objects to
+  // their offsets in the image
+  class _image_offsets {
+    std::vector<std::pair<const gc_object*, uint64_t> > slots_;
+    size_t size_;
+  public:
+    _image_offsets() : slots_(1024), size_(0) {}
+    uint64_t* find(const gc_object* obj) {
+      size_t i = _slot_of(obj);
+      return slots_[i].first != NULL ? &slots_[i].second : NULL;
+    }
+    void insert(const gc_object* obj, uint64_t offset) {
+      if ((size_ + 1) * 2 > slots_.size()) {
+	std::vector<std::pair<const gc_object*, uint64_t> > old(
+	  slots_.size() * 2);
+	old.swap(slots_);
+	for (size_t i = 0; i != old.size(); ++i)
+	  if (old[i].first != NULL)
+	    slots_[_slot_of(old[i].first)] = old[i];
+      }
+      slots_[_slot_of(obj)] = std::make_pair(obj, offset);
+      ++size_;
+    }
+  protected:
+    size_t _slot_of(const gc_object* obj) const {
+      size_t mask = slots_.size() - 1;
+      size_t i = ((uintptr_t)obj >> 4) * 0x9e3779b97f4a7c15ULL >> 20 & mask;
+      while (slots_[i].first != NULL && slots_[i].first != obj)
+	i = (i + 1) & mask;
+      return i;
+    }
+  };
+
+  template <typename T> inline bool _image_write(FILE* fp,
+						 const std::vector<T>& v)
+  {
+    return v.empty() || fwrite(&v[0], sizeof(T), v.size(), fp) == v.size();
+  }
+
+  // writes the objects reachable from the roots as an image; fails if any
+  // of them is of a type not registered, if it has members that cannot be
+  // fixed up (see image_types), or on I/O errors
+  inline bool save_image(FILE* fp, gc& gc, gc_object* const* roots,
+			 size_t num_roots, const image_types& types)
+  {
+    std::vector<_image_type> type_table;
+    std::map<uint32_t, uint64_t> type_index;
+    std::vector<const gc_object*> objects;
+    std::vector<uint64_t> object_types;
+    _image_offsets offsets;
+    uint64_t data_size = 16;
+
+    // find the objects (breadth first), and assign the offsets
+    struct finder : public gc_visitor {
+      const image_types& types_;
+      std::vector<_image_type>& type_table_;
+      std::map<uint32_t, uint64_t>& type_index_;
+      std::vector<const gc_object*>& objects_;
+      std::vector<uint64_t>& object_types_;
+      _image_offsets& offsets_;
+      uint64_t& data_size_;
+      std::vector<std::pair<const void*, const gc_object*> > slots_;
+      const void* last_vptr_;
+      uint64_t last_type_;
+      size_t last_size_;
+      bool failed_;
+      finder(const image_types& types, std::vector<_image_type>& type_table,
+	     std::map<uint32_t, uint64_t>& type_index,
+	     std::vector<const gc_object*>& objects,
+	     std::vector<uint64_t>& object_types, _image_offsets& offsets,
+	     uint64_t& data_size)
+	: types_(types), type_table_(type_table), type_index_(type_index),
+	  objects_(objects), object_types_(object_types), offsets_(offsets),
+	  data_size_(data_size), slots_(), last_vptr_(NULL),
+	  last_type_(0), last_size_(0), failed_(false) {}
+      virtual void visit_slot(const void* slot, gc_object* obj) {
+	if (slot == NULL) // movable or compressed_ptr
+	  failed_ = true;
+	slots_.push_back(std::make_pair(slot, obj));
+	visit(obj);
+      }
+      virtual void visit(gc_object* obj) {
+	if (offsets_.find(obj) != NULL)
+	  return;
+	// objects of same type tend to be found one after another
+	const void* vptr = *reinterpret_cast<const void* const*>(obj);
+	if (vptr != last_vptr_) {
+	  const image_types::type* ty = types_.find(obj);
+	  if (ty == NULL) {
+	    failed_ = true;
+	    return;
+	  }
+	  std::map<uint32_t, uint64_t>::iterator ti = type_index_.find(ty->id);
+	  if (ti == type_index_.end()) {
+	    _image_type t;
+	    t.id = ty->id;
+	    t.reserved = 0;
+	    t.size = ty->size;
+	    ti = type_index_.insert(
+	      std::make_pair(ty->id, (uint64_t)type_table_.size())).first;
+	    type_table_.push_back(t);
+	  }
+	  last_vptr_ = vptr;
+	  last_type_ = ti->second;
+	  last_size_ = ty->size;
+	}
+	offsets_.insert(obj, data_size_);
+	objects_.push_back(obj);
+	object_types_.push_back(last_type_);
+	data_size_ += (last_size_ + sizeof(uint64_t) + 15) & ~(uint64_t)15;
+      }
+    } f(types, type_table, type_index, objects, object_types, offsets,
+	data_size);
+    for (size_t i = 0; i != num_roots; ++i)
+      if (roots[i] != NULL)
+	f.visit(roots[i]);
+    for (size_t i = 0; i != objects.size() && ! f.failed_; ++i)
+      gc.visit_members(const_cast<gc_object*>(objects[i]), &f);
+    if (f.failed_)
+      return false;
+
+    // copy the objects, replacing the vptrs and the pointers
+    std::vector<char> data(data_size);
+    std::vector<uint64_t> fixups;
+    for (size_t i = 0; i != objects.size(); ++i) {
+      const gc_object* obj = objects[i];
+      uint64_t offset = *offsets.find(obj);
+      f.slots_.clear();
+      gc.visit_members(const_cast<gc_object*>(obj), &f);
+      size_t size = type_table[object_types[i]].size;
+      uint64_t* dst = reinterpret_cast<uint64_t*>(&data[offset]);
+      dst[-1] = (size + sizeof(uint64_t) + 15) & ~(uint64_t)15;
+      memcpy(dst, obj, size);
+      dst[0] = object_types[i];
+      dst[1] = (dst[1] & _FLAG_MASK) | _FLAG_MARKED;
+      // the slots reported by gc_mark are the pointers to be fixed up; the
+      // members not held within the object (e.g. converted to a
+      // temporary) or not pointing to the start of the object cannot be
+      for (size_t j = 0; j != f.slots_.size(); ++j) {
+	const void* slot = f.slots_[j].first;
+	uintptr_t at = (uintptr_t)slot - (uintptr_t)obj;
+	if (at % sizeof(uint64_t) != 0 || at < 2 * sizeof(uint64_t)
+	    || at + sizeof(uint64_t) > size
+	    || *static_cast<const gc_object* const*>(slot)
+	       != f.slots_[j].second)
+	  return false;
+	dst[at / sizeof(uint64_t)] = *offsets.find(f.slots_[j].second);
+	fixups.push_back(offset + at);
+      }
+    }
+    // (a slot reported twice is fixed up once)
+    std::sort(fixups.begin(), fixups.end());
+    fixups.erase(std::unique(fixups.begin(), fixups.end()), fixups.end());
+
+    // write
+    _image_header header;
+    memcpy(header.magic, "picogc01", 8);
+    header.num_types = type_table.size();
+    header.num_roots = num_roots;
+    header.num_fixups = fixups.size();
+    header.data_size = data_size;
+    std::vector<uint64_t> root_offsets(num_roots);
+    for (size_t i = 0; i != num_roots; ++i)
+      root_offsets[i] = roots[i] != NULL ? *offsets.find(roots[i]) : 0;
+    // the objects follow the tables, aligned to 16 bytes
+    if ((sizeof(header) + type_table.size() * sizeof(_image_type)
+	 + (num_roots + fixups.size()) * sizeof(uint64_t)) % 16 != 0)
+      fixups.push_back(0);
+    header.num_fixups = fixups.size();
+    return fwrite(&header, sizeof(header), 1, fp) == 1
+      && _image_write(fp, type_table) && _image_write(fp, root_offsets)
+      && _image_write(fp, fixups) && _image_write(fp, data)
+      && fflush(fp) == 0;
+  }
+
+  // an image mapped into memory.  The objects are usable once loaded, and
+  // are never collected nor destroyed; register the image to the heap by
+  // gc::add_roots if they are modified to refer to the objects of the heap.
+  // Then every collection calls gc_mark of all the objects in the image
+  // (they are kept marked, so the references within the image end there),
+  // which costs about as much as marking a heap of the same objects; keep
+  // the references to the heap in a few objects registered separately if
+  // the image is large.
+  class image : public gc_roots {
+  protected:
+    void* map_;
+    size_t map_size_;
+    char* data_;
+    size_t data_size_;
+    std::vector<gc_object*> roots_;
+    size_t num_objects_;
+    image(const image&); // = delete;
+    image& operator=(const image&); // = delete;
+  public:
+    image() : map_(NULL), map_size_(0), data_(NULL), data_size_(0), roots_(),
+	      num_objects_(0) {}
+    ~image() {
+      unload();
+    }
+    // fails if the file is broken, or if any of the types are not
+    // registered (or differ in size)
+    bool load(const char* path, const image_types& types);
+    // unmaps the image (the objects should no longer be referred to)
+    void unload();
+    size_t num_roots() const { return roots_.size(); }
+    gc_object* root(size_t i) const { return roots_[i]; }
+    size_t num_objects() const { return num_objects_; }
+    bool contains(const void* p) const {
+      return data_ <= p && p < data_ + data_size_;
+    }
+    virtual void gc_mark_roots(gc* gc) {
+      if (data_ == NULL)
+	return;
+      for (char* p = data_ + 16; p != data_ + data_size_;
+	   p += reinterpret_cast<uint64_t*>(p)[-1])
+	gc->mark_members(reinterpret_cast<gc_object*>(p));
+    }
+  };
+
+  inline bool image::load(const char* path, const image_types& types)
+  {
+    unload();
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(_image_header)) {
+      close(fd);
+      return false;
+    }
+    // private, so that the objects can be fixed up (and modified)
+    int flags = MAP_PRIVATE;
+#ifdef MAP_POPULATE
+    // faulting the pages one by one costs more than the fixups
+    flags |= MAP_POPULATE;
+#endif
+    void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+      return false;
+    map_ = map;
+    map_size_ = st.st_size;
+
+    const _image_header* header = static_cast<const _image_header*>(map_);
+    if (memcmp(header->magic, "picogc01", 8) != 0) {
+      unload();
+      return false;
+    }
+    size_t table_size = sizeof(_image_header)
+      + header->num_types * sizeof(_image_type)
+      + (header->num_roots + header->num_fixups) * sizeof(uint64_t);
+    if (table_size + header->data_size != map_size_
+	|| table_size % 16 != 0 || header->data_size < 16) {
+      unload();
+      return false;
+    }
+    const _image_type* type_table =
+      reinterpret_cast<const _image_type*>(header + 1);
+    const uint64_t* root_offsets =
+      reinterpret_cast<const uint64_t*>(type_table + header->num_types);
+    const uint64_t* fixups = root_offsets + header->num_roots;
+    data_ = static_cast<char*>(map_) + table_size;
+    data_size_ = header->data_size;
+
+    // map the type indexes to vptrs
+    std::vector<const void*> vptrs(header->num_types);
+    for (size_t i = 0; i != header->num_types; ++i) {
+      const image_types::type* ty = types.find(type_table[i].id);
+      if (ty == NULL || ty->size != type_table[i].size) {
+	unload();
+	return false;
+      }
+      vptrs[i] = ty->vptr;
+    }
+    // fix up the pointers (a zero offset is padding) and the vptrs
+    for (size_t i = 0; i != header->num_fixups; ++i) {
+      if (fixups[i] == 0)
+	continue;
+      uint64_t* slot = reinterpret_cast<uint64_t*>(data_ + fixups[i]);
+      if (fixups[i] % sizeof(uint64_t) != 0 || fixups[i] >= data_size_
+	  || *slot >= data_size_) {
+	unload();
+	return false;
+      }
+      *slot += (uintptr_t)data_;
+    }
+    for (char* p = data_ + 16; p != data_ + data_size_; ++num_objects_) {
+      uint64_t* words = reinterpret_cast<uint64_t*>(p);
+      if (words[-1] < 32 || words[-1] % 16 != 0
+	  || words[-1] > (uint64_t)(data_ + data_size_ - p)
+	  || words[0] >= vptrs.size()) {
+	unload();
+	return false;
+      }
+      *reinterpret_cast<const void**>(p) = vptrs[words[0]];
+      p += words[-1];
+    }
+    for (size_t i = 0; i != header->num_roots; ++i) {
+      if (root_offsets[i] >= data_size_) {
+	unload();
+	return false;
+      }
+      roots_.push_back(root_offsets[i] != 0
+		       ? reinterpret_cast<gc_object*>(data_ + root_offsets[i])
+		       : NULL);
+    }
+    return true;
+  }
+
+  inline void image::unload()
+  {
+    if (map_ != NULL)
+      munmap(map_, map_size_);
+    map_ = NULL;
+    map_size_ = 0;
+    data_ = NULL;
+    data_size_ = 0;
+    roots_.clear();
+    num_objects_ = 0;
+  }
+
+}
+
+#endif
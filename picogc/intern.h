@@ -0,0 +1,186 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_intern_h
+#define picogc_intern_h
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+extern "C" {
+#include <stdint.h>
+}
+
+// please include picogc.h by yourself
+
+namespace picogc {
+
+  struct intern_stats {
+    size_t lookups; // calls to find
+    size_t hits;    // lookups that found an interned object
+    size_t entries; // objects being interned
+    size_t dropped; // entries dropped as the objects were collected
+    intern_stats() : lookups(0), hits(0), entries(0), dropped(0) {}
+    // objects requested per object allocated
+    double dedup_ratio() const {
+      return lookups != hits ? (double)lookups / (lookups - hits) : 1;
+    }
+  };
+
+  // hash-consing of immutable objects; find returns the interned object
+  // equal to the key (as tested by T::intern_equals(key)), and insert
+  // registers a new one.  The entries are weak; the objects found dead by
+  // a collection are dropped before being swept.  The table registers
+  // itself to the heap, and its objects should not be transferred (nor be
+  // MOVABLE, as the entries are not updated by the compaction).
+  template <typename T> class intern_table : public gc_roots {
+    struct entry {
+      size_t hash;
+      T* obj; // NULL if empty
+    };
+    std::vector<entry> entries_; // open addressing, with linear probing
+    size_t min_capacity_;
+    intern_stats stats_;
+  public:
+    // capacity is rounded up to a power of 2
+    intern_table(gc& gc, size_t capacity = 1024)
+      : entries_(), min_capacity_(16), stats_() {
+      while (min_capacity_ < capacity)
+	min_capacity_ *= 2;
+      entries_.resize(min_capacity_, _empty());
+      gc.add_roots(this);
+    }
+    template <typename Key> T* find(size_t hash, const Key& key) {
+      stats_.lookups++;
+      size_t mask = entries_.size() - 1;
+      for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+	const entry& e = entries_[i];
+	if (e.obj == NULL)
+	  return NULL;
+	if (e.hash == hash && e.obj->intern_equals(key)) {
+	  stats_.hits++;
+	  return e.obj;
+	}
+      }
+    }
+    // obj should not be equal to any of the interned objects
+    T* insert(size_t hash, T* obj) {
+      if ((stats_.entries + 1) * 2 > entries_.size())
+	_rehash(entries_.size() * 2);
+      _insert(hash, obj);
+      stats_.entries++;
+      return obj;
+    }
+    const intern_stats& stats() const { return stats_; }
+    virtual void gc_clear_weak(gc*) {
+      size_t num_alive = 0;
+      for (size_t i = 0; i != entries_.size(); ++i) {
+	if (entries_[i].obj != NULL && entries_[i].obj->gc_is_marked())
+	  num_alive++;
+      }
+      if (num_alive == stats_.entries)
+	return;
+      stats_.dropped += stats_.entries - num_alive;
+      // rebuild with the survivors, shrinking the table if it got sparse
+      size_t capacity = entries_.size();
+      while (capacity > min_capacity_ && num_alive * 8 < capacity)
+	capacity /= 2;
+      _rehash(capacity, true);
+      stats_.entries = num_alive;
+    }
+  protected:
+    static entry _empty() {
+      entry e = { 0, NULL };
+      return e;
+    }
+    void _insert(size_t hash, T* obj) {
+      size_t mask = entries_.size() - 1;
+      size_t i = hash & mask;
+      while (entries_[i].obj != NULL)
+	i = (i + 1) & mask;
+      entries_[i].hash = hash;
+      entries_[i].obj = obj;
+    }
+    void _rehash(size_t capacity, bool marked_only = false) {
+      std::vector<entry> old(capacity, _empty());
+      old.swap(entries_);
+      for (size_t i = 0; i != old.size(); ++i) {
+	if (old[i].obj != NULL && ! (marked_only && ! old[i].obj->gc_is_marked()))
+	  _insert(old[i].hash, old[i].obj);
+      }
+    }
+  };
+
+  // an immutable string, allocated as atomic with the characters trailing
+  // (and null-terminated); created by intern()
+  class interned_string : public gc_object {
+    size_t size_;
+  public:
+    struct key {
+      const char* s;
+      size_t len;
+      key(const char* s, size_t len) : s(s), len(len) {}
+    };
+    interned_string(const char* s, size_t len) : size_(len) {
+      memcpy(data(), s, len);
+      data()[len] = '\0';
+    }
+    size_t size() const { return size_; }
+    char* data() { return trailing_elements<char>(this); }
+    const char* c_str() const {
+      return trailing_elements<char>(const_cast<interned_string*>(this));
+    }
+    bool intern_equals(const key& k) const {
+      return k.len == size_ && memcmp(c_str(), k.s, k.len) == 0;
+    }
+    // FNV-1a
+    static size_t hash(const char* s, size_t len) {
+      uint64_t h = 14695981039346656037ULL;
+      for (size_t i = 0; i != len; ++i)
+	h = (h ^ (unsigned char)s[i]) * 1099511628211ULL;
+      return (size_t)h;
+    }
+  };
+
+  // returns the interned string equal to s, allocating one if none
+  inline interned_string* intern(intern_table<interned_string>& table,
+				 const char* s, size_t len, int flags = 0)
+  {
+    assert((flags & MOVABLE) == 0);
+    size_t hash = interned_string::hash(s, len);
+    interned_string* found = table.find(hash, interned_string::key(s, len));
+    if (found != NULL)
+      return found;
+    return table.insert(hash, new (trailing<char>(len + 1),
+				   flags | IS_ATOMIC | TRIVIALLY_DESTRUCTIBLE)
+			interned_string(s, len));
+  }
+
+}
+
+#endif
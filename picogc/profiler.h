@@ -0,0 +1,195 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_profiler_h
+#define picogc_profiler_h
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <vector>
+#include <cxxabi.h>
+extern "C" {
+#include <dlfcn.h>
+#include <execinfo.h>
+}
+
+// please include picogc.h by yourself
+// (link with -rdynamic so that the call sites can be symbolized)
+
+namespace picogc {
+
+  class alloc_profiler : public gc_sampler {
+  public:
+    enum {
+      ALLOCATED, // estimated bytes allocated
+      LIVE,      // estimated bytes still alive
+      SURVIVED   // estimated bytes x number of collections survived
+    };
+    typedef std::vector<void*> callstack;
+    struct site {
+      size_t samples;
+      double bytes;
+      size_t live;
+      double live_bytes;
+      double survived_bytes;
+      site() : samples(0), bytes(0), live(0), live_bytes(0), survived_bytes(0)
+      {}
+    };
+  protected:
+    struct sampled {
+      site* site_;
+      double bytes_;
+    };
+    size_t mean_interval_;
+    size_t max_depth_;
+    uint64_t rand_;
+    std::map<callstack, site> sites_;
+    std::map<gc_object*, sampled> sampled_;
+    // the sampled object is no longer alive
+    static void _release(const sampled& e) {
+      e.site_->live--;
+      e.site_->live_bytes -= e.bytes_;
+    }
+  public:
+    alloc_profiler(size_t mean_interval = 512 * 1024, size_t max_depth = 64)
+      : mean_interval_(mean_interval), max_depth_(max_depth),
+	rand_(0x9e3779b97f4a7c15ULL) {}
+    const std::map<callstack, site>& sites() const { return sites_; }
+    void clear() {
+      sites_.clear();
+      sampled_.clear();
+    }
+    // poisson sampling; the intervals are exponentially distributed
+    virtual size_t next_interval(gc*) {
+      rand_ ^= rand_ >> 12;
+      rand_ ^= rand_ << 25;
+      rand_ ^= rand_ >> 27;
+      double u = ((rand_ * 0x2545f4914f6cdd1dULL) >> 11) / 9007199254740992.0;
+      double n = -log(1 - u) * mean_interval_;
+      return n < 1 ? 1 : (size_t)n;
+    }
+    virtual void sample(gc*, gc_object* obj, size_t sz) {
+      void* frames[256];
+      int depth = backtrace(frames, max_depth_ < 256 ? (int)max_depth_ : 256);
+      site& s = sites_[callstack(frames, frames + depth)];
+      // an object of sz bytes is sampled with probability 1 - exp(-sz/mean)
+      double bytes = sz / (1 - exp(-(double)sz / mean_interval_));
+      s.samples++;
+      s.bytes += bytes;
+      s.live++;
+      s.live_bytes += bytes;
+      sampled e = { &s, bytes };
+      std::pair<std::map<gc_object*, sampled>::iterator, bool> r =
+	sampled_.insert(std::make_pair(obj, e));
+      if (! r.second) {
+	// the address is reused; the object sampled has been freed
+	_release(r.first->second);
+	r.first->second = e;
+      }
+    }
+    virtual void mark_end(gc*) {
+      for (std::map<gc_object*, sampled>::iterator i = sampled_.begin();
+	   i != sampled_.end(); ) {
+	if (i->first->gc_is_marked()) {
+	  i->second.site_->survived_bytes += i->second.bytes_;
+	  ++i;
+	} else {
+	  _release(i->second);
+	  sampled_.erase(i++);
+	}
+      }
+    }
+    virtual void cleared(gc*) {
+      for (std::map<gc_object*, sampled>::iterator i = sampled_.begin();
+	   i != sampled_.end(); ++i)
+	_release(i->second);
+      sampled_.clear();
+    }
+    // the sample is kept only if the target heap is profiled by this
+    virtual void transferred(gc*, gc_object* obj, gc* to) {
+      if (to->sampler() == this)
+	return;
+      std::map<gc_object*, sampled>::iterator i = sampled_.find(obj);
+      if (i == sampled_.end())
+	return;
+      _release(i->second);
+      sampled_.erase(i);
+    }
+    virtual void moved(gc*, gc_object* from, gc_object* to) {
+      std::map<gc_object*, sampled>::iterator i = sampled_.find(from);
+      if (i == sampled_.end())
+	return;
+      sampled_[to] = i->second;
+      sampled_.erase(i);
+    }
+    // emits folded stacks (as consumed by flamegraph.pl and friends)
+    void write_folded(FILE* fp, int what = ALLOCATED) const {
+      for (std::map<callstack, site>::const_iterator i = sites_.begin();
+	   i != sites_.end();
+	   ++i) {
+	double v = what == LIVE ? i->second.live_bytes
+	  : what == SURVIVED ? i->second.survived_bytes : i->second.bytes;
+	if (v < 0.5)
+	  continue;
+	const char* delim = "";
+	for (size_t j = i->first.size(); j != 0; --j) {
+	  std::string name = symbolize(i->first[j - 1]);
+	  if (name.compare(0, 8, "picogc::") == 0)
+	    break; // frames below are internal to picogc
+	  fprintf(fp, "%s%s", delim, name.c_str());
+	  delim = ";";
+	}
+	fprintf(fp, " %.0f\n", v);
+      }
+      fflush(fp);
+    }
+    static std::string symbolize(void* addr) {
+      Dl_info info;
+      if (dladdr(addr, &info) != 0 && info.dli_sname != NULL) {
+	int status;
+	char* demangled =
+	  abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+	if (demangled != NULL) {
+	  std::string name(demangled);
+	  free(demangled);
+	  return name;
+	}
+	return info.dli_sname;
+      }
+      char buf[32];
+      sprintf(buf, "%p", addr);
+      return buf;
+    }
+  };
+
+}
+
+#endif
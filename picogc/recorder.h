@@ -0,0 +1,282 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_recorder_h
+#define picogc_recorder_h
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+extern "C" {
+#include <stdint.h>
+}
+
+// please include picogc.h by yourself
+
+namespace picogc {
+
+  // the trace starts with the magic, followed by the events, each being a
+  // tag byte followed by the arguments encoded as LEB128:
+  //   ALLOC size flags address  (address relative to the previous ALLOC)
+  //   FREE address              (relative to the previous FREE)
+  //   SCOPE_OPEN, SCOPE_CLOSE
+  //   GC nanoseconds collected not_collected heap_bytes live_bytes
+  //   MOVE from to              (relative to the previous FREE and ALLOC)
+  // the addresses are zigzag-encoded differences in units of 8 bytes
+  static const char _recording_magic[] = "picogcr1";
+
+  enum {
+    RECORD_ALLOC = 1,
+    RECORD_FREE,
+    RECORD_SCOPE_OPEN,
+    RECORD_SCOPE_CLOSE,
+    RECORD_GC,
+    RECORD_MOVE
+  };
+
+  // writes the events of the heap it is set to (by gc::recorder) to fp;
+  // flush (or destroy) it before closing fp
+  class trace_recorder : public gc_recorder {
+    enum { _BUF_SIZE = 65536, _MAX_EVENT_SIZE = 64 };
+    FILE* fp_;
+    unsigned char buf_[_BUF_SIZE];
+    size_t len_;
+    uintptr_t last_alloc_;
+    uintptr_t last_free_;
+    double gc_start_;
+    trace_recorder(const trace_recorder&); // = delete;
+    trace_recorder& operator=(const trace_recorder&); // = delete;
+  public:
+    trace_recorder(FILE* fp)
+      : fp_(fp), len_(0), last_alloc_(0), last_free_(0), gc_start_(0) {
+      fwrite(_recording_magic, 1, 8, fp_);
+    }
+    ~trace_recorder() {
+      flush();
+    }
+    void flush() {
+      fwrite(buf_, 1, len_, fp_);
+      len_ = 0;
+      fflush(fp_);
+    }
+    virtual void allocated(gc*, gc_object* obj, size_t sz, int flags) {
+      buf_[len_++] = RECORD_ALLOC;
+      _put(sz);
+      _put(flags);
+      _put_address(last_alloc_, obj);
+      _event_end();
+    }
+    virtual void freed(gc*, gc_object* obj) {
+      buf_[len_++] = RECORD_FREE;
+      _put_address(last_free_, obj);
+      _event_end();
+    }
+    virtual void moved(gc*, gc_object* from, gc_object* to) {
+      buf_[len_++] = RECORD_MOVE;
+      _put_address(last_free_, from);
+      _put_address(last_alloc_, to);
+      _event_end();
+    }
+    virtual void scope_opened(gc*) {
+      buf_[len_++] = RECORD_SCOPE_OPEN;
+      _event_end();
+    }
+    virtual void scope_closed(gc*) {
+      buf_[len_++] = RECORD_SCOPE_CLOSE;
+      _event_end();
+    }
+    virtual void collection_started(gc*) {
+      gc_start_ = gc::now();
+    }
+    virtual void collection_ended(gc* gc, const gc_stats& stats) {
+      gc_metrics m = gc->metrics();
+      buf_[len_++] = RECORD_GC;
+      _put((uint64_t)((gc::now() - gc_start_) * 1e9));
+      _put(stats.collected);
+      _put(stats.not_collected);
+      _put(m.heap_bytes);
+      _put(m.live_bytes);
+      _event_end();
+    }
+  protected:
+    void _put(uint64_t v) {
+      for (; v >= 0x80; v >>= 7)
+	buf_[len_++] = (unsigned char)(v | 0x80);
+      buf_[len_++] = (unsigned char)v;
+    }
+    void _put_address(uintptr_t& last, gc_object* obj) {
+      intptr_t d = (intptr_t)(reinterpret_cast<uintptr_t>(obj) - last) / 8;
+      last = reinterpret_cast<uintptr_t>(obj);
+      _put(((uint64_t)d << 1) ^ (uint64_t)(d >> (sizeof(d) * 8 - 1)));
+    }
+    void _event_end() {
+      if (len_ > _BUF_SIZE - _MAX_EVENT_SIZE)
+	flush();
+    }
+  };
+
+  struct recorded_event {
+    int type; // RECORD_*
+    size_t object; // ALLOC, FREE: numbered in the order of allocation
+    size_t size; // ALLOC
+    int flags; // ALLOC
+    // GC
+    double duration;
+    size_t collected;
+    size_t not_collected;
+    size_t heap_bytes;
+    size_t live_bytes;
+  };
+
+  // reads a trace written by trace_recorder, event by event; the objects
+  // are identified by numbers instead of the addresses (which is kept
+  // across the relocation by the compaction, not reported as an event)
+  class recording_reader {
+    FILE* fp_;
+    uintptr_t last_alloc_;
+    uintptr_t last_free_;
+    size_t num_objects_;
+    std::map<uintptr_t, size_t> live_; // address -> number
+    bool has_pending_;
+    recorded_event pending_;
+  public:
+    recording_reader(FILE* fp)
+      : fp_(fp), last_alloc_(0), last_free_(0), num_objects_(0), live_(),
+	has_pending_(false), pending_() {}
+    // checks the magic
+    bool start() {
+      char magic[8];
+      return fread(magic, 1, 8, fp_) == 8
+	&& memcmp(magic, _recording_magic, 8) == 0;
+    }
+    size_t num_objects() const { return num_objects_; }
+    // returns false at the end of the trace (or if it is broken)
+    bool next(recorded_event& e) {
+      if (has_pending_) {
+	e = pending_;
+	has_pending_ = false;
+	return true;
+      }
+      for (;;) {
+	int tag = fgetc(fp_);
+	uint64_t v[5];
+	switch (tag) {
+	case RECORD_ALLOC: {
+	  uintptr_t addr;
+	  if (! (_get(v[0]) && _get(v[1]) && _get_address(last_alloc_, addr)))
+	    return false;
+	  e = recorded_event();
+	  e.type = RECORD_ALLOC;
+	  e.object = num_objects_++;
+	  e.size = v[0];
+	  e.flags = (int)v[1];
+	  std::pair<std::map<uintptr_t, size_t>::iterator, bool> r =
+	    live_.insert(std::make_pair(addr, e.object));
+	  if (! r.second) {
+	    // the memory was reused without the object being reported as
+	    // freed (e.g. by gc::reset); report it first
+	    pending_ = e;
+	    has_pending_ = true;
+	    e.type = RECORD_FREE;
+	    e.object = r.first->second;
+	    r.first->second = pending_.object;
+	  }
+	  return true;
+	}
+	case RECORD_FREE: {
+	  uintptr_t addr;
+	  if (! _get_address(last_free_, addr))
+	    return false;
+	  std::map<uintptr_t, size_t>::iterator i = live_.find(addr);
+	  if (i == live_.end())
+	    continue; // allocated before being recorded
+	  e = recorded_event();
+	  e.type = RECORD_FREE;
+	  e.object = i->second;
+	  live_.erase(i);
+	  return true;
+	}
+	case RECORD_MOVE: {
+	  uintptr_t from, to;
+	  if (! (_get_address(last_free_, from) && _get_address(last_alloc_, to)))
+	    return false;
+	  std::map<uintptr_t, size_t>::iterator i = live_.find(from);
+	  if (i != live_.end()) {
+	    live_[to] = i->second;
+	    live_.erase(i);
+	  }
+	  continue;
+	}
+	case RECORD_SCOPE_OPEN:
+	case RECORD_SCOPE_CLOSE:
+	  e = recorded_event();
+	  e.type = tag;
+	  return true;
+	case RECORD_GC:
+	  for (size_t i = 0; i != 5; ++i)
+	    if (! _get(v[i]))
+	      return false;
+	  e = recorded_event();
+	  e.type = RECORD_GC;
+	  e.duration = v[0] / 1e9;
+	  e.collected = v[1];
+	  e.not_collected = v[2];
+	  e.heap_bytes = v[3];
+	  e.live_bytes = v[4];
+	  return true;
+	default:
+	  return false;
+	}
+      }
+    }
+  protected:
+    bool _get(uint64_t& v) {
+      v = 0;
+      for (int shift = 0; shift < 64; shift += 7) {
+	int ch = fgetc(fp_);
+	if (ch == EOF)
+	  return false;
+	v |= (uint64_t)(ch & 0x7f) << shift;
+	if ((ch & 0x80) == 0)
+	  return true;
+      }
+      return false;
+    }
+    bool _get_address(uintptr_t& last, uintptr_t& addr) {
+      uint64_t z;
+      if (! _get(z))
+	return false;
+      int64_t d = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+      addr = last = last + d * 8;
+      return true;
+    }
+  };
+
+}
+
+#endif
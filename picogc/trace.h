@@ -0,0 +1,202 @@
+/* 
+ * Copyright 2012 Kazuho Oku
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ * 
+ * The views and conclusions contained in the software and documentation are
+ * those of the authors and should not be interpreted as representing official
+ * policies, either expressed or implied, of the author.
+ * 
+ */
+#ifndef picogc_trace_h
+#define picogc_trace_h
+
+#include <cstdio>
+#include <vector>
+extern "C" {
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+}
+
+// please include picogc.h by yourself
+
+namespace picogc {
+
+  // records the phases of the collections into a ring buffer allocated
+  // upfront; flush() writes them out as Chrome trace events (to be opened
+  // by chrome://tracing or Perfetto), and may be called from another thread
+  class trace_emitter : public gc_emitter {
+  public:
+    enum {
+      GC,
+      SETUP_NEW,
+      SETUP_LOCAL,
+      MARK,
+      SWEEP,
+      CONCURRENT_MARK,
+      REMARK,
+      COMPACT,
+      // number of events recorded per collection (at most)
+      EVENTS_PER_GC = 14
+    };
+    struct event {
+      uint64_t ts; // CLOCK_MONOTONIC, in nanoseconds
+      int phase;
+      bool begin;
+      long tid;
+      gc_stats stats; // set for the end of GC
+      gc_compaction compaction; // set for the end of COMPACT
+    };
+  protected:
+    std::vector<event> events_;
+    size_t mask_;
+    size_t head_; // updated by the collector
+    size_t tail_; // updated by flush
+    size_t num_dropped_; // collections not recorded due to lack of space
+    bool dropping_;
+    bool started_;
+    long pid_;
+    trace_emitter(const trace_emitter&); // = delete;
+    trace_emitter& operator=(const trace_emitter&); // = delete;
+  public:
+    // capacity (in events) is rounded up to a power of 2
+    trace_emitter(size_t capacity = 4096)
+      : events_(), mask_(0), head_(0), tail_(0), num_dropped_(0),
+	dropping_(false), started_(false), pid_(getpid()) {
+      size_t n = 16;
+      while (n < capacity)
+	n *= 2;
+      events_.resize(n);
+      mask_ = n - 1;
+    }
+    size_t num_dropped() const {
+      return __atomic_load_n(&num_dropped_, __ATOMIC_RELAXED);
+    }
+    virtual void gc_start(gc*) {
+      // a collection is either recorded as a whole, or not at all
+      size_t used = head_ - __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+      dropping_ = events_.size() - used < EVENTS_PER_GC;
+      if (dropping_) {
+	__atomic_store_n(&num_dropped_, num_dropped_ + 1, __ATOMIC_RELAXED);
+	return;
+      }
+      _record(GC, true);
+    }
+    virtual void gc_end(gc*, const gc_stats& stats) {
+      _record(GC, false, &stats);
+    }
+    virtual void setup_new_start(gc*) { _record(SETUP_NEW, true); }
+    virtual void setup_new_end(gc*) { _record(SETUP_NEW, false); }
+    virtual void setup_local_start(gc*) { _record(SETUP_LOCAL, true); }
+    virtual void setup_local_end(gc*) { _record(SETUP_LOCAL, false); }
+    virtual void mark_start(gc*) { _record(MARK, true); }
+    virtual void mark_end(gc*) { _record(MARK, false); }
+    // recorded with the thread id of the marker thread
+    virtual void concurrent_mark_start(gc*) { _record(CONCURRENT_MARK, true); }
+    virtual void concurrent_mark_end(gc*) { _record(CONCURRENT_MARK, false); }
+    virtual void remark_start(gc*) { _record(REMARK, true); }
+    virtual void remark_end(gc*) { _record(REMARK, false); }
+    virtual void sweep_start(gc*) { _record(SWEEP, true); }
+    virtual void sweep_end(gc*) { _record(SWEEP, false); }
+    virtual void compact_start(gc*) { _record(COMPACT, true); }
+    virtual void compact_end(gc*, const gc_compaction& result) {
+      _record(COMPACT, false, NULL, &result);
+    }
+    // writes the recorded events, in the JSON array format
+    void flush(FILE* fp) {
+      size_t head = __atomic_load_n(&head_, __ATOMIC_ACQUIRE), tail = tail_;
+      for (; tail != head; ++tail) {
+	const event& e = events_[tail & mask_];
+	static const char* names[] = {
+	  "gc", "setup_new", "setup_local", "mark", "sweep", "concurrent_mark",
+	  "remark", "compact"
+	};
+	fprintf(fp,
+		"%s{\"name\":\"%s\",\"cat\":\"picogc\",\"ph\":\"%s\","
+		"\"ts\":%llu.%03u,\"pid\":%ld,\"tid\":%ld",
+		started_ ? ",\n" : "[\n", names[e.phase], e.begin ? "B" : "E",
+		(unsigned long long)(e.ts / 1000), (unsigned)(e.ts % 1000),
+		pid_, e.tid);
+	if (e.phase == GC && ! e.begin) {
+	  fprintf(fp,
+		  ",\"args\":{\"on_stack\":%zu,\"slowly_marked\":%zu,"
+		  "\"not_collected\":%zu,\"collected\":%zu,"
+		  "\"mark_stack_overflows\":%zu,"
+		  "\"by_memory_pressure\":%zu,\"remarked\":%zu,"
+		  "\"by_heap_limit\":%zu}",
+		  e.stats.on_stack, e.stats.slowly_marked,
+		  e.stats.not_collected, e.stats.collected,
+		  e.stats.mark_stack_overflows, e.stats.by_memory_pressure,
+		  e.stats.remarked, e.stats.by_heap_limit);
+	} else if (e.phase == COMPACT && ! e.begin) {
+	  fprintf(fp,
+		  ",\"args\":{\"objects_moved\":%zu,\"bytes_moved\":%zu,"
+		  "\"chunks_released\":%zu,\"fragmentation_before\":%.3f,"
+		  "\"fragmentation_after\":%.3f}",
+		  e.compaction.objects_moved, e.compaction.bytes_moved,
+		  e.compaction.chunks_released,
+		  e.compaction.fragmentation_before,
+		  e.compaction.fragmentation_after);
+	}
+	fputs("}", fp);
+	started_ = true;
+      }
+      __atomic_store_n(&tail_, tail, __ATOMIC_RELEASE);
+      fflush(fp);
+    }
+    // flushes, and closes the array
+    void finish(FILE* fp) {
+      flush(fp);
+      fputs(started_ ? "\n]\n" : "[]\n", fp);
+      fflush(fp);
+    }
+  protected:
+    void _record(int phase, bool begin, const gc_stats* stats = NULL,
+		 const gc_compaction* compaction = NULL) {
+      if (dropping_)
+	return;
+      event e;
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      e.ts = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+      e.phase = phase;
+      e.begin = begin;
+#ifdef __linux__
+      e.tid = syscall(SYS_gettid);
+#else
+      e.tid = 0;
+#endif
+      if (stats != NULL)
+	e.stats = *stats;
+      if (compaction != NULL)
+	e.compaction = *compaction;
+      events_[head_ & mask_] = e;
+      __atomic_store_n(&head_, head_ + 1, __ATOMIC_RELEASE);
+    }
+  };
+
+}
+
+#endif
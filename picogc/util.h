@@ -30,6 +30,7 @@
 #define picogc_util_h
 
 #include <cstdio>
+#include <vector>
 extern "C" {
 #include <sys/resource.h>
 }
@@ -38,6 +39,7 @@ extern "C" {
 
 namespace picogc {
 
+  // logs the statistics of each collection to fp (if not NULL)
   class gc_log_emitter : public gc_emitter {
     FILE* fp_;
     double mark_time_;
@@ -46,6 +48,8 @@ namespace picogc {
       double mark_time;
       double sweep_time;
       gc_stats stats;
+      size_t compactions;
+      size_t bytes_moved;
     } accumulated_;
     static double now() {
       rusage ru;
@@ -56,9 +60,18 @@ namespace picogc {
     gc_log_emitter(FILE* fp) : fp_(fp) {
       accumulated_.mark_time = 0;
       accumulated_.sweep_time = 0;
-      memset(&accumulated_.stats, 0, sizeof(accumulated_.stats));
+      accumulated_.stats = gc_stats();
+      accumulated_.compactions = 0;
+      accumulated_.bytes_moved = 0;
     }
+    double mark_time() const { return accumulated_.mark_time; }
+    double sweep_time() const { return accumulated_.sweep_time; }
+    const gc_stats& stats() const { return accumulated_.stats; }
+    size_t compactions() const { return accumulated_.compactions; }
+    size_t bytes_moved() const { return accumulated_.bytes_moved; }
     virtual void gc_start(gc*) {
+      if (fp_ == NULL)
+	return;
       fprintf(fp_, "--- picogc - garbage collection ---\n");
       fflush(fp_);
     }
@@ -69,6 +82,12 @@ namespace picogc {
       accumulated_.stats.slowly_marked += stats.slowly_marked;
       accumulated_.stats.not_collected += stats.not_collected;
       accumulated_.stats.collected += stats.collected;
+      accumulated_.stats.mark_stack_overflows += stats.mark_stack_overflows;
+      accumulated_.stats.by_memory_pressure += stats.by_memory_pressure;
+      accumulated_.stats.remarked += stats.remarked;
+      accumulated_.stats.by_heap_limit += stats.by_heap_limit;
+      if (fp_ == NULL)
+	return;
       fprintf(fp_,
 	      "mark_time:     %f (%f)\n"
 	      "sweep_time:    %f (%f)\n"
@@ -76,13 +95,22 @@ namespace picogc {
 	      "slowly_marked: %zd (%zd)\n"
 	      "not_collected: %zd (%zd)\n"
 	      "collected:     %zd (%zd)\n"
+	      "overflows:     %zd (%zd)\n"
+	      "by_pressure:   %zd (%zd)\n"
+	      "remarked:      %zd (%zd)\n"
+	      "by_heap_limit: %zd (%zd)\n"
 	      "-----------------------------------\n",
 	      mark_time_, accumulated_.mark_time,
 	      sweep_time_, accumulated_.sweep_time,
 	      stats.on_stack, accumulated_.stats.on_stack,
 	      stats.slowly_marked, accumulated_.stats.slowly_marked,
 	      stats.not_collected, accumulated_.stats.not_collected,
-	      stats.collected, accumulated_.stats.collected);
+	      stats.collected, accumulated_.stats.collected,
+	      stats.mark_stack_overflows,
+	      accumulated_.stats.mark_stack_overflows,
+	      stats.by_memory_pressure, accumulated_.stats.by_memory_pressure,
+	      stats.remarked, accumulated_.stats.remarked,
+	      stats.by_heap_limit, accumulated_.stats.by_heap_limit);
       fflush(fp_);
     }
     virtual void mark_start(gc*) {
@@ -91,12 +119,112 @@ namespace picogc {
     virtual void mark_end(gc*) {
       mark_time_ = now() - mark_time_;
     }
+    // the pause of concurrent marking is accounted as the mark time
+    virtual void remark_start(gc*) {
+      mark_time_ = now();
+    }
+    virtual void remark_end(gc*) {
+      mark_time_ = now() - mark_time_;
+    }
     virtual void sweep_start(gc*) {
       sweep_time_ = now();
     }
     virtual void sweep_end(gc*) {
       sweep_time_ = now() - sweep_time_;
     }
+    virtual void compact_end(gc*, const gc_compaction& result) {
+      accumulated_.compactions++;
+      accumulated_.bytes_moved += result.bytes_moved;
+      if (fp_ == NULL)
+	return;
+      fprintf(fp_,
+	      "compaction:    %zd objects, %zd bytes moved (%zd), "
+	      "fragmentation %.3f -> %.3f\n",
+	      result.objects_moved, result.bytes_moved,
+	      accumulated_.bytes_moved, result.fragmentation_before,
+	      result.fragmentation_after);
+      fflush(fp_);
+    }
+  };
+
+  // writes gc::metrics() in the Prometheus text exposition format
+  inline void write_prometheus_metrics(FILE* fp, const gc_metrics& m,
+				       const char* prefix = "picogc_")
+  {
+    struct {
+      const char* name;
+      const char* type;
+      const char* help;
+      double value;
+    } metrics[] = {
+      { "bytes_requested_total", "counter",
+	"Bytes requested by the allocations.", (double)m.bytes_requested },
+      { "bytes_allocated_total", "counter",
+	"Bytes allocated for the objects.", (double)m.bytes_allocated },
+      { "bytes_freed_total", "counter",
+	"Bytes of the objects freed.", (double)m.bytes_freed },
+      { "object_bytes", "gauge",
+	"Bytes of the objects not yet freed.", (double)m.object_bytes },
+      { "live_bytes", "gauge",
+	"Bytes of the objects found alive by the last collection.",
+	(double)m.live_bytes },
+      { "heap_bytes", "gauge",
+	"Bytes obtained from the allocator.", (double)m.heap_bytes },
+      { "peak_heap_bytes", "gauge",
+	"Maximum of heap_bytes.", (double)m.peak_heap_bytes },
+      { "overhead_bytes", "gauge",
+	"Bytes of the heap not used by the objects.",
+	(double)m.overhead_bytes },
+      { "collections_total", "counter",
+	"Number of garbage collections.", (double)m.num_gc },
+      { "pressure_collections_total", "counter",
+	"Number of garbage collections triggered by memory pressure.",
+	(double)m.num_pressure_gc },
+      { "pause_seconds_total", "counter",
+	"Time spent in garbage collection.", m.pause_time },
+      { "limit_collections_total", "counter",
+	"Number of garbage collections triggered by the heap limit.",
+	(double)m.num_limit_gc },
+      { "allocation_failures_total", "counter",
+	"Number of allocations refused by the heap limit.",
+	(double)m.num_allocation_failures },
+    };
+    for (size_t i = 0; i != sizeof(metrics) / sizeof(metrics[0]); ++i) {
+      fprintf(fp, "# HELP %s%s %s\n# TYPE %s%s %s\n%s%s %.17g\n",
+	      prefix, metrics[i].name, metrics[i].help,
+	      prefix, metrics[i].name, metrics[i].type,
+	      prefix, metrics[i].name, metrics[i].value);
+    }
+    fflush(fp);
+  }
+
+  // pool of ready-to-use gc instances (e.g. for per-request heaps)
+  class gc_pool {
+    config conf_;
+    std::vector<gc*> gcs_;
+    gc_pool(const gc_pool&); // = delete;
+    gc_pool& operator=(const gc_pool&); // = delete;
+  public:
+    gc_pool(const config& conf = config(), size_t num_prealloc = 0)
+      : conf_(conf) {
+      for (size_t i = 0; i < num_prealloc; ++i)
+	gcs_.push_back(new gc(conf_));
+    }
+    ~gc_pool() {
+      for (std::vector<gc*>::iterator i = gcs_.begin(); i != gcs_.end(); ++i)
+	delete *i;
+    }
+    gc* acquire() {
+      if (gcs_.empty())
+	return new gc(conf_);
+      gc* g = gcs_.back();
+      gcs_.pop_back();
+      return g;
+    }
+    void release(gc* g) {
+      g->reset();
+      gcs_.push_back(g);
+    }
   };
 
 }
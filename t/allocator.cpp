@@ -0,0 +1,156 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/allocator.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  K* linked_;
+  int value_;
+  ~K() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+// forwards to another allocator, counting the calls and the bytes in use
+struct counting_allocator : public picogc::gc_allocator {
+  picogc::gc_allocator* base_;
+  size_t num_allocated_, num_freed_, num_bulk_freed_, bytes_in_use_;
+  counting_allocator(picogc::gc_allocator* base)
+    : base_(base), num_allocated_(0), num_freed_(0), num_bulk_freed_(0),
+      bytes_in_use_(0) {}
+  virtual void* allocate(size_t sz) {
+    void* p = base_->allocate(sz);
+    num_allocated_++;
+    bytes_in_use_ += base_->usable_size(p);
+    return p;
+  }
+  virtual void free(void* p, size_t sz) {
+    num_freed_++;
+    bytes_in_use_ -= sz;
+    base_->free(p, sz);
+  }
+  virtual void free_bulk(void* const* blocks, size_t n) {
+    for (size_t i = 0; i != n; ++i)
+      bytes_in_use_ -= base_->usable_size(blocks[i]);
+    num_bulk_freed_ += n;
+    base_->free_bulk(blocks, n);
+  }
+  virtual size_t usable_size(void* p) {
+    return base_->usable_size(p);
+  }
+};
+
+static void run(const char* name, picogc::gc_allocator* base,
+		picogc::config conf)
+{
+  counting_allocator a(base);
+  num_destroyed = 0;
+  {
+    picogc::gc gc(conf.allocator(&a));
+    picogc::gc_scope gc_scope(&gc);
+    {
+      picogc::scope scope;
+      picogc::local<K> head;
+      {
+	picogc::scope scope;
+	for (int i = 0; i < 1000; ++i) {
+	  K* k = new K;
+	  k->value_ = i;
+	  if (i % 2 == 0) {
+	    k->linked_ = head;
+	    head = k;
+	  }
+	}
+	new (picogc::trailing<char>(100000)) K; // large
+      }
+      gc.trigger_gc();
+      is(num_destroyed, (size_t)501, name);
+      ok(a.num_allocated_ != 0, "  memory obtained from the allocator");
+      ok(a.bytes_in_use_ >= gc.metrics().object_bytes, "  bytes in use");
+    }
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1001, "  collected");
+    if (conf.arena_chunk_size() == 0) {
+      ok(a.num_bulk_freed_ >= 1001, "  freed in bulk");
+    } else {
+      is(a.num_bulk_freed_, (size_t)0, "  the arena frees chunks");
+    }
+  }
+  is(a.bytes_in_use_, (size_t)0, "  all freed with the heap");
+}
+
+struct default_allocator : public picogc::gc_allocator {
+  virtual void* allocate(size_t sz) { return ::operator new(sz); }
+  virtual void free(void* p, size_t) { ::operator delete(p); }
+  virtual size_t usable_size(void* p) { return malloc_usable_size(p); }
+};
+
+void test()
+{
+  plan(6 * 5 + 5 + 4);
+
+  default_allocator def;
+  picogc::pool_allocator pool(64 * 1024);
+  picogc::freelist_allocator freelist;
+  run("default", &def, picogc::config());
+  run("pool", &pool, picogc::config());
+  run("freelist", &freelist, picogc::config());
+  run("arena on freelist", &freelist,
+      picogc::config().arena_chunk_size(64 * 1024));
+  run("atomic chunks on pool", &pool, picogc::config().atomic_chunks(true));
+
+  { // usable sizes
+    void* p = pool.allocate(100);
+    is(pool.usable_size(p), (size_t)104, "pool: usable size");
+    pool.free(p, 100);
+    p = pool.allocate(104);
+    is(pool.usable_size(p), (size_t)104, "pool: usable size (exact)");
+    pool.free(p, 104);
+    p = freelist.allocate(0);
+    ok(p != NULL, "freelist: zero bytes");
+    is(freelist.usable_size(p), (size_t)16, "freelist: smallest class");
+    freelist.free(p, 0);
+  }
+
+  { // the objects stay intact while blocks are recycled
+    picogc::gc gc(picogc::config().allocator(&pool).gc_interval_bytes(4096));
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    picogc::local<K> head;
+    for (int i = 0; i < 10000; ++i) {
+      picogc::scope scope;
+      K* k = new (picogc::MAY_TRIGGER_GC) K;
+      k->value_ = i;
+      if (i % 100 == 0) {
+	k->linked_ = head;
+	head = k;
+      }
+    }
+    int expected = 9900, n = 0;
+    bool intact = true;
+    for (K* k = head; k != NULL; k = k->linked_, expected -= 100, ++n)
+      intact = intact && k->value_ == expected;
+    is(n, 100, "recycled: all survivors found");
+    ok(intact, "recycled: survivors intact");
+    ok(gc.metrics().num_gc > 10, "recycled: collected repeatedly");
+  }
+
+  { // transfer requires the same allocator
+    picogc::gc gc(picogc::config().allocator(&freelist)), other, same(
+      picogc::config().allocator(&freelist));
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    K* k = new K;
+    ok(! gc.transfer(k, other), "transfer to another allocator refused");
+    ok(gc.transfer(k, same), "transfer to the same allocator");
+  }
+}
@@ -0,0 +1,119 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+template <size_t N> struct Leaf : public picogc::gc_object {
+  char buf_[N];
+  ~Leaf() {
+    ++num_destroyed;
+  }
+};
+
+// the destructor does nothing
+template <size_t N> struct Plain : public picogc::gc_object {
+  typedef Plain gc_trivially_destructible;
+  char buf_[N];
+};
+
+struct Holder : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::gc_object* leaf_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(leaf_);
+  }
+};
+
+void test()
+{
+  plan(11);
+
+  picogc::gc gc(picogc::config().atomic_chunks(true));
+  picogc::gc_scope gc_scope(&gc);
+
+  {
+    picogc::scope scope;
+    picogc::local<Holder> holder = new Holder;
+    for (int i = 0; i < 10000; ++i) {
+      new (picogc::IS_ATOMIC) Leaf<8>;
+      new (picogc::IS_ATOMIC) Leaf<100>;
+    }
+    holder->leaf_ = new (picogc::IS_ATOMIC | picogc::IMMEDIATELY_TRACEABLE)
+      Leaf<8>;
+    new (picogc::IS_ATOMIC | picogc::IMMEDIATELY_TRACEABLE) Leaf<8>;
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1, "objects in scope survive");
+    ok(holder->leaf_->gc_is_marked() == false, "mark is cleared");
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1, "referred object survives");
+    holder->leaf_ = NULL;
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)20002, "all collected");
+
+  // slots are reused
+  num_destroyed = 0;
+  void* first;
+  {
+    picogc::scope scope;
+    first = new (picogc::IS_ATOMIC) Leaf<8>;
+  }
+  gc.trigger_gc();
+  {
+    picogc::scope scope;
+    ok(new (picogc::IS_ATOMIC) Leaf<8> == first, "slot is reused");
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)2);
+
+  // incremental sweep while allocating
+  num_destroyed = 0;
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 1000000; ++i)
+      new (picogc::IS_ATOMIC) Leaf<8>;
+  }
+  gc.collect_for(picogc::gc::now() + 0.001);
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 1000; ++i)
+      new (picogc::IS_ATOMIC) Leaf<8>;
+    while (! gc.collect_for(picogc::gc::now() + 0.001))
+      ;
+    is(num_destroyed, (size_t)1000000, "garbage collected");
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)1001000, "objects allocated while sweeping");
+
+  // trivially destructible ones, and reset
+  num_destroyed = 0;
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 100; ++i) {
+      new (picogc::IS_ATOMIC) Leaf<8>;
+      new (picogc::IS_ATOMIC | picogc::TRIVIALLY_DESTRUCTIBLE) Plain<8>;
+    }
+    gc.trigger_gc();
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)100, "dtor not called for trivial objects");
+  num_destroyed = 0;
+  {
+    picogc::gc_scope gc_scope2(NULL);
+  }
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 100; ++i)
+      new (picogc::IS_ATOMIC) Leaf<8>;
+  }
+  gc.reset();
+  is(num_destroyed, (size_t)100, "destroyed by reset");
+  {
+    picogc::scope scope;
+    ok(new (picogc::IS_ATOMIC) Leaf<8> != NULL, "usable after reset");
+  }
+}
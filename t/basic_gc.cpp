@@ -0,0 +1,94 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  K* linked_;
+  ~K() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+struct counting_emitter : public picogc::gc_emitter {
+  size_t num_gc_;
+  counting_emitter() : num_gc_(0) {}
+  virtual void gc_start(picogc::gc*) {
+    ++num_gc_;
+  }
+};
+
+void test()
+{
+  plan(15);
+
+  {
+    typedef picogc::basic_gc<counting_emitter, picogc::fixed_interval<1024>,
+			     picogc::fixed_allocator<4096>,
+			     picogc::fixed_tracer<4, true> > my_gc;
+    my_gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    is(gc.conf().gc_interval_bytes(), (size_t)1024, "config follows pacing");
+    is(gc.conf().arena_chunk_size(), (size_t)4096,
+       "config follows allocator");
+    is(gc.conf().mark_stack_size(), (size_t)4, "config follows tracer");
+    ok(gc.conf().batched_sweep(), "config follows tracer (sweep)");
+    num_destroyed = 0;
+    {
+      picogc::scope scope;
+      picogc::local<K> k = new (gc) K;
+      for (int i = 0; i < 100; ++i) {
+	K* l = new (gc) K;
+	l->linked_ = k;
+	k = l;
+      }
+      for (int i = 0; i < 100; ++i)
+	new (gc, picogc::MAY_TRIGGER_GC) K;
+      ok(gc.emitter_policy().num_gc_ != 0, "collected by the interval");
+      is(num_destroyed, (size_t)0, "nothing collected while in scope");
+    }
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)201, "all collected");
+
+    // the policy is called statically, without being registered
+    ok(gc.emitter() != &gc.emitter_policy(), "emitter policy not registered");
+    size_t num_gc = gc.emitter_policy().num_gc_;
+    gc.trigger_gc();
+    is(gc.emitter_policy().num_gc_, num_gc + 1, "called by trigger_gc");
+    static_cast<picogc::gc&>(gc).trigger_gc();
+    is(gc.emitter_policy().num_gc_, num_gc + 2, "  called through gc");
+    counting_emitter other;
+    gc.emitter(&other);
+    gc.trigger_gc();
+    ok(gc.emitter_policy().num_gc_ == num_gc + 3 && other.num_gc_ == 0,
+       "  not replaced by gc::emitter");
+    gc.collect_for(HUGE_VAL);
+    ok(gc.emitter_policy().num_gc_ == num_gc + 3 && other.num_gc_ == 1,
+       "collect_for calls the emitter registered");
+  }
+
+  { // new (gc) T also works with picogc::gc
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    num_destroyed = 0;
+    {
+      picogc::scope scope;
+      picogc::local<K> k = new (gc) K;
+      k->linked_ = new (gc, picogc::IS_ATOMIC) K;
+      new (gc) K;
+      gc.trigger_gc();
+      is(num_destroyed, (size_t)0, "objects in scope are retained");
+    }
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)3, "collected after scope");
+    ok(gc.emitter() != NULL, "default emitter");
+  }
+}
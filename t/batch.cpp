@@ -0,0 +1,120 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include <string>
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+static size_t num_constructed = 0, num_destroyed = 0, throw_at = SIZE_MAX;
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  K* linked_;
+  int value_;
+  K() : value_(123) {
+    if (num_constructed == throw_at)
+      throw 1;
+    ++num_constructed;
+  }
+  ~K() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+// a variable-length object
+struct Str : public picogc::gc_object {
+  size_t len_;
+  Str(const char* s) : len_(strlen(s)) {
+    memcpy(chars(), s, len_ + 1);
+  }
+  char* chars() { return picogc::trailing_elements<char>(this); }
+};
+
+static void run(const char* name, const picogc::config& conf)
+{
+  picogc::gc gc(conf);
+  picogc::gc_scope gc_scope(&gc);
+  num_constructed = num_destroyed = 0;
+  {
+    picogc::scope scope;
+    K* objs[100];
+    gc.allocate_batch(100, objs);
+    is(num_constructed, (size_t)100, name);
+    bool ok_ = true;
+    for (size_t i = 0; i != 100; ++i)
+      ok_ = ok_ && objs[i]->value_ == 123 && objs[i]->linked_ == NULL;
+    ok(ok_, "  constructed and zero-filled");
+    is(gc.metrics().bytes_requested, sizeof(K) * 100, "  accounted");
+    if (conf.arena_chunk_size() != 0)
+      ok((char*)objs[99] - (char*)objs[0] == 99 * ((char*)objs[1] - (char*)objs[0]),
+	 "  contiguous");
+    else
+      ok(true, "  (not contiguous)");
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)0, "  retained by the scope");
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)100, "  collected");
+
+  { // exception in ctor
+    picogc::scope scope;
+    num_constructed = num_destroyed = 0;
+    throw_at = 5;
+    K* objs[10];
+    bool thrown = false;
+    try {
+      gc.allocate_batch(10, objs);
+    } catch (...) {
+      thrown = true;
+    }
+    throw_at = SIZE_MAX;
+    ok(thrown, "  exception is propagated");
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)5, "  only the constructed ones are destroyed");
+}
+
+void test()
+{
+  plan(8 * 2 + 8);
+
+  run("batch", picogc::config());
+  run("batch in arena", picogc::config().arena_chunk_size(64 * 1024));
+
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  {
+    picogc::scope scope;
+    picogc::local<picogc::array<int> > ints = picogc::make_array<int>(10);
+    is(ints->size(), (size_t)10, "array size");
+    bool zero = true;
+    for (size_t i = 0; i != 10; ++i)
+      zero = zero && (*ints)[i] == 0;
+    ok(zero, "array of ints is zero-filled");
+
+    picogc::local<picogc::array<K*> > ks = picogc::make_array<K*>(3);
+    {
+      picogc::scope scope;
+      (*ks)[1] = new K;
+    }
+    num_destroyed = 0;
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)0, "elements are marked");
+    (*ks)[1] = NULL;
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1, "element collected once removed");
+
+    Str* s = new (picogc::trailing<char>(6)) Str("hello");
+    is(s->len_, (size_t)5, "variable-length object");
+    is(std::string(s->chars()), std::string("hello"), "trailing elements");
+    ok(reinterpret_cast<char*>(s) + sizeof(Str) == s->chars(),
+       "elements follow the object");
+    ok(gc.metrics().bytes_requested >= sizeof(Str) + 6,
+       "elements are allocated along with the object");
+  }
+}
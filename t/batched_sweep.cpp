@@ -0,0 +1,89 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+#define NUM_TYPES 80
+
+static size_t num_destroyed[NUM_TYPES];
+static size_t num_broken = 0;
+
+template <int N> struct T : public picogc::gc_object {
+  int n_;
+  T() : n_(N) {}
+  ~T() {
+    if (n_ != N)
+      ++num_broken;
+    ++num_destroyed[N];
+  }
+};
+
+// the destructor does nothing
+template <int N> struct P : public picogc::gc_object {
+  typedef P gc_trivially_destructible;
+  int n_;
+};
+
+template <int N> static void alloc_each(picogc::gc* gc)
+{
+  new T<N>;
+  new (picogc::TRIVIALLY_DESTRUCTIBLE) P<N>;
+  alloc_each<N - 1>(gc);
+}
+
+template <> void alloc_each<-1>(picogc::gc*)
+{
+}
+
+static size_t total_destroyed()
+{
+  size_t n = 0;
+  for (size_t i = 0; i != NUM_TYPES; ++i)
+    n += num_destroyed[i];
+  return n;
+}
+
+static void run(const char* name, picogc::config conf, bool incremental)
+{
+  memset(num_destroyed, 0, sizeof(num_destroyed));
+  num_broken = 0;
+  picogc::gc gc(conf.batched_sweep(true));
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  {
+    picogc::scope scope;
+    picogc::local<T<3> > alive = new T<3>;
+    {
+      picogc::scope scope;
+      for (int i = 0; i < 100; ++i)
+	alloc_each<NUM_TYPES - 1>(&gc);
+    }
+    if (incremental) {
+      while (! gc.collect_for(picogc::gc::now() + 0.00001))
+	;
+    } else {
+      gc.trigger_gc();
+    }
+    is(total_destroyed(), (size_t)(NUM_TYPES * 100), name);
+    is(num_destroyed[0], (size_t)100, "  objects of first type");
+    is(num_destroyed[NUM_TYPES - 1], (size_t)100, "  objects of last type");
+    is(num_broken, (size_t)0, "  objects were intact when destroyed");
+    is(log.stats().collected, (size_t)(NUM_TYPES * 200), "  all collected");
+    is(alive->n_, 3, "  the live object survives");
+  }
+  gc.trigger_gc();
+  is(num_destroyed[3], (size_t)101, "  the live object is collected later");
+}
+
+void test()
+{
+  plan(21);
+
+  run("batched sweep", picogc::config(), false);
+  run("incremental batched sweep", picogc::config(), true);
+  run("batched sweep with arena",
+      picogc::config().arena_chunk_size(64 * 1024), false);
+}
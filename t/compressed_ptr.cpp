@@ -0,0 +1,99 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/allocator.h"
+#include "t/test.h"
+
+static int num_live;
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::compressed_ptr<K> next_;
+  int value_;
+  K(int value) : value_(value) {
+    ++num_live;
+  }
+  ~K() {
+    --num_live;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+// a chain of n objects (the last one first)
+static K* build(int n)
+{
+  picogc::scope scope;
+  picogc::local<K> head;
+  for (int i = 0; i < n; ++i) {
+    picogc::scope scope;
+    K* k = new (picogc::MAY_TRIGGER_GC) K(i);
+    k->next_ = head;
+    head = k;
+  }
+  return scope.close(head.get());
+}
+
+static bool check(K* k, int n)
+{
+  for (int i = n - 1; i >= 0; --i, k = k->next_)
+    if (k == NULL || k->value_ != i)
+      return false;
+  return k == NULL;
+}
+
+static void test_cage(const char* name, picogc::config conf)
+{
+  num_live = 0;
+  {
+    picogc::gc gc(conf.gc_interval_bytes(64 * 1024));
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    picogc::local<K> head = build(20000);
+    ok(gc.metrics().num_gc != 0, name);
+    ok(check(head, 20000), "  chain intact");
+    gc.trigger_gc();
+    is(num_live, 20000, "  reachable through compressed_ptr");
+    head->next_->next_ = NULL;
+    gc.trigger_gc();
+    is(num_live, 2, "  unreachable ones collected");
+    ok(head->next_->next_ == NULL, "  assigned null");
+    head = NULL;
+  }
+  is(num_live, 0, "  all destroyed");
+}
+
+void test()
+{
+  plan(6 * 3 + 6);
+
+  picogc::cage_allocator cage(256 * 1024 * 1024, 64 * 1024);
+
+  { // representation
+    picogc::gc gc(picogc::config().allocator(&cage));
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    is(sizeof(picogc::compressed_ptr<K>), (size_t)4, "32-bit");
+    picogc::compressed_ptr<K> p;
+    ok(p.get() == NULL, "null by default");
+    K* k = new K(1);
+    p = k;
+    ok(p.get() == k && p->value_ == 1, "refers to the object");
+    picogc::compressed_ptr<K> q = p;
+    ok(q.get() == k, "copied");
+    K* large = new (picogc::trailing<char>(1024 * 1024)) K(2);
+    q = large;
+    ok(q.get() == large, "refers to a large object");
+    q = NULL;
+    ok(q.get() == NULL, "null");
+  }
+
+  test_cage("malloc", picogc::config().allocator(&cage));
+  test_cage("arena", picogc::config().allocator(&cage)
+	    .arena_chunk_size(64 * 1024));
+  test_cage("concurrent", picogc::config().allocator(&cage)
+	    .concurrent_marking(true));
+}
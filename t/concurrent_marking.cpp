@@ -0,0 +1,307 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include <set>
+#include <vector>
+extern "C" {
+#include <pthread.h>
+}
+#include "picogc.h"
+#include "t/test.h"
+
+#define NUM_HOLDERS 20000
+
+struct Node;
+static std::set<Node*> live_nodes;
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<Node> next_;
+  Node() {
+    live_nodes.insert(this);
+  }
+  ~Node() {
+    live_nodes.erase(this);
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+struct Holder : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<Holder> next_;
+  picogc::member<Node> slot_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+    gc->mark(slot_);
+  }
+};
+
+// blocks the marker thread once it has traced the object, until released
+static pthread_mutex_t trap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t trap_cond = PTHREAD_COND_INITIALIZER;
+static enum { TRAP_NONE, TRAP_ARMED, TRAP_HIT, TRAP_RELEASED } trap_state;
+
+struct Trap : public Holder {
+  virtual void gc_mark(picogc::gc* gc) {
+    Holder::gc_mark(gc);
+    pthread_mutex_lock(&trap_mutex);
+    if (trap_state == TRAP_ARMED) {
+      trap_state = TRAP_HIT;
+      pthread_cond_broadcast(&trap_cond);
+      while (trap_state != TRAP_RELEASED)
+	pthread_cond_wait(&trap_cond, &trap_mutex);
+    }
+    pthread_mutex_unlock(&trap_mutex);
+  }
+};
+
+struct counting_emitter : public picogc::gc_emitter {
+  size_t num_gc_, num_mark_, num_concurrent_, num_remark_, num_remarked_;
+  counting_emitter()
+    : num_gc_(0), num_mark_(0), num_concurrent_(0), num_remark_(0),
+      num_remarked_(0) {}
+  virtual void gc_end(picogc::gc*, const picogc::gc_stats& stats) {
+    ++num_gc_;
+    num_remarked_ += stats.remarked;
+  }
+  virtual void mark_start(picogc::gc*) { ++num_mark_; }
+  // called from the marker thread; read after the remark
+  virtual void concurrent_mark_start(picogc::gc*) { ++num_concurrent_; }
+  virtual void remark_start(picogc::gc*) { ++num_remark_; }
+};
+
+// the nodes reachable from the holders, all of them should be alive
+static bool check_reachable(const std::vector<Holder*>& holders,
+			    size_t* num_reachable)
+{
+  std::set<Node*> seen;
+  for (size_t i = 0; i != holders.size(); ++i) {
+    for (Node* n = holders[i]->slot_; n != NULL; n = n->next_) {
+      if (live_nodes.find(n) == live_nodes.end())
+	return false;
+      if (! seen.insert(n).second)
+	break;
+    }
+  }
+  *num_reachable = seen.size();
+  return true;
+}
+
+static void run(const char* name, picogc::config conf)
+{
+  picogc::gc gc(conf.concurrent_marking(true).gc_interval_bytes(256 * 1024));
+  counting_emitter emitter;
+  gc.emitter(&emitter);
+  picogc::gc_scope gc_scope(&gc);
+  unsigned rnd = 1;
+  {
+    picogc::scope scope;
+    picogc::local<Holder> head;
+    std::vector<Holder*> holders;
+    {
+      picogc::scope scope;
+      for (int i = 0; i < NUM_HOLDERS; ++i) {
+	Holder* h = new Holder;
+	h->next_ = head;
+	head = h;
+	holders.push_back(h);
+      }
+    }
+    // move the references around while the heap is being marked; the
+    // nodes are allocated in scopes, and become old while marking
+    for (int i = 0; i < 200000; ++i) {
+      picogc::scope scope;
+      rnd = rnd * 1103515245 + 12345;
+      Holder* a = holders[(rnd >> 8) % NUM_HOLDERS];
+      rnd = rnd * 1103515245 + 12345;
+      Holder* b = holders[(rnd >> 8) % NUM_HOLDERS];
+      Node* n = a->slot_;
+      a->slot_ = b->slot_;
+      b->slot_ = n;
+      switch (rnd % 4) {
+      case 0:
+	n = new (picogc::MAY_TRIGGER_GC) Node;
+	n->next_ = a->slot_;
+	a->slot_ = n;
+	break;
+      case 1:
+	n = new (picogc::MAY_TRIGGER_GC | picogc::IMMEDIATELY_TRACEABLE) Node;
+	n->next_ = b->slot_;
+	b->slot_ = n;
+	break;
+      case 2:
+	if (a->slot_ != NULL)
+	  a->slot_ = a->slot_->next_;
+	break;
+      default:
+	new (picogc::MAY_TRIGGER_GC) Node; // garbage
+	break;
+      }
+    }
+    size_t num_reachable = 0;
+    ok(check_reachable(holders, &num_reachable), name);
+    is(emitter.num_mark_, (size_t)0, "  not marked in a pause");
+    ok(emitter.num_remarked_ != 0, "  remarked the updates");
+
+    // completed by trigger_gc
+    gc.trigger_gc();
+    ok(emitter.num_concurrent_ > 10, "  marked concurrently");
+    is(emitter.num_remark_, emitter.num_concurrent_, "  remark per cycle");
+    is(emitter.num_mark_, (size_t)1, "  trigger_gc marks in a pause");
+    ok(check_reachable(holders, &num_reachable), "  reachable nodes alive");
+    is(live_nodes.size(), num_reachable, "  garbage collected");
+
+    // driven by collect_for
+    for (size_t i = 0; i != holders.size(); ++i)
+      holders[i]->slot_ = NULL;
+    size_t num_concurrent = emitter.num_concurrent_;
+    ok(! gc.collect_for(picogc::gc::now() + 10), "  collect_for starts");
+    while (! gc.collect_for(picogc::gc::now() + 0.001))
+      ;
+    is(emitter.num_concurrent_, num_concurrent + 1, "  a concurrent cycle");
+    is(live_nodes.size(), (size_t)0, "  all nodes collected");
+  }
+  size_t num_gc = emitter.num_gc_;
+  {
+    // the destructor waits for the marker
+    picogc::scope scope;
+    for (int i = 0; i < 100000; ++i)
+      new (picogc::MAY_TRIGGER_GC) Node;
+  }
+  ok(emitter.num_gc_ != num_gc, "  collections run");
+}
+
+// moves a reference from an object not yet traced to the one traced
+static void test_barrier(const char* name, picogc::config conf)
+{
+  picogc::gc gc(conf.concurrent_marking(true));
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  picogc::local<Trap> head;
+  {
+    picogc::scope scope;
+    head = new Trap;
+    head->next_ = new Holder;
+    head->next_->slot_ = new Node;
+  }
+  Node* n = head->next_->slot_;
+  trap_state = TRAP_ARMED;
+  ok(! gc.collect_for(picogc::gc::now() + 10), name);
+  pthread_mutex_lock(&trap_mutex);
+  while (trap_state != TRAP_HIT)
+    pthread_cond_wait(&trap_cond, &trap_mutex);
+  head->slot_ = head->next_->slot_;
+  head->next_->slot_ = NULL;
+  trap_state = TRAP_RELEASED;
+  pthread_cond_broadcast(&trap_cond);
+  pthread_mutex_unlock(&trap_mutex);
+  while (! gc.collect_for(picogc::gc::now() + 0.001))
+    ;
+  ok(live_nodes.find(n) != live_nodes.end(), "  moved object retained");
+  head->slot_ = NULL;
+  gc.trigger_gc();
+  ok(live_nodes.find(n) == live_nodes.end(), "  collected once unreachable");
+}
+
+static void wait_trap()
+{
+  pthread_mutex_lock(&trap_mutex);
+  while (trap_state != TRAP_HIT)
+    pthread_cond_wait(&trap_cond, &trap_mutex);
+}
+
+static void release_trap()
+{
+  trap_state = TRAP_RELEASED;
+  pthread_cond_broadcast(&trap_cond);
+  pthread_mutex_unlock(&trap_mutex);
+}
+
+// the young objects are linked to the list on scope exit while the marker
+// thread traces them
+static void test_scope_exit()
+{
+  picogc::gc gc(picogc::config().concurrent_marking(true));
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  picogc::local<Trap> head;
+  {
+    picogc::scope scope;
+    head = new Trap;
+    head->next_ = new Holder;
+  }
+  trap_state = TRAP_ARMED;
+  ok(! gc.collect_for(picogc::gc::now() + 10), "scope exit while marking");
+  wait_trap();
+  Node* n;
+  {
+    picogc::scope scope;
+    n = new Node;
+    n->next_ = new Node;
+    head->next_->slot_ = n;
+    release_trap();
+  }
+  while (! gc.collect_for(picogc::gc::now() + 0.001))
+    ;
+  ok(live_nodes.find(n) != live_nodes.end()
+     && live_nodes.find(n->next_) != live_nodes.end(),
+     "  young objects retained");
+  head->next_->slot_ = NULL;
+  gc.trigger_gc();
+  is(live_nodes.size(), (size_t)0, "  collected once unreachable");
+}
+
+// the stores made within the gc_scope of another heap are logged to the
+// heap marking, which leaves the objects of the other heap alone
+static void test_nested_heaps()
+{
+  picogc::gc gc(picogc::config().concurrent_marking(true));
+  picogc::gc other;
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  picogc::local<Trap> head;
+  {
+    picogc::scope scope;
+    head = new Trap;
+    head->next_ = new Holder;
+    head->next_->slot_ = new Node;
+  }
+  Node* n = head->next_->slot_;
+  trap_state = TRAP_ARMED;
+  ok(! gc.collect_for(picogc::gc::now() + 10), "nested heaps");
+  wait_trap();
+  Node* foreign;
+  {
+    picogc::gc_scope gc_scope(&other);
+    picogc::scope scope;
+    head->slot_ = head->next_->slot_;
+    head->next_->slot_ = NULL;
+    foreign = new Node;
+    foreign->next_ = new Node;
+  }
+  release_trap();
+  while (! gc.collect_for(picogc::gc::now() + 0.001))
+    ;
+  ok(live_nodes.find(n) != live_nodes.end(), "  moved object retained");
+  ok(! foreign->next_->gc_is_marked(), "  other heap not marked");
+  head->slot_ = NULL;
+  gc.trigger_gc();
+  ok(live_nodes.find(n) == live_nodes.end(), "  collected once unreachable");
+}
+
+void test()
+{
+  plan(12 * 2 + 3 * 2 + 3 + 4);
+
+  run("malloc", picogc::config());
+  run("arena", picogc::config().arena_chunk_size(64 * 1024));
+  test_barrier("write barrier (malloc)", picogc::config());
+  test_barrier("write barrier (arena)",
+	       picogc::config().arena_chunk_size(64 * 1024));
+  test_scope_exit();
+  test_nested_heaps();
+}
@@ -0,0 +1,175 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+#define LIMIT (4 * 1024 * 1024)
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<K> next_;
+  char buf_[1000];
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+struct A : public picogc::gc_object {
+  char buf_[32];
+};
+
+// drops the cache once
+struct cache_dropper : public picogc::gc_oom_handler {
+  picogc::local<K>* cache_;
+  size_t num_called_;
+  cache_dropper() : cache_(NULL), num_called_(0) {}
+  virtual bool out_of_memory(picogc::gc*, size_t) {
+    ++num_called_;
+    if (cache_ == NULL || *cache_ == NULL)
+      return false;
+    *cache_ = NULL;
+    return true;
+  }
+};
+
+// allocates n objects linked from head, returns if succeeded
+static bool fill(picogc::local<K>& head, size_t n, int flags)
+{
+  try {
+    for (size_t i = 0; i != n; ++i) {
+      picogc::scope scope;
+      K* k = new (flags) K;
+      k->next_ = head;
+      head = k;
+    }
+  } catch (std::bad_alloc&) {
+    return false;
+  }
+  return true;
+}
+
+static void test_heap(const char* name, const picogc::config& base)
+{
+  cache_dropper dropper;
+  picogc::config conf = picogc::config(base).heap_limit_bytes(LIMIT)
+    .oom_handler(&dropper);
+  picogc::gc gc(conf);
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+
+  // garbage is collected before reaching the limit
+  for (int i = 0; i < 20000; ++i) {
+    picogc::scope scope;
+    new (picogc::MAY_TRIGGER_GC) K;
+  }
+  picogc::gc_metrics m = gc.metrics();
+  ok(m.num_limit_gc != 0, name);
+  ok(m.peak_heap_bytes <= LIMIT, "  stays within the limit");
+  is(m.num_allocation_failures, (size_t)0, "  no failures");
+  is(log.stats().by_heap_limit, m.num_limit_gc, "  reported in stats");
+
+  // live objects exceeding the limit
+  picogc::local<K> live;
+  ok(! fill(live, LIMIT / sizeof(K) * 2, picogc::MAY_TRIGGER_GC),
+     "  bad_alloc thrown");
+  is(gc.metrics().num_allocation_failures, (size_t)1, "  counted");
+  is(dropper.num_called_, (size_t)1, "  oom handler called");
+  ok(gc.metrics().heap_bytes <= LIMIT, "  heap within the limit");
+
+  // no collections are repeated near the limit
+  size_t num_gc = gc.metrics().num_gc;
+  for (int i = 0; i < 100; ++i) {
+    picogc::scope scope;
+    try {
+      new (picogc::MAY_TRIGGER_GC) K;
+    } catch (std::bad_alloc&) {
+    }
+  }
+  ok(gc.metrics().num_gc - num_gc <= 1, "  not thrashing");
+
+  // the handler drops the cache
+  picogc::local<K> cache = live;
+  live = NULL;
+  dropper.cache_ = &cache;
+  dropper.num_called_ = 0;
+  ok(fill(live, 100, picogc::MAY_TRIGGER_GC), "  cache dropped");
+  is(dropper.num_called_, (size_t)1, "  by the handler");
+  ok(cache.get() == NULL, "  cache is empty");
+
+  { // allocations not triggering GC fail without collecting
+    picogc::scope scope;
+    num_gc = gc.metrics().num_gc;
+    size_t bytes_requested = 0;
+    bool thrown = false;
+    try {
+      for (size_t i = 0; i != LIMIT / sizeof(K) * 2; ++i) {
+	bytes_requested = gc.metrics().bytes_requested;
+	new K;
+      }
+    } catch (std::bad_alloc&) {
+      thrown = true;
+    }
+    ok(thrown, "  fails without GC");
+    is(dropper.num_called_, (size_t)2, "  handler called");
+    is(gc.metrics().num_gc, num_gc, "  not collected");
+    is(gc.metrics().bytes_requested, bytes_requested,
+       "  failed allocation is not accounted");
+  }
+}
+
+// allocations fitting in the chunks already allocated do not fail
+static void test_chunks(const char* name, const picogc::config& conf,
+			int flags)
+{
+  size_t limit;
+  { // the heap after the first allocation
+    picogc::gc gc(conf);
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    new (flags) A;
+    limit = gc.metrics().heap_bytes;
+  }
+  picogc::gc gc(picogc::config(conf).heap_limit_bytes(limit));
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  size_t n = 0;
+  try {
+    for (; n != 1000000; ++n)
+      new (flags) A;
+  } catch (std::bad_alloc&) {
+  }
+  ok(n > 1, name);
+  ok(n < 1000000, "  fails on a new chunk");
+  is(gc.metrics().heap_bytes, limit, "  heap within the limit");
+}
+
+void test()
+{
+  plan(16 * 2 + 3 * 3 + 2);
+
+  test_heap("malloc", picogc::config());
+  // (the interval is beyond the limit, so that the cycles started by it
+  // would not race with the marker thread to avoid the limit)
+  test_heap("concurrent", picogc::config().concurrent_marking(true)
+	    .gc_interval_bytes(2 * LIMIT));
+
+  test_chunks("atomic chunks", picogc::config().atomic_chunks(true),
+	      picogc::IS_ATOMIC);
+  test_chunks("arena", picogc::config().arena_chunk_size(64 * 1024), 0);
+  test_chunks("movable", picogc::config(), picogc::MOVABLE);
+
+  { // no limit by default
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    picogc::local<K> live;
+    ok(fill(live, LIMIT / sizeof(K) * 2, picogc::MAY_TRIGGER_GC),
+       "no limit by default");
+    is(gc.metrics().num_limit_gc, (size_t)0, "no collection by the limit");
+  }
+}
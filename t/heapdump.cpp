@@ -0,0 +1,84 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/heapdump.h"
+#include "t/test.h"
+
+struct Leaf : public picogc::gc_object {
+  char buf_[100];
+};
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* next_;
+  Leaf* leaf_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+    gc->mark(leaf_);
+  }
+};
+
+void test()
+{
+  plan(14);
+
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+  picogc::local<Node> a, b;
+  {
+    picogc::scope scope;
+    Leaf* shared = new Leaf;
+    // a -> (9 more nodes) -> shared, b -> shared
+    a = new Node;
+    Node* n = a;
+    for (int i = 0; i < 9; ++i)
+      n = n->next_ = new Node;
+    n->leaf_ = shared;
+    b = new Node;
+    b->leaf_ = shared;
+    for (int i = 0; i < 5; ++i)
+      new Node;
+  }
+
+  FILE* fp = tmpfile();
+  ok(picogc::write_heap_dump(fp, gc), "written");
+  rewind(fp);
+  picogc::heap_dump dump;
+  ok(dump.read(fp), "read");
+  fclose(fp);
+  dump.analyze();
+
+  is(dump.num_objects(), (size_t)17, "all objects are dumped");
+  is(dump.num_roots(), (size_t)2, "roots");
+  size_t num_reachable = 0;
+  for (size_t i = 0; i != dump.num_objects(); ++i)
+    num_reachable += dump.is_reachable(i);
+  is(num_reachable, (size_t)12, "garbage is unreachable");
+
+  // find the objects
+  size_t ra = 0, rb = 1;
+  if (dump.root_index(0) < dump.root_index(1))
+    std::swap(ra, rb); // b is on top of the stack
+  is(dump.root_kind(ra), (int)picogc::gc::ROOT_LOCAL, "kind of root");
+  size_t oa = dump.root_object(ra), ob = dump.root_object(rb);
+  is(dump.num_edges(ob), (size_t)1, "b refers to the leaf");
+  size_t oleaf = dump.edge(ob, 0);
+  uint64_t node_size = dump.object_size(oa), leaf_size = dump.object_size(oleaf);
+
+  is(dump.root_retained_size(ra), node_size * 10, "retained by a");
+  is(dump.root_retained_size(rb), node_size, "retained by b");
+  is(dump.idom(dump.object_node(oleaf)), (uint32_t)0,
+     "shared object is dominated by the super root");
+  is(dump.retained_size(0), node_size * 11 + leaf_size, "total retained");
+
+  std::vector<picogc::heap_dump::type_summary> types = dump.type_summaries();
+  is(types.size(), (size_t)2, "types");
+  const picogc::heap_dump::type_summary& node_type =
+    types[dump.object_type(oa)];
+  is(node_type.name, std::string("Node"), "type name");
+  is(node_type.retained_size, node_size * 11,
+     "retained by type is not counted twice");
+}
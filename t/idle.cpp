@@ -0,0 +1,88 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct K : public picogc::gc_object {
+  bool alive_;
+  K() : alive_(true) {}
+  ~K() {
+    alive_ = false;
+    ++num_destroyed;
+  }
+};
+
+// starts a cycle with the shortest slice that the mark fits in, so that
+// the sweep stops at the deadline (unless the slice outlasts the sweep)
+static void start_cycle(picogc::gc& gc)
+{
+  size_t n = num_destroyed;
+  for (double slice = 1e-6; num_destroyed == n; slice *= 2)
+    gc.collect_for(picogc::gc::now() + slice);
+}
+
+void test()
+{
+  plan(12);
+
+  picogc::gc gc(picogc::config().gc_interval_bytes(64 * 1024 * 1024));
+  picogc::gc_scope gc_scope(&gc);
+
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 1000; ++i)
+      new K;
+  }
+  ok(gc.idle_notification(1), "nothing to do below the idle threshold");
+  is(num_destroyed, (size_t)0);
+
+  ok(gc.collect_for(HUGE_VAL), "completes without a deadline");
+  is(num_destroyed, (size_t)1000);
+
+  // sweep in steps, while allocating objects
+  num_destroyed = 0;
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 1000000; ++i)
+      new K;
+  }
+  start_cycle(gc);
+  ok(num_destroyed < 1000000, "partially swept");
+  // the deadline has passed, each call sweeps a batch
+  size_t n = num_destroyed;
+  ok(! gc.collect_for(0), "stops at the deadline");
+  ok(num_destroyed > n, "progresses");
+  {
+    picogc::scope scope;
+    picogc::local<K> k = new K;
+    new (picogc::IMMEDIATELY_TRACEABLE) K;
+    while (! gc.collect_for(0))
+      ;
+    is(num_destroyed, (size_t)1000000, "all garbage collected");
+    ok(k->alive_, "local kept");
+  }
+
+  // trigger_gc completes the cycle in progress
+  num_destroyed = 0;
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 1000000; ++i)
+      new K;
+  }
+  start_cycle(gc);
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)1000002);
+
+  // idle notification above the threshold
+  num_destroyed = 0;
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 40 * 1024 * 1024 / (int)sizeof(K); ++i)
+      new K;
+  }
+  ok(gc.idle_notification(HUGE_VAL));
+  is(num_destroyed, (size_t)(40 * 1024 * 1024 / sizeof(K)));
+}
@@ -0,0 +1,185 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+extern "C" {
+#include <stdlib.h>
+#include <unistd.h>
+}
+#include "picogc.h"
+#include "picogc/image.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* left_;
+  Node* right_;
+  picogc::gc_object* other_;
+  int value_;
+  Node() : left_(NULL), right_(NULL), other_(NULL), value_(0) {}
+  ~Node() {
+    ++num_destroyed;
+  }
+  virtual int value() const { return value_; }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(left_);
+    gc->mark(right_);
+    gc->mark(other_);
+  }
+};
+
+struct Leaf : public picogc::gc_object {
+  long value_;
+  long twice() const { return value_ * 2; }
+  virtual long get() const { return value_; }
+};
+
+struct Unregistered : public picogc::gc_object {
+};
+
+// refers through member, and holds a word equal to its address
+struct Tagged : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<Node> node_;
+  uintptr_t key_;
+  Tagged() : key_(0) {}
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(node_);
+  }
+};
+
+struct Handle : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::movable<Node> node_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(node_);
+  }
+};
+
+// reports a copy of the member
+struct Converted : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* node_;
+  Converted() : node_(NULL) {}
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(static_cast<picogc::gc_object*>(node_));
+  }
+};
+
+static bool save(const char* path, picogc::gc& gc, picogc::gc_object** roots,
+		 size_t num_roots, const picogc::image_types& types)
+{
+  FILE* fp = fopen(path, "wb");
+  bool ok = picogc::save_image(fp, gc, roots, num_roots, types);
+  fclose(fp);
+  return ok;
+}
+
+void test()
+{
+  plan(24);
+
+  char path[] = "/tmp/picogc-image-XXXXXX";
+  close(mkstemp(path));
+
+  picogc::image_types types;
+  types.add<Node>(1).add<Leaf>(2);
+  num_destroyed = 0;
+
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  {
+    picogc::scope scope;
+    picogc::local<Node> a = new Node, b = new Node;
+    a->value_ = 1;
+    b->value_ = 2;
+    a->left_ = b;
+    a->right_ = b; // shared
+    b->left_ = a;  // cycle
+    Leaf* leaf = new (picogc::IS_ATOMIC) Leaf;
+    leaf->value_ = 42;
+    b->other_ = leaf;
+    picogc::gc_object* roots[] = { a, NULL };
+    ok(save(path, gc, roots, 2, types), "saved");
+
+    b->right_ = reinterpret_cast<Node*>(new Unregistered);
+    ok(! save("/dev/null", gc, roots, 1, types), "unregistered type");
+    b->right_ = NULL;
+  }
+  gc.trigger_gc();
+  is(num_destroyed, (size_t)2, "original objects are collected");
+
+  {
+    picogc::image img;
+    ok(img.load(path, types), "loaded");
+    is(img.num_objects(), (size_t)3, "number of objects");
+    is(img.num_roots(), (size_t)2, "number of roots");
+    ok(img.root(1) == NULL, "null root");
+    Node* a = static_cast<Node*>(img.root(0));
+    ok(img.contains(a), "root is in the image");
+    is(a->value(), 1, "virtual function works");
+    ok(a->left_ == a->right_ && a->left_->left_ == a, "pointers are fixed up");
+    is(a->left_->value(), 2, "second object");
+    Leaf* leaf = static_cast<Leaf*>(a->left_->other_);
+    is(leaf->get(), 42L, "atomic object");
+    is(leaf->twice(), 84L, "non-virtual member");
+
+    // objects of the heap referred to from the image are retained
+    gc.add_roots(&img);
+    {
+      picogc::scope scope;
+      a->other_ = new Node;
+    }
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)2, "referred from the image");
+    a->other_ = NULL;
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)3, "collected once unreferred");
+    is(a->value(), 1, "image objects are not swept");
+  }
+
+  { // types should match
+    picogc::image_types other;
+    other.add<Node>(1);
+    picogc::image img;
+    ok(! img.load(path, other), "missing type");
+    ok(! img.load("/dev/null", types), "broken file");
+  }
+
+  { // only the slots reported by gc_mark are fixed up
+    picogc::image_types types2;
+    types2.add<Node>(1).add<Tagged>(3).add<Handle>(4).add<Converted>(5);
+    picogc::scope scope;
+    picogc::local<Node> n = new Node;
+    n->value_ = 5;
+    picogc::local<Tagged> t = new Tagged;
+    t->node_ = n;
+    t->key_ = reinterpret_cast<uintptr_t>(n.get());
+    picogc::gc_object* roots[] = { t };
+    ok(save(path, gc, roots, 1, types2), "saved with member");
+    picogc::image img;
+    ok(img.load(path, types2), "loaded");
+    Tagged* loaded = static_cast<Tagged*>(img.root(0));
+    ok(img.contains(loaded->node_) && loaded->node_->value() == 5,
+       "member is fixed up");
+    ok(loaded->key_ == reinterpret_cast<uintptr_t>(n.get()),
+       "word equal to a member is intact");
+
+    picogc::local<Handle> h = new Handle;
+    h->node_ = new (picogc::MOVABLE) Node;
+    roots[0] = h;
+    ok(! save("/dev/null", gc, roots, 1, types2), "movable is rejected");
+    picogc::local<Converted> c = new Converted;
+    c->node_ = n;
+    roots[0] = c;
+    ok(! save("/dev/null", gc, roots, 1, types2),
+       "member not reported by its slot is rejected");
+  }
+
+  unlink(path);
+}
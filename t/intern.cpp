@@ -0,0 +1,95 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/intern.h"
+#include "t/test.h"
+
+struct holder : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::interned_string* s_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(s_);
+  }
+};
+
+static picogc::interned_string* intern(
+  picogc::intern_table<picogc::interned_string>& table, const char* s)
+{
+  return picogc::intern(table, s, strlen(s));
+}
+
+static void run(const char* name, const picogc::config& conf)
+{
+  picogc::gc gc(conf);
+  picogc::gc_scope gc_scope(&gc);
+  picogc::intern_table<picogc::interned_string> table(gc, 16);
+  picogc::scope scope;
+  picogc::local<holder> h = new holder;
+  {
+    picogc::scope scope;
+    picogc::interned_string* a = intern(table, "abc");
+    ok(intern(table, "abc") == a, name);
+    ok(intern(table, "abd") != a, "  different strings differ");
+    ok(strcmp(a->c_str(), "abc") == 0 && a->size() == 3, "  content");
+    is(table.stats().hits, (size_t)1, "  hits");
+    h->s_ = a;
+    gc.trigger_gc();
+    ok(intern(table, "abd") != NULL, "  young objects are kept");
+    is(table.stats().dropped, (size_t)0, "  nothing dropped in scope");
+  }
+  gc.trigger_gc();
+  is(table.stats().dropped, (size_t)1, "  unreferenced entry dropped");
+  is(table.stats().entries, (size_t)1, "  referenced entry kept");
+  ok(intern(table, "abc") == h->s_, "  kept entry is found");
+
+  // grow, and shrink as they die
+  char buf[32];
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 10000; ++i) {
+      sprintf(buf, "%d", i % 5000);
+      intern(table, buf);
+    }
+    is(table.stats().entries, (size_t)5001, "  grown");
+    gc.trigger_gc();
+    bool found = true;
+    for (int i = 0; i < 5000; ++i) {
+      sprintf(buf, "%d", i);
+      size_t hits = table.stats().hits;
+      intern(table, buf);
+      found = found && table.stats().hits == hits + 1;
+    }
+    ok(found, "  all found after collection");
+  }
+  gc.trigger_gc();
+  is(table.stats().entries, (size_t)1, "  shrunk");
+  ok(intern(table, "abc") == h->s_, "  survivor found after shrinking");
+}
+
+void test()
+{
+  plan(13 * 3 + 2);
+
+  run("malloc", picogc::config());
+  run("arena", picogc::config().arena_chunk_size(64 * 1024));
+  run("atomic chunks", picogc::config().atomic_chunks(true));
+
+  { // reset drops the entries
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    picogc::intern_table<picogc::interned_string> table(gc);
+    {
+      picogc::scope scope;
+      intern(table, "x");
+    }
+    gc.reset();
+    is(table.stats().entries, (size_t)0, "reset clears the table");
+    {
+      picogc::scope scope;
+      intern(table, "x");
+    }
+    is(table.stats().entries, (size_t)1, "reinterned after reset");
+  }
+}
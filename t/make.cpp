@@ -0,0 +1,207 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "picogc.h"
+#include "t/test.h"
+
+static int num_live;
+
+struct Atomic : public picogc::gc_object {
+  int a_, b_;
+  Atomic() : a_(1), b_(2) {
+    ++num_live;
+  }
+  Atomic(int a, int b) : a_(a), b_(b) {
+    ++num_live;
+  }
+  ~Atomic() {
+    --num_live;
+  }
+};
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* next_; // raw pointer, not initialized until the body
+  int value_;
+  int gc_before_, gc_after_;
+  Node(int value, int n, bool fail) : value_(value) {
+    ++num_live;
+    // garbage is allocated before initializing next_
+    gc_before_ = picogc::gc::top()->metrics().num_gc;
+    for (int i = 0; i < n; ++i) {
+      picogc::scope scope;
+      picogc::make<Atomic>(picogc::MAY_TRIGGER_GC);
+    }
+    gc_after_ = picogc::gc::top()->metrics().num_gc;
+    if (fail) {
+      --num_live;
+      throw std::runtime_error("failed");
+    }
+    next_ = n != 0 ? picogc::make<Node>(0, -value, 0, false) : NULL;
+  }
+  ~Node() {
+    --num_live;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+// overrides gc_mark through the base class
+struct Derived : public Node {
+  Derived() : Node(0, 0, false) {}
+};
+
+// declares that the destructor does nothing
+struct Trivial : public picogc::gc_object {
+  typedef Trivial gc_trivially_destructible;
+  int n_;
+};
+
+// the destructor of the subclass does something
+struct NotTrivial : public Trivial {
+  ~NotTrivial() {
+    --num_live;
+  }
+};
+
+// the member is not set by the constructor
+struct Unset : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<Unset> linked_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+// triggers collections before setting the raw pointer, and records if
+// gc_mark is called meanwhile
+struct Constructing : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  static Constructing* constructing_;
+  static int num_marked_, num_marked_constructing_;
+  Constructing* linked_;
+  explicit Constructing(int n) {
+    constructing_ = this;
+    for (int i = 0; i < n; ++i) {
+      picogc::scope scope;
+      picogc::make<Atomic>(picogc::MAY_TRIGGER_GC);
+    }
+    linked_ = NULL;
+    constructing_ = NULL;
+  }
+protected:
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    if (this == constructing_)
+      ++num_marked_constructing_;
+    ++num_marked_;
+    gc->mark(linked_);
+  }
+};
+
+Constructing* Constructing::constructing_;
+int Constructing::num_marked_, Constructing::num_marked_constructing_;
+
+struct flags_recorder : public picogc::gc_recorder {
+  int flags_;
+  flags_recorder() : flags_(0) {}
+  virtual void allocated(picogc::gc*, picogc::gc_object*, size_t, int flags) {
+    flags_ = flags;
+  }
+};
+
+static void test_make(const char* name, const picogc::config& conf)
+{
+  num_live = 0;
+  picogc::gc gc(conf);
+  picogc::gc_scope gc_scope(&gc);
+  flags_recorder recorder;
+  gc.recorder(&recorder);
+  {
+    picogc::scope scope;
+
+    Atomic* a = picogc::make<Atomic>();
+    ok(a->a_ == 1 && a->b_ == 2, name);
+    ok((recorder.flags_ & picogc::IS_ATOMIC) != 0, "  detected as atomic");
+    a = picogc::make<Atomic>(0, 3, 4);
+    ok(a->a_ == 3 && a->b_ == 4, "  with arguments");
+
+    // the memory is dirtied before being reused for the object
+    for (int i = 0; i < 100; ++i) {
+      void* p = malloc(sizeof(Unset));
+      memset(p, 0xab, sizeof(Unset));
+      free(p);
+    }
+    Unset* u = picogc::make<Unset>();
+    ok(u->linked_ == NULL, "  member is initialized without the zero-fill");
+    gc.trigger_gc();
+
+    // over the dirtied memory as well
+    Constructing::num_marked_ = Constructing::num_marked_constructing_ = 0;
+    size_t num_gc = gc.metrics().num_gc;
+    picogc::make<Constructing>(0, 0);
+    ok((recorder.flags_ & picogc::IS_ATOMIC) == 0,
+       "  detected as traced through protected gc_mark");
+    picogc::local<Constructing> c =
+      picogc::make<Constructing>(picogc::MAY_TRIGGER_GC, 100000);
+    ok(gc.metrics().num_gc > num_gc, "  collected after construction");
+    gc.trigger_gc();
+    ok(Constructing::num_marked_ != 0 && c->linked_ == NULL,
+       "  marked after construction");
+    is(Constructing::num_marked_constructing_, 0,
+       "  not marked while being constructed");
+
+    picogc::local<Node> n = picogc::make<Node>(picogc::MAY_TRIGGER_GC, 1,
+					       100000, false);
+    ok((recorder.flags_ & picogc::IS_ATOMIC) == 0, "  detected as traced");
+    ok(n->gc_after_ == n->gc_before_, "  not collected during construction");
+    ok(gc.metrics().num_gc > (size_t)n->gc_after_, "  collected after");
+    ok(n->value_ == 1 && n->next_->value_ == -1, "  constructed");
+    picogc::make<Derived>();
+    ok((recorder.flags_ & picogc::IS_ATOMIC) == 0,
+       "  detected as traced through the base");
+    picogc::make<Trivial>();
+    ok((recorder.flags_ & picogc::TRIVIALLY_DESTRUCTIBLE) != 0,
+       "  detected as trivially destructible");
+    ++num_live;
+    picogc::make<NotTrivial>();
+    ok((recorder.flags_ & picogc::TRIVIALLY_DESTRUCTIBLE) == 0,
+       "  not inherited by the subclass");
+
+    // the object is collected if the constructor fails
+    gc.trigger_gc();
+    int num_before = num_live;
+    bool thrown = false;
+    try {
+      picogc::make<Node>(picogc::MAY_TRIGGER_GC, 2, 100000, true);
+    } catch (std::runtime_error&) {
+      thrown = true;
+    }
+    ok(thrown, "  exception passed through");
+    num_gc = gc.metrics().num_gc;
+    for (int i = 0; i < 100000; ++i) {
+      picogc::scope scope;
+      picogc::make<Atomic>(picogc::MAY_TRIGGER_GC);
+    }
+    ok(gc.metrics().num_gc > num_gc, "  collected after the failure");
+    gc.trigger_gc();
+    is(num_live, num_before, "  failed object is not destroyed as T");
+  }
+  gc.trigger_gc();
+  is(num_live, 0, "  all collected");
+}
+
+void test()
+{
+  plan(19 * 2);
+
+  test_make("malloc", picogc::config().gc_interval_bytes(64 * 1024));
+  test_make("concurrent", picogc::config().concurrent_marking(true)
+	    .gc_interval_bytes(64 * 1024));
+}
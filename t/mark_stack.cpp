@@ -0,0 +1,76 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* children_[8];
+  ~Node() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    for (size_t i = 0; i != sizeof(children_) / sizeof(children_[0]); ++i)
+      gc->mark(children_[i]);
+  }
+};
+
+// builds a tree of given depth, and returns the number of nodes
+static size_t build(Node* parent, int depth)
+{
+  if (depth == 0)
+    return 0;
+  size_t n = 0;
+  for (size_t i = 0; i != 8; ++i) {
+    parent->children_[i] = new Node;
+    n += 1 + build(parent->children_[i], depth - 1);
+  }
+  return n;
+}
+
+static void run(const char* name, size_t mark_stack_size, bool overflow)
+{
+  picogc::gc gc(picogc::config().mark_stack_size(mark_stack_size));
+  picogc::gc_log_emitter log(NULL);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  num_destroyed = 0;
+  size_t num_nodes;
+  {
+    picogc::scope scope;
+    picogc::local<Node> root = new Node;
+    picogc::local<Node> list;
+    {
+      picogc::scope scope;
+      num_nodes = build(root, 4);
+      // a long list, as well as some garbage
+      for (int i = 0; i < 1000; ++i) {
+	Node* n = new Node;
+	n->children_[0] = list;
+	list = n;
+	new Node;
+      }
+    }
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1000, name);
+    is(log.stats().not_collected, num_nodes + 1001, "  live objects retained");
+    ok((log.stats().mark_stack_overflows != 0) == overflow,
+       overflow ? "  overflowed" : "  not overflowed");
+  }
+  gc.trigger_gc();
+  is(num_destroyed, num_nodes + 2001, "  all collected once unreachable");
+}
+
+void test()
+{
+  plan(12);
+
+  run("large mark stack", 16384, false);
+  run("small mark stack", 4, true);
+  run("zero-sized mark stack", 0, true);
+}
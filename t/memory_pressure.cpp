@@ -0,0 +1,56 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+struct K : public picogc::gc_object {
+  char buf_[1000];
+};
+
+static size_t run(const picogc::config& conf, picogc::gc_log_emitter& log)
+{
+  picogc::gc gc(conf);
+  gc.emitter(&log);
+  picogc::gc_scope gc_scope(&gc);
+  for (int i = 0; i < 10000; ++i) {
+    picogc::scope scope;
+    new (picogc::MAY_TRIGGER_GC) K;
+  }
+  return gc.metrics().num_pressure_gc;
+}
+
+void test()
+{
+  plan(7);
+
+  size_t usage, limit;
+  ok(picogc::gc::read_memory_usage(usage, limit, 1), "read rss");
+  ok(usage != 0, "rss is non-zero");
+  is(limit, (size_t)1, "limit is the given one");
+
+  picogc::config conf;
+  conf.gc_interval_bytes(1024 * 1024 * 1024)
+    .memory_check_interval_bytes(64 * 1024);
+
+  {
+    picogc::gc_log_emitter log(NULL);
+    is(run(conf, log), (size_t)0, "no pressure gc by default");
+  }
+
+  { // usage exceeds the limit; collect at every check
+    picogc::gc_log_emitter log(NULL);
+    size_t n = run(picogc::config(conf).memory_pressure_ratio(0.5)
+		   .memory_limit_bytes(usage / 2), log);
+    ok(n > 10000 * sizeof(K) / (64 * 1024) / 2, "collected under pressure");
+    is(log.stats().by_memory_pressure, n, "reported in stats");
+  }
+
+  { // far below the limit
+    picogc::gc_log_emitter log(NULL);
+    is(run(picogc::config(conf).memory_pressure_ratio(0.5)
+	   .memory_limit_bytes((size_t)1 << 50), log),
+       (size_t)0, "no pressure gc below the ratio");
+  }
+}
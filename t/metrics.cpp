@@ -0,0 +1,122 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  K* linked_;
+  char buf_[40];
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+// allocates n objects of which the first `alive` ones are linked from the
+// returned object
+static K* alloc(int n, int alive, int flags = 0)
+{
+  K* head = NULL;
+  for (int i = 0; i < n; ++i) {
+    K* k = new (flags) K;
+    if (i < alive) {
+      k->linked_ = head;
+      head = k;
+    }
+  }
+  return head;
+}
+
+static void test_heap(const char* name, const picogc::config& conf,
+		      int flags, int num_alive)
+{
+  picogc::gc gc(conf);
+  picogc::gc_scope gc_scope(&gc);
+  size_t per_object;
+  {
+    picogc::scope scope;
+    picogc::local<K> alive;
+    {
+      picogc::scope scope;
+      alive = alloc(100, num_alive, flags);
+    }
+    picogc::gc_metrics m = gc.metrics();
+    is(m.bytes_requested, sizeof(K) * 100, name);
+    per_object = m.bytes_allocated / 100;
+    is(m.bytes_allocated, per_object * 100, "  objects are of same size");
+    ok(per_object >= sizeof(K), "  size includes the rounding");
+    is(m.object_bytes, m.bytes_allocated, "  nothing freed");
+    ok(m.heap_bytes >= m.object_bytes, "  heap holds the objects");
+    is(m.overhead_bytes, m.heap_bytes - m.object_bytes, "  overhead");
+    gc.trigger_gc();
+    m = gc.metrics();
+    is(m.num_gc, (size_t)1, "  num_gc");
+    is(m.live_bytes, per_object * num_alive, "  live bytes");
+    is(m.bytes_freed, per_object * (100 - num_alive), "  freed bytes");
+    is(m.object_bytes, per_object * num_alive, "  object bytes");
+    ok(m.peak_heap_bytes >= m.heap_bytes, "  peak");
+    ok(m.pause_time > 0, "  pause time");
+  }
+  gc.trigger_gc();
+  picogc::gc_metrics m = gc.metrics();
+  is(m.object_bytes, (size_t)0, "  all freed");
+  gc.reset();
+  is(gc.metrics().object_bytes, (size_t)0, "  nothing left after reset");
+}
+
+void test()
+{
+  plan(14 * 3 + 6);
+
+  test_heap("malloc", picogc::config(), 0, 10);
+  test_heap("arena", picogc::config().arena_chunk_size(4096), 0, 10);
+  // atomic objects do not keep the linked ones alive
+  test_heap("atomic chunks", picogc::config().atomic_chunks(true),
+	    picogc::IS_ATOMIC, 1);
+
+  { // transfer moves the bytes
+    picogc::gc gc, target;
+    picogc::gc_scope gc_scope(&gc);
+    K* root;
+    {
+      picogc::scope scope;
+      root = alloc(10, 5);
+    }
+    size_t before = gc.metrics().object_bytes;
+    ok(gc.transfer(root, target), "transferred");
+    is(gc.metrics().object_bytes + target.metrics().object_bytes, before,
+       "bytes are moved");
+    is(target.metrics().object_bytes, target.metrics().heap_bytes,
+       "target heap holds the objects");
+  }
+
+  { // prometheus
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    {
+      picogc::scope scope;
+      alloc(10, 0);
+    }
+    gc.trigger_gc();
+    FILE* fp = tmpfile();
+    picogc::write_prometheus_metrics(fp, gc.metrics());
+    rewind(fp);
+    char buf[256];
+    size_t num_lines = 0;
+    bool found_type = false, found_value = false;
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+      ++num_lines;
+      if (strcmp(buf, "# TYPE picogc_collections_total counter\n") == 0)
+	found_type = true;
+      if (strcmp(buf, "picogc_collections_total 1\n") == 0)
+	found_value = true;
+    }
+    fclose(fp);
+    is(num_lines, (size_t)39, "prometheus: 3 lines per metric");
+    ok(found_type, "prometheus: type");
+    ok(found_value, "prometheus: value");
+  }
+}
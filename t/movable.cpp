@@ -0,0 +1,171 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+#define NUM_NODES 20000
+
+static int num_nodes;
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::movable<Node> next_;
+  int value_;
+  Node(int value) : value_(value) {
+    ++num_nodes;
+  }
+  ~Node() {
+    --num_nodes;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+struct Holder : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::movable<Node> nodes_[NUM_NODES];
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    for (size_t i = 0; i != NUM_NODES; ++i)
+      gc->mark(nodes_[i]);
+  }
+};
+
+struct compaction_emitter : public picogc::gc_emitter {
+  size_t num_compactions_;
+  picogc::gc_compaction last_;
+  compaction_emitter() : num_compactions_(0), last_() {}
+  virtual void compact_end(picogc::gc*, const picogc::gc_compaction& r) {
+    ++num_compactions_;
+    last_ = r;
+  }
+};
+
+struct move_recorder : public picogc::gc_recorder {
+  size_t num_moved_;
+  move_recorder() : num_moved_(0) {}
+  virtual void moved(picogc::gc*, picogc::gc_object* from,
+		     picogc::gc_object* to) {
+    ++num_moved_;
+  }
+};
+
+struct object_counter : public picogc::gc_visitor {
+  size_t num_;
+  object_counter() : num_(0) {}
+  virtual void visit(picogc::gc_object*) {}
+  virtual void visit_object(picogc::gc_object*, size_t) { ++num_; }
+};
+
+// the values of the nodes held, which are chained by next_ in pairs
+static bool check_nodes(Holder* h, int step)
+{
+  for (int i = 0; i < NUM_NODES; i += step) {
+    Node* n = h->nodes_[i];
+    if (n == NULL || n->value_ != i || n->next_ == NULL
+	|| n->next_->value_ != -i)
+      return false;
+  }
+  return true;
+}
+
+static void test_compaction(const char* name, picogc::config conf)
+{
+  num_nodes = 0;
+  picogc::gc gc(conf);
+  compaction_emitter emitter;
+  gc.emitter(&emitter);
+  move_recorder recorder;
+  gc.recorder(&recorder);
+  picogc::gc_scope gc_scope(&gc);
+  {
+    picogc::scope scope;
+    picogc::local<Holder> holder = new Holder;
+    picogc::local<Node> pinned;
+    {
+      picogc::scope scope;
+      for (int i = 0; i < NUM_NODES; ++i) {
+	Node* n = new (picogc::MOVABLE) Node(i);
+	n->next_ = new (picogc::MOVABLE) Node(-i);
+	holder->nodes_[i] = n;
+      }
+    }
+    pinned = holder->nodes_[1];
+    Node* pinned_addr = pinned;
+    gc.trigger_gc();
+    is(num_nodes, NUM_NODES * 2, name);
+    is(emitter.num_compactions_, (size_t)0, "  not fragmented");
+
+    // drop 3 pairs out of 4
+    for (int i = 0; i < NUM_NODES; ++i)
+      if (i % 4 != 0 && i != 1)
+	holder->nodes_[i] = NULL;
+    size_t heap_bytes = gc.metrics().heap_bytes;
+    gc.trigger_gc();
+    is(num_nodes, (NUM_NODES / 4 + 1) * 2, "  dead nodes destroyed");
+    is(emitter.num_compactions_, (size_t)1, "  compacted");
+    ok(emitter.last_.objects_moved != 0, "  objects moved");
+    is(recorder.num_moved_, emitter.last_.objects_moved, "  moves recorded");
+    ok(emitter.last_.chunks_released != 0, "  chunks released");
+    ok(emitter.last_.fragmentation_before > 0.5, "  fragmented before");
+    ok(emitter.last_.fragmentation_after
+       < emitter.last_.fragmentation_before, "  less fragmented after");
+    ok(gc.metrics().heap_bytes < heap_bytes, "  heap shrunk");
+    ok(check_nodes(holder, 4), "  reachable through the handles");
+    ok(pinned.get() == pinned_addr && pinned->value_ == 1,
+       "  object on the stack is not moved");
+    object_counter counter;
+    gc.visit_heap(&counter);
+    is(counter.num_, (size_t)(NUM_NODES / 4 + 1) * 2 + 1, "  visit_heap");
+
+    // compacted again after more are dropped, the nodes are kept intact
+    for (int i = 0; i < NUM_NODES; i += 8)
+      holder->nodes_[i] = NULL;
+    gc.trigger_gc();
+    is(num_nodes, (NUM_NODES / 8 + 1) * 2, "  collected again");
+    bool intact = true;
+    for (int i = 4; i < NUM_NODES; i += 8)
+      intact = intact && holder->nodes_[i]->value_ == i
+	&& holder->nodes_[i]->next_->value_ == -i;
+    ok(intact, "  nodes intact");
+  }
+  gc.trigger_gc();
+  is(num_nodes, 0, "  all collected");
+  {
+    picogc::scope scope;
+    for (int i = 0; i < 1000; ++i)
+      new (picogc::MOVABLE) Node(i);
+  }
+  gc.reset();
+  is(num_nodes, 0, "  destroyed by reset");
+}
+
+void test()
+{
+  plan(17 * 3 + 2);
+
+  test_compaction("malloc", picogc::config());
+  test_compaction("arena", picogc::config().arena_chunk_size(64 * 1024));
+  test_compaction("concurrent",
+		  picogc::config().concurrent_marking(true)
+		  .gc_interval_bytes(64 * 1024));
+
+  { // disabled
+    picogc::gc gc(picogc::config().compaction_threshold(0));
+    compaction_emitter emitter;
+    gc.emitter(&emitter);
+    picogc::gc_scope gc_scope(&gc);
+    {
+      picogc::scope scope;
+      for (int i = 0; i < NUM_NODES; ++i)
+	new (picogc::MOVABLE) Node(i);
+    }
+    gc.trigger_gc();
+    is(num_nodes, 0, "disabled: collected");
+    is(emitter.num_compactions_, (size_t)0, "disabled: not compacted");
+  }
+}
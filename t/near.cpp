@@ -0,0 +1,133 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* next_;
+  int value_;
+  ~Node() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+// number of links of the list that are not adjacent in memory
+static size_t num_jumps(Node* n)
+{
+  size_t jumps = 0;
+  for (; n->next_ != NULL; n = n->next_) {
+    if (reinterpret_cast<char*>(n->next_) - reinterpret_cast<char*>(n) != 48)
+      jumps++;
+  }
+  return jumps;
+}
+
+static size_t length(Node* n)
+{
+  size_t len = 0;
+  for (int expected = 0; n != NULL; n = n->next_, ++expected, ++len) {
+    if (n->value_ != expected)
+      return 0;
+  }
+  return len;
+}
+
+void test()
+{
+  plan(13);
+
+  { // arena
+    picogc::gc gc(picogc::config().arena_chunk_size(64 * 1024));
+    picogc::gc_scope gc_scope(&gc);
+    num_destroyed = 0;
+    picogc::scope scope;
+    picogc::local<Node> plain, hinted;
+    {
+      picogc::scope scope;
+      Node* ptail = plain = new Node;
+      Node* htail = hinted = new Node;
+      for (int i = 1; i < 1000; ++i) {
+	ptail = ptail->next_ = new Node;
+	ptail->value_ = i;
+	new Node; // garbage
+	htail = htail->next_ = new (picogc::near(htail)) Node;
+	htail->value_ = i;
+	new Node; // garbage
+      }
+    }
+    ok(num_jumps(plain) == 999, "arena: unhinted nodes are scattered");
+    ok(num_jumps(hinted) < 20, "arena: hinted nodes are packed");
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1998, "arena: garbage collected");
+    is(length(plain), (size_t)1000, "arena: unhinted list intact");
+    is(length(hinted), (size_t)1000, "arena: hinted list intact");
+    is(gc.metrics().object_bytes, (size_t)2000 * 48, "arena: accounted");
+
+    // cluster
+    picogc::local<Node> clustered;
+    {
+      picogc::scope scope;
+      picogc::cluster c;
+      Node* tail = clustered = new (picogc::near(c)) Node;
+      for (int i = 1; i < 1000; ++i) {
+	new Node; // garbage
+	tail = tail->next_ = new (picogc::near(c)) Node;
+	tail->value_ = i;
+      }
+    }
+    ok(num_jumps(clustered) < 20, "cluster: packed");
+    is(length(clustered), (size_t)1000, "cluster: intact");
+    gc.trigger_gc();
+    is(length(clustered), (size_t)1000, "cluster: intact after collection");
+  }
+
+  { // the hints are ignored unless the arena is used
+    picogc::gc gc;
+    picogc::gc_scope gc_scope(&gc);
+    num_destroyed = 0;
+    {
+      picogc::scope scope;
+      picogc::local<Node> head = new Node;
+      picogc::cluster c;
+      Node* tail = head;
+      for (int i = 1; i < 1000; ++i) {
+	tail = tail->next_ = new (picogc::near(tail), picogc::MAY_TRIGGER_GC)
+	  Node;
+	tail->value_ = i;
+	new (picogc::near(c)) Node;
+      }
+      gc.trigger_gc();
+      is(length(head), (size_t)1000, "malloc: intact");
+    }
+    gc.trigger_gc();
+    is(num_destroyed, (size_t)1999, "malloc: collected");
+  }
+
+  { // clusters are forgotten by reset
+    picogc::gc gc(picogc::config().arena_chunk_size(64 * 1024));
+    picogc::gc_scope gc_scope(&gc);
+    Node* n;
+    {
+      picogc::scope scope;
+      n = new Node;
+      new (picogc::near(n)) Node;
+    }
+    gc.reset();
+    {
+      picogc::scope scope;
+      picogc::local<Node> m = new Node;
+      m->next_ = new (picogc::near(n)) Node;
+      m->next_->value_ = 1;
+      is(length(m), (size_t)2, "reset: allocated after reset");
+    }
+    is(gc.metrics().object_bytes, (size_t)2 * 48, "reset: accounted");
+  }
+}
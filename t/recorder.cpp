@@ -0,0 +1,132 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include <vector>
+#include "picogc.h"
+#include "picogc/recorder.h"
+#include "t/test.h"
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  K* linked_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+struct counts {
+  size_t allocs, frees, opens, closes, gcs, collected, atomic, big;
+  std::vector<bool> freed;
+  bool ok;
+  counts() : allocs(0), frees(0), opens(0), closes(0), gcs(0), collected(0),
+	     atomic(0), big(0), freed(), ok(true) {}
+  void read(FILE* fp) {
+    rewind(fp);
+    picogc::recording_reader reader(fp);
+    ok = reader.start();
+    picogc::recorded_event e;
+    while (reader.next(e)) {
+      switch (e.type) {
+      case picogc::RECORD_ALLOC:
+	ok = ok && e.object == allocs;
+	allocs++;
+	atomic += (e.flags & picogc::IS_ATOMIC) != 0;
+	big += e.size == 1000;
+	freed.push_back(false);
+	break;
+      case picogc::RECORD_FREE:
+	ok = ok && e.object < freed.size() && ! freed[e.object];
+	if (e.object < freed.size())
+	  freed[e.object] = true;
+	frees++;
+	break;
+      case picogc::RECORD_SCOPE_OPEN:
+	opens++;
+	break;
+      case picogc::RECORD_SCOPE_CLOSE:
+	closes++;
+	break;
+      case picogc::RECORD_GC:
+	gcs++;
+	collected += e.collected;
+	ok = ok && e.duration >= 0 && e.live_bytes <= e.heap_bytes;
+	break;
+      }
+    }
+  }
+};
+
+static void run(const char* name, const picogc::config& conf)
+{
+  FILE* fp = tmpfile();
+  {
+    picogc::gc gc(conf);
+    picogc::gc_scope gc_scope(&gc);
+    picogc::trace_recorder recorder(fp);
+    gc.recorder(&recorder);
+    {
+      picogc::scope scope;
+      picogc::local<K> head;
+      for (int i = 0; i < 100; ++i) {
+	picogc::scope scope;
+	K* k = new K;
+	if (i % 10 == 0) {
+	  k->linked_ = head;
+	  head = k;
+	}
+	new (picogc::IS_ATOMIC) K;
+	new (picogc::trailing<char>(1000 - sizeof(K))) K;
+      }
+      gc.trigger_gc();
+    }
+    gc.trigger_gc();
+    gc.recorder(NULL);
+  }
+  counts c;
+  c.read(fp);
+  fclose(fp);
+  ok(c.ok, name);
+  is(c.allocs, (size_t)300, "  allocations");
+  is(c.atomic, (size_t)100, "  flags");
+  is(c.big, (size_t)100, "  sizes");
+  is(c.opens, (size_t)101, "  scopes opened");
+  is(c.closes, (size_t)101, "  scopes closed");
+  is(c.gcs, (size_t)2, "  collections");
+  is(c.frees, (size_t)300, "  frees");
+  is(c.collected, (size_t)300, "  collected");
+}
+
+void test()
+{
+  plan(9 * 3 + 3);
+
+  run("malloc", picogc::config());
+  run("arena", picogc::config().arena_chunk_size(64 * 1024));
+  run("atomic chunks", picogc::config().atomic_chunks(true));
+
+  { // memory reused without being freed (by reset) counts as freed
+    FILE* fp = tmpfile();
+    {
+      picogc::gc gc(picogc::config().arena_chunk_size(64 * 1024));
+      picogc::gc_scope gc_scope(&gc);
+      picogc::trace_recorder recorder(fp);
+      gc.recorder(&recorder);
+      for (int i = 0; i < 2; ++i) {
+	{
+	  picogc::scope scope;
+	  for (int j = 0; j < 10; ++j)
+	    new (picogc::TRIVIALLY_DESTRUCTIBLE) K;
+	}
+	gc.reset();
+      }
+      gc.recorder(NULL);
+    }
+    counts c;
+    c.read(fp);
+    fclose(fp);
+    ok(c.ok, "reset");
+    is(c.allocs, (size_t)20, "  allocations");
+    is(c.frees, (size_t)10, "  reused memory reported as freed");
+  }
+}
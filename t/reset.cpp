@@ -0,0 +1,103 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/util.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::gc_object* linked_;
+  ~K() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(linked_);
+  }
+};
+
+// the destructor does nothing
+struct Plain : public picogc::gc_object {
+  typedef Plain gc_trivially_destructible;
+  int n_;
+};
+
+struct Big : public picogc::gc_object {
+  typedef Big gc_trivially_destructible;
+  char buf_[8192];
+};
+
+static void* run_request(picogc::gc* gc, int n)
+{
+  picogc::gc_scope gc_scope(gc);
+  picogc::scope scope;
+  void* first = new K;
+  for (int i = 1; i < n; ++i) {
+    if (i % 2 == 0) {
+      new K;
+    } else {
+      new (picogc::TRIVIALLY_DESTRUCTIBLE) Plain;
+    }
+  }
+  new (picogc::IMMEDIATELY_TRACEABLE | picogc::TRIVIALLY_DESTRUCTIBLE) Big;
+  return first;
+}
+
+void test()
+{
+  plan(10);
+
+  { // without arena
+    picogc::gc gc;
+    picogc::gc_log_emitter log(NULL);
+    gc.emitter(&log);
+    run_request(&gc, 100);
+    gc.reset();
+    is(num_destroyed, (size_t)50, "dtors of non-trivial objects are called");
+    num_destroyed = 0;
+    {
+      picogc::gc_scope gc_scope(&gc);
+      picogc::scope scope;
+      picogc::local<K> k = new K;
+      k->linked_ = new (picogc::TRIVIALLY_DESTRUCTIBLE) Plain;
+      gc.trigger_gc();
+      is(num_destroyed, (size_t)0, "reusable after reset");
+    }
+    gc.trigger_gc();
+    is(log.stats().collected, (size_t)2, "trivial objects are collected");
+    is(num_destroyed, (size_t)1, "  without calling the dtors");
+  }
+
+  { // with arena
+    num_destroyed = 0;
+    picogc::gc gc(picogc::config().arena_chunk_size(4096));
+    void* first = run_request(&gc, 1000);
+    {
+      picogc::gc_scope gc_scope(&gc);
+      gc.trigger_gc();
+    }
+    is(num_destroyed, (size_t)500);
+    num_destroyed = 0;
+    void* first2 = run_request(&gc, 1000);
+    ok(first != first2, "memory not reused before reset");
+    gc.reset();
+    is(num_destroyed, (size_t)500);
+    num_destroyed = 0;
+    void* first3 = run_request(&gc, 1000);
+    ok(first == first3 || first2 == first3, "chunks are recycled");
+    gc.reset();
+    is(num_destroyed, (size_t)500);
+  }
+
+  { // pool
+    picogc::gc_pool pool(picogc::config().arena_chunk_size(4096), 1);
+    picogc::gc* gc = pool.acquire();
+    run_request(gc, 10);
+    pool.release(gc);
+    ok(pool.acquire() == gc, "gc is reused");
+    pool.release(gc);
+  }
+}
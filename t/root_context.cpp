@@ -0,0 +1,173 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "t/test.h"
+
+static int num_live;
+
+struct K : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<K> next_;
+  int value_;
+  K(int value) : value_(value) {
+    ++num_live;
+  }
+  ~K() {
+    --num_live;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+// a coroutine suspended between the steps, building a chain of objects in
+// the scope kept open in its frame
+struct coro {
+  picogc::root_context ctx_;
+  picogc::scope* scope_;
+  picogc::local<K>* head_;
+  coro(int flags) : ctx_(), scope_(NULL), head_(NULL) {
+    ctx_.attach();
+    scope_ = new picogc::scope;
+    head_ = new picogc::local<K>;
+    new (flags) K(-1); // young object not referred to by a local
+    ctx_.detach();
+  }
+  ~coro() {
+    ctx_.attach();
+    delete head_;
+    delete scope_;
+    ctx_.detach();
+  }
+  void step(int value, int flags) {
+    ctx_.attach();
+    {
+      picogc::scope scope;
+      K* k = new (flags) K(value);
+      k->next_ = *head_;
+      *head_ = k;
+    }
+    ctx_.detach();
+  }
+  // the chain is intact
+  bool check(int n) {
+    K* k = *head_;
+    for (int i = n - 1; i >= 0; --i, k = k->next_)
+      if (k == NULL || k->value_ != i)
+	return false;
+    return k == NULL;
+  }
+};
+
+struct root_counter : public picogc::gc_visitor {
+  size_t num_;
+  root_counter() : num_(0) {}
+  virtual void visit(picogc::gc_object*) { ++num_; }
+};
+
+struct compaction_emitter : public picogc::gc_emitter {
+  size_t num_compactions_;
+  compaction_emitter() : num_compactions_(0) {}
+  virtual void compact_end(picogc::gc*, const picogc::gc_compaction&) {
+    ++num_compactions_;
+  }
+};
+
+#define NUM_CORO 3
+#define NUM_STEPS 10000
+
+static void test_contexts(const char* name, const picogc::config& conf)
+{
+  num_live = 0;
+  picogc::gc gc(conf);
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+
+  coro* coros[NUM_CORO];
+  for (int i = 0; i != NUM_CORO; ++i)
+    coros[i] = new coro(picogc::MAY_TRIGGER_GC);
+  for (int n = 0; n != NUM_STEPS; ++n)
+    for (int i = 0; i != NUM_CORO; ++i)
+      coros[i]->step(n, picogc::MAY_TRIGGER_GC);
+  ok(gc.metrics().num_gc != 0, name);
+  bool intact = true;
+  for (int i = 0; i != NUM_CORO; ++i)
+    intact = intact && coros[i]->check(NUM_STEPS);
+  ok(intact, "  chains intact after switching");
+  gc.trigger_gc();
+  is(num_live, NUM_CORO * (NUM_STEPS + 1), "  detached roots kept");
+
+  root_counter counter;
+  gc.visit_roots(&counter);
+  ok(counter.num_ >= NUM_CORO, "  visit_roots covers the contexts");
+
+  // nested switch, objects of the outer context are kept
+  coros[0]->ctx_.attach();
+  coros[1]->step(NUM_STEPS, 0);
+  picogc::local<K> k = new K(0);
+  gc.trigger_gc();
+  ok(k->value_ == 0 && coros[1]->check(NUM_STEPS + 1), "  nested switch");
+  coros[0]->ctx_.detach();
+
+  { // transfer clears the locals of a detached context as well
+    picogc::gc other;
+    ok(gc.transfer(coros[2]->head_->get(), other)
+       && coros[2]->head_->get() == NULL,
+       "  transfer clears a detached local");
+  }
+
+  // the objects are collected once the frame is gone
+  delete coros[1];
+  gc.trigger_gc();
+  is(num_live, (NUM_CORO - 1) * (NUM_STEPS + 1) + 1 - NUM_STEPS,
+     "  collected after the scope is closed");
+  delete coros[0];
+  delete coros[2];
+  gc.trigger_gc();
+  is(num_live, 0, "  all collected");
+}
+
+void test()
+{
+  plan(8 * 2 + 3);
+
+  test_contexts("malloc",
+		picogc::config().gc_interval_bytes(64 * 1024));
+  test_contexts("concurrent",
+		picogc::config().concurrent_marking(true)
+		.gc_interval_bytes(64 * 1024));
+
+  { // objects on the stack of a detached context are not moved
+    picogc::gc gc;
+    compaction_emitter emitter;
+    gc.emitter(&emitter);
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    picogc::root_context ctx;
+    ctx.attach();
+    picogc::scope* ctx_scope = new picogc::scope;
+    picogc::local<K>* pinned = new picogc::local<K>;
+    {
+      picogc::scope scope;
+      for (int i = 0; i < 10000; ++i) {
+	K* k = new (picogc::MOVABLE) K(i);
+	if (i == 5000)
+	  *pinned = k;
+      }
+    }
+    K* pinned_addr = *pinned;
+    ctx.detach();
+    gc.trigger_gc();
+    is(emitter.num_compactions_, (size_t)1, "compacted");
+    ok(pinned_addr == pinned->get() && pinned_addr->value_ == 5000,
+       "  object of a detached context is pinned");
+    ctx.attach();
+    delete pinned;
+    delete ctx_scope;
+    ctx.detach();
+    gc.trigger_gc();
+    is(num_live, 0, "  collected after the scope is closed");
+  }
+}
@@ -0,0 +1,192 @@
+#! /usr/bin/C
+#option -cWall -p -cg -crdynamic
+
+#include <set>
+#include "picogc.h"
+#include "picogc/profiler.h"
+#include "t/test.h"
+
+struct K : public picogc::gc_object {
+  char buf_[100];
+};
+
+struct sampler : public picogc::gc_sampler {
+  std::set<picogc::gc_object*> sampled_;
+  size_t collected_;
+  sampler() : collected_(0) {}
+  virtual size_t next_interval(picogc::gc*) {
+    return sizeof(K) * 10;
+  }
+  virtual void sample(picogc::gc*, picogc::gc_object* obj, size_t) {
+    sampled_.insert(obj);
+  }
+  virtual void mark_end(picogc::gc*) {
+    for (std::set<picogc::gc_object*>::iterator i = sampled_.begin();
+	 i != sampled_.end(); ) {
+      if ((*i)->gc_is_marked()) {
+	++i;
+      } else {
+	++collected_;
+	sampled_.erase(i++);
+      }
+    }
+  }
+};
+
+#define NUM_MOVABLE 20000
+
+struct Holder : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::movable<K> ks_[NUM_MOVABLE];
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    for (size_t i = 0; i != NUM_MOVABLE; ++i)
+      gc->mark(ks_[i]);
+  }
+};
+
+// exposes the objects being sampled
+struct sample_profiler : public picogc::alloc_profiler {
+  sample_profiler() : alloc_profiler(sizeof(K) * 10) {}
+  size_t num_sampled() const { return sampled_.size(); }
+  bool is_sampled(picogc::gc_object* obj) const {
+    return sampled_.find(obj) != sampled_.end();
+  }
+};
+
+struct compaction_emitter : public picogc::gc_emitter {
+  size_t num_compactions_;
+  compaction_emitter() : num_compactions_(0) {}
+  virtual void compact_end(picogc::gc*, const picogc::gc_compaction&) {
+    ++num_compactions_;
+  }
+};
+
+static size_t live_samples(const picogc::alloc_profiler& prof)
+{
+  size_t live = 0;
+  for (std::map<picogc::alloc_profiler::callstack,
+	 picogc::alloc_profiler::site>::const_iterator i = prof.sites().begin();
+       i != prof.sites().end();
+       ++i)
+    live += i->second.live;
+  return live;
+}
+
+K* alloc_k()
+{
+  return new K;
+}
+
+void test()
+{
+  plan(15);
+
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+
+  { // fixed interval
+    sampler s;
+    gc.sampler(&s);
+    {
+      picogc::scope scope;
+      for (int i = 0; i < 1000; ++i)
+	new K;
+      is(s.sampled_.size(), (size_t)100, "every 10th object is sampled");
+      gc.trigger_gc();
+      is(s.collected_, (size_t)0, "objects in scope survive");
+    }
+    gc.trigger_gc();
+    ok(s.sampled_.empty(), "collected objects are reported");
+    is(s.collected_, (size_t)100);
+    gc.sampler(NULL);
+  }
+
+  { // poisson sampling with call-site attribution
+    picogc::alloc_profiler prof(1024);
+    gc.sampler(&prof);
+    {
+      picogc::scope scope;
+      for (int i = 0; i < 10000; ++i)
+	alloc_k();
+      gc.trigger_gc();
+    }
+    gc.trigger_gc();
+    gc.sampler(NULL);
+    size_t samples = 0, live = 0;
+    double bytes = 0;
+    for (std::map<picogc::alloc_profiler::callstack,
+	   picogc::alloc_profiler::site>::const_iterator i
+	   = prof.sites().begin();
+	 i != prof.sites().end();
+	 ++i) {
+      samples += i->second.samples;
+      live += i->second.live;
+      bytes += i->second.bytes;
+    }
+    ok(samples != 0, "sampled");
+    is(live, (size_t)0, "no live samples");
+    ok(bytes > 10000 * sizeof(K) * 0.8 && bytes < 10000 * sizeof(K) * 1.2,
+       "estimated bytes are close to the actual");
+  }
+
+  { // samples of the movable objects follow the compaction
+    picogc::gc gc;
+    compaction_emitter emitter;
+    gc.emitter(&emitter);
+    picogc::gc_scope gc_scope(&gc);
+    sample_profiler prof;
+    gc.sampler(&prof);
+    {
+      picogc::scope scope;
+      picogc::local<Holder> holder = new Holder;
+      {
+	picogc::scope scope;
+	for (int i = 0; i < NUM_MOVABLE; ++i)
+	  holder->ks_[i] = new (picogc::MOVABLE) K;
+      }
+      gc.trigger_gc();
+      for (int i = 0; i < NUM_MOVABLE; ++i)
+	if (i % 4 != 0)
+	  holder->ks_[i] = NULL;
+      gc.trigger_gc();
+      is(emitter.num_compactions_, (size_t)1, "compacted");
+      size_t n = prof.is_sampled(holder);
+      for (int i = 0; i < NUM_MOVABLE; i += 4)
+	n += prof.is_sampled(holder->ks_[i]);
+      ok(n > 1, "  movable objects sampled");
+      is(prof.num_sampled(), n, "  samples follow the moved objects");
+    }
+    gc.trigger_gc();
+    gc.sampler(NULL);
+    is(prof.num_sampled(), (size_t)0, "  collected after the compaction");
+  }
+
+  { // the samples of the objects freed without being collected
+    sample_profiler prof;
+    {
+      picogc::gc gc;
+      gc.sampler(&prof);
+      picogc::gc_scope gc_scope(&gc);
+      {
+	picogc::scope scope;
+	for (int i = 0; i < 1000; ++i)
+	  new K;
+      }
+      ok(live_samples(prof) != 0, "sampled before reset");
+      gc.reset();
+      is(live_samples(prof), (size_t)0, "  none live after reset");
+      {
+	picogc::scope scope;
+	for (int i = 0; i < 1000; ++i)
+	  new K;
+      }
+    }
+    is(live_samples(prof), (size_t)0, "  none live after the heap is gone");
+    // an address reused by an object freed without being reported
+    K k;
+    prof.sample(NULL, &k, sizeof(K));
+    prof.sample(NULL, &k, sizeof(K));
+    is(live_samples(prof), (size_t)1, "  address reused");
+  }
+}
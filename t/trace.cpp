@@ -0,0 +1,123 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include <string>
+#include "picogc.h"
+#include "picogc/trace.h"
+#include "t/test.h"
+
+struct K : public picogc::gc_object {
+};
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::member<Node> next_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(next_);
+  }
+};
+
+static size_t count(const std::string& s, const std::string& needle)
+{
+  size_t n = 0;
+  for (size_t pos = 0; (pos = s.find(needle, pos)) != std::string::npos;
+       pos += needle.size())
+    ++n;
+  return n;
+}
+
+static std::string flush(picogc::trace_emitter& emitter, bool finish = false)
+{
+  FILE* fp = tmpfile();
+  if (finish)
+    emitter.finish(fp);
+  else
+    emitter.flush(fp);
+  rewind(fp);
+  std::string s;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) != 0)
+    s.append(buf, n);
+  fclose(fp);
+  return s;
+}
+
+// the begins and ends of the concurrent marking (C) and the remark (R), in
+// the order recorded
+static std::string mark_phases(const std::string& s)
+{
+  std::string phases;
+  for (size_t pos = 0;
+       (pos = s.find("{\"name\":\"", pos)) != std::string::npos; ) {
+    pos += 9;
+    std::string name = s.substr(pos, s.find('"', pos) - pos);
+    if (name == "concurrent_mark" || name == "remark") {
+      phases += name == "remark" ? 'R' : 'C';
+      phases += s[s.find("\"ph\":\"", pos) + 6];
+    }
+  }
+  return phases;
+}
+
+void test()
+{
+  plan(13);
+
+  picogc::trace_emitter emitter, small_emitter(16);
+  picogc::gc gc;
+  picogc::gc_scope gc_scope(&gc);
+  picogc::scope scope;
+
+  {
+    gc.emitter(&emitter);
+    new K;
+    gc.trigger_gc();
+    gc.trigger_gc();
+    std::string s = flush(emitter, true);
+    is(s.substr(0, 2), std::string("[\n"), "array is opened");
+    is(s.substr(s.size() - 3), std::string("\n]\n"), "array is closed");
+    is(count(s, "\"ph\":\"B\""), (size_t)10, "begin events");
+    is(count(s, "\"ph\":\"E\""), (size_t)10, "end events");
+    is(count(s, "\"name\":\"setup_new\""), (size_t)4, "setup_new");
+    is(count(s, "\"name\":\"setup_local\""), (size_t)4, "setup_local");
+    is(count(s, "\"name\":\"mark\""), (size_t)4, "mark");
+    is(count(s, "\"not_collected\":1,"), (size_t)2, "stats");
+  }
+
+  { // collections not fitting in the buffer are dropped as a whole
+    gc.emitter(&small_emitter);
+    gc.trigger_gc();
+    gc.trigger_gc();
+    is(small_emitter.num_dropped(), (size_t)1, "dropped");
+    std::string s = flush(small_emitter);
+    is(count(s, "\"ph\":\"B\""), (size_t)5, "only the first is recorded");
+    gc.trigger_gc();
+    s = flush(small_emitter);
+    is(count(s, "\"ph\":\"B\""), (size_t)5, "recorded after flush");
+    is(s.substr(0, 2), std::string(",\n"), "continues the array");
+  }
+
+  { // the remark finishing the cycle begins after the marker thread ends
+    picogc::trace_emitter emitter;
+    picogc::gc gc(picogc::config().concurrent_marking(true));
+    gc.emitter(&emitter);
+    picogc::gc_scope gc_scope(&gc);
+    picogc::scope scope;
+    picogc::local<Node> head;
+    for (int i = 0; i < 100000; ++i) {
+      Node* n = new Node;
+      n->next_ = head;
+      head = n;
+    }
+    std::string expected;
+    for (int i = 0; i < 20; ++i) {
+      gc.collect_for(HUGE_VAL); // starts the marker thread
+      gc.trigger_gc();
+      expected += "CBCERBRE";
+    }
+    is(mark_phases(flush(emitter, true)), expected,
+       "concurrent mark and remark nested");
+  }
+}
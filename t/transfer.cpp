@@ -0,0 +1,242 @@
+#! /usr/bin/C
+#option -cWall -p -cg
+
+#include "picogc.h"
+#include "picogc/allocator.h"
+#include "t/test.h"
+
+static size_t num_destroyed = 0;
+
+struct Node : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  Node* left_;
+  Node* right_;
+  ~Node() {
+    ++num_destroyed;
+  }
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(left_);
+    gc->mark(right_);
+  }
+};
+
+struct Holder : public picogc::gc_object {
+  typedef picogc::gc_object super;
+  picogc::gc_object* atomic_;
+  picogc::movable<Node> movable_;
+  virtual void gc_mark(picogc::gc* gc) {
+    super::gc_mark(gc);
+    gc->mark(atomic_);
+    gc->mark(movable_);
+  }
+};
+
+struct Leaf : public picogc::gc_object {
+  int value_;
+};
+
+struct node_roots : public picogc::gc_roots {
+  Node* node_;
+  node_roots(Node* node) : node_(node) {}
+  virtual void gc_mark_roots(picogc::gc* gc) {
+    gc->mark(node_);
+  }
+};
+
+struct transfer_sampler : public picogc::gc_sampler {
+  size_t num_transferred_;
+  picogc::gc* from_;
+  picogc::gc* to_;
+  transfer_sampler() : num_transferred_(0), from_(NULL), to_(NULL) {}
+  virtual size_t next_interval(picogc::gc*) {
+    return SIZE_MAX;
+  }
+  virtual void transferred(picogc::gc* from, picogc::gc_object*,
+			   picogc::gc* to) {
+    ++num_transferred_;
+    from_ = from;
+    to_ = to;
+  }
+};
+
+struct transfer_recorder : public picogc::gc_recorder {
+  size_t num_allocated_, num_freed_;
+  int flags_;
+  transfer_recorder() : num_allocated_(0), num_freed_(0), flags_(0) {}
+  virtual void allocated(picogc::gc*, picogc::gc_object*, size_t,
+			 int flags) {
+    ++num_allocated_;
+    flags_ = flags;
+  }
+  virtual void freed(picogc::gc*, picogc::gc_object*) {
+    ++num_freed_;
+  }
+};
+
+static Node* build(int depth)
+{
+  picogc::scope scope;
+  picogc::local<Node> n = new Node;
+  if (depth != 0) {
+    n->left_ = build(depth - 1);
+    n->right_ = build(depth - 1);
+  }
+  return scope.close(n.get());
+}
+
+// the object survives in src after the transfer is refused
+static void test_refused(picogc::gc& src, picogc::gc& dst, Node* root,
+			 const char* name)
+{
+  num_destroyed = 0;
+  ok(! src.transfer(root, dst), name);
+  src.trigger_gc();
+  is(num_destroyed, (size_t)0, "  left in the source heap");
+}
+
+void test()
+{
+  plan(31);
+
+  picogc::gc src, dst;
+  Node* root;
+
+  {
+    picogc::gc_scope gc_scope(&src);
+    picogc::scope scope;
+    picogc::local<Node> other = new Node;
+    {
+      picogc::scope scope;
+      picogc::local<Node> tree = build(9); // 1023 nodes
+      root = tree;
+      other->left_ = root->right_;
+      ok(! src.transfer(root, dst),
+	 "refused while another object refers to it");
+      ok(tree.get() == root, "  local is kept");
+      other->left_ = NULL;
+      ok(src.transfer(root, dst), "transferred");
+      ok(tree.get() == NULL, "  local is cleared");
+    }
+    src.trigger_gc();
+    is(num_destroyed, (size_t)0, "not collected by the source heap");
+  }
+  src.trigger_gc();
+  is(num_destroyed, (size_t)1);
+
+  num_destroyed = 0;
+  {
+    picogc::gc_scope gc_scope(&dst);
+    picogc::scope scope;
+    picogc::local<Node> tree = root;
+    dst.trigger_gc();
+    is(num_destroyed, (size_t)0, "owned by the target heap");
+
+    // transfer back an object in scope
+    picogc::local<Node> n = new Node;
+    n->left_ = tree->left_;
+    tree->left_ = NULL;
+    ok(dst.transfer(n, src), "young objects can be transferred");
+    ok(n.get() == NULL, "  local is cleared");
+    dst.trigger_gc();
+    is(num_destroyed, (size_t)0);
+  }
+  dst.trigger_gc();
+  is(num_destroyed, (size_t)512);
+  {
+    picogc::gc_scope gc_scope(&src);
+    src.trigger_gc();
+  }
+  is(num_destroyed, (size_t)1024);
+
+  // the samplers and the recorders of both heaps are notified
+  {
+    transfer_sampler src_sampler, dst_sampler;
+    transfer_recorder src_recorder, dst_recorder;
+    src.sampler(&src_sampler);
+    dst.sampler(&dst_sampler);
+    src.recorder(&src_recorder);
+    dst.recorder(&dst_recorder);
+    {
+      picogc::gc_scope gc_scope(&src);
+      picogc::scope scope;
+      ok(src.transfer(build(2), dst), "transferred with the hooks");
+    }
+    is(src_sampler.num_transferred_, (size_t)7, "  source sampler");
+    is(dst_sampler.num_transferred_, (size_t)7, "  target sampler");
+    ok(dst_sampler.from_ == &src && dst_sampler.to_ == &dst,
+       "  with the heaps");
+    is(src_recorder.num_freed_, (size_t)7, "  freed from the source");
+    is(dst_recorder.num_allocated_, (size_t)7, "  allocated in the target");
+    is(dst_recorder.flags_, (int)picogc::IMMEDIATELY_TRACEABLE,
+       "  as traceable");
+    src.sampler(NULL);
+    dst.sampler(NULL);
+    src.recorder(NULL);
+    dst.recorder(NULL);
+    picogc::gc_scope gc_scope(&dst);
+    dst.trigger_gc();
+  }
+
+  // refused while registered as a root
+  {
+    picogc::gc_scope gc_scope(&src);
+    picogc::scope scope;
+    node_roots roots(new Node);
+    src.add_roots(&roots);
+    test_refused(src, dst, roots.node_,
+		 "refused while gc_roots refer to it");
+    src.remove_roots(&roots);
+  }
+  {
+    picogc::gc_scope gc_scope(&src);
+    src.trigger_gc();
+  }
+
+  // refused if the target heap would exceed the limit
+  {
+    picogc::gc small(picogc::config().heap_limit_bytes(1024));
+    picogc::gc_scope gc_scope(&src);
+    picogc::scope scope;
+    picogc::local<Node> tree = build(6);
+    test_refused(src, small, tree,
+		 "refused beyond the limit of the target");
+    ok(tree.get() != NULL, "  local is kept");
+  }
+  {
+    picogc::gc_scope gc_scope(&src);
+    src.trigger_gc();
+  }
+
+  // refused for the objects in the chunks
+  {
+    picogc::gc chunked(picogc::config().atomic_chunks(true));
+    picogc::gc_scope gc_scope(&chunked);
+    picogc::scope scope;
+    picogc::local<Holder> holder = new Holder;
+    holder->atomic_ = new (picogc::IS_ATOMIC) Leaf;
+    ok(! chunked.transfer(holder, dst), "refused for an atomic chunk");
+    holder->atomic_ = NULL;
+    holder->movable_ = new (picogc::MOVABLE) Node;
+    ok(! chunked.transfer(holder, dst), "refused for a movable object");
+    holder->movable_ = NULL;
+    ok(chunked.transfer(holder, dst), "  transferred without them");
+    picogc::gc_scope dst_scope(&dst);
+    dst.trigger_gc();
+  }
+  {
+    picogc::gc arena(picogc::config().arena_chunk_size(65536));
+    picogc::gc_scope gc_scope(&arena);
+    picogc::scope scope;
+    test_refused(arena, dst, new Node, "refused for an arena");
+  }
+
+  // refused between the heaps using different allocators
+  {
+    picogc::freelist_allocator freelist;
+    picogc::gc other(picogc::config().allocator(&freelist));
+    picogc::gc_scope gc_scope(&src);
+    picogc::scope scope;
+    test_refused(src, other, new Node, "refused for another allocator");
+  }
+}
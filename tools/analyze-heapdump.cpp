@@ -0,0 +1,113 @@
+#! /usr/bin/C
+#option -cWall -p -cO2
+
+// usage: analyze-heapdump.cpp dump-file [num-top-entries]
+// reports the objects, the types and the roots retaining the most bytes
+
+#include "picogc.h"
+#include "picogc/heapdump.h"
+
+static const char* root_kind_name(int kind)
+{
+  switch (kind) {
+  case picogc::gc::ROOT_NEW:
+    return "new";
+  case picogc::gc::ROOT_LOCAL:
+    return "local";
+  default:
+    return "external";
+  }
+}
+
+template <typename T> struct by_value_desc {
+  bool operator()(const std::pair<uint64_t, T>& x,
+		  const std::pair<uint64_t, T>& y) const {
+    return x.first > y.first;
+  }
+};
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s dump-file [num-top-entries]\n", argv[0]);
+    return 1;
+  }
+  size_t num_top = argc >= 3 ? atoi(argv[2]) : 20;
+  FILE* fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+  picogc::heap_dump dump;
+  if (! dump.read(fp)) {
+    fprintf(stderr, "%s: broken heap dump\n", argv[1]);
+    return 1;
+  }
+  fclose(fp);
+  dump.analyze();
+
+  uint64_t total = 0, garbage = 0;
+  size_t num_garbage = 0;
+  for (size_t i = 0; i != dump.num_objects(); ++i) {
+    total += dump.object_size(i);
+    if (! dump.is_reachable(i)) {
+      garbage += dump.object_size(i);
+      num_garbage++;
+    }
+  }
+  printf("objects: %zu (%llu bytes), unreachable: %zu (%llu bytes)\n",
+	 dump.num_objects(), (unsigned long long)total, num_garbage,
+	 (unsigned long long)garbage);
+
+  { // roots
+    std::vector<std::pair<uint64_t, size_t> > roots;
+    for (size_t i = 0; i != dump.num_roots(); ++i)
+      roots.push_back(std::make_pair(dump.root_retained_size(i), i));
+    std::sort(roots.begin(), roots.end(), by_value_desc<size_t>());
+    printf("\n%-16s %-10s %-12s %s\n", "retained", "kind", "index", "type");
+    for (size_t i = 0; i != roots.size() && i != num_top; ++i) {
+      size_t r = roots[i].second;
+      printf("%-16llu %-10s %-12zu %s\n", (unsigned long long)roots[i].first,
+	     root_kind_name(dump.root_kind(r)), dump.root_index(r),
+	     dump.type_name(dump.object_type(dump.root_object(r))).c_str());
+    }
+  }
+
+  { // types
+    std::vector<picogc::heap_dump::type_summary> types =
+      dump.type_summaries();
+    std::vector<std::pair<uint64_t, size_t> > order;
+    for (size_t i = 0; i != types.size(); ++i)
+      order.push_back(std::make_pair(types[i].retained_size, i));
+    std::sort(order.begin(), order.end(), by_value_desc<size_t>());
+    printf("\n%-16s %-16s %-10s %s\n", "retained", "shallow", "count",
+	   "type");
+    for (size_t i = 0; i != order.size() && i != num_top; ++i) {
+      const picogc::heap_dump::type_summary& t = types[order[i].second];
+      printf("%-16llu %-16llu %-10zu %s\n",
+	     (unsigned long long)t.retained_size,
+	     (unsigned long long)t.shallow_size, t.count, t.name.c_str());
+    }
+  }
+
+  { // objects
+    std::vector<std::pair<uint64_t, size_t> > objects;
+    for (size_t i = 0; i != dump.num_objects(); ++i)
+      if (dump.is_reachable(i))
+	objects.push_back(std::make_pair(dump.object_retained_size(i), i));
+    size_t n = std::min(num_top, objects.size());
+    std::partial_sort(objects.begin(), objects.begin() + n, objects.end(),
+		      by_value_desc<size_t>());
+    printf("\n%-16s %-16s %-10s %s\n", "retained", "shallow", "object",
+	   "type");
+    for (size_t i = 0; i != n; ++i) {
+      size_t o = objects[i].second;
+      printf("%-16llu %-16llu %-10zu %s\n",
+	     (unsigned long long)objects[i].first,
+	     (unsigned long long)dump.object_size(o), o,
+	     dump.type_name(dump.object_type(o)).c_str());
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,223 @@
+#! /usr/bin/C
+#option -cWall -p -cO2
+
+// usage: replay-trace.cpp trace-file [config...]
+// replays the allocations recorded by picogc::trace_recorder against the
+// heap configured by each argument (comma-separated list of interval=N,
+// arena=N, mark-stack=N, atomic-chunks and batched-sweep; sizes may have a
+// K, M or G suffix), and reports the collections.  the objects are kept
+// alive until the recorded collection that freed them, so the lifetimes
+// are as precise as the collections run while recording.
+//
+// the edges between the objects are not recorded: every object is replayed
+// as an object of the same size without members (held by a root), and is
+// destroyed without running a destructor of its type.  Hence the costs
+// that depend on the shape of the graph or on the types (tracing the
+// members, the overflows of the mark stack, the batches of the batched
+// sweep, and the difference between atomic and traced objects other than
+// where they are allocated) are not reproduced; the comparisons of those
+// configurations reflect the allocation and the sweep only.
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "picogc.h"
+#include "picogc/recorder.h"
+
+struct replay_object : public picogc::gc_object {
+};
+
+// the objects alive according to the trace
+class replay_roots : public picogc::gc_roots {
+  std::vector<std::pair<picogc::gc_object*, size_t> > objects_;
+  std::vector<size_t> slots_; // indexed by the object number
+public:
+  void add(size_t id, picogc::gc_object* obj) {
+    if (slots_.size() <= id)
+      slots_.resize(id + 1, SIZE_MAX);
+    slots_[id] = objects_.size();
+    objects_.push_back(std::make_pair(obj, id));
+  }
+  void remove(size_t id) {
+    if (id >= slots_.size() || slots_[id] == SIZE_MAX)
+      return;
+    // fill the hole with the last one
+    size_t slot = slots_[id];
+    objects_[slot] = objects_.back();
+    slots_[objects_[slot].second] = slot;
+    objects_.pop_back();
+    slots_[id] = SIZE_MAX;
+  }
+  virtual void gc_mark_roots(picogc::gc* gc) {
+    for (size_t i = 0; i != objects_.size(); ++i)
+      gc->mark(objects_[i].first);
+  }
+};
+
+struct outcome : public picogc::gc_recorder {
+  size_t num_gc;
+  double total_pause;
+  double max_pause;
+  size_t peak_heap;
+  double start_;
+  outcome() : num_gc(0), total_pause(0), max_pause(0), peak_heap(0),
+	      start_(0) {}
+  void add(double pause, size_t heap) {
+    num_gc++;
+    total_pause += pause;
+    max_pause = std::max(max_pause, pause);
+    peak_heap = std::max(peak_heap, heap);
+  }
+  virtual void collection_started(picogc::gc*) {
+    start_ = picogc::gc::now();
+  }
+  virtual void collection_ended(picogc::gc* gc, const picogc::gc_stats&) {
+    add(picogc::gc::now() - start_, gc->metrics().heap_bytes);
+  }
+};
+
+static void print(const char* name, const outcome& o, size_t peak_heap)
+{
+  printf("%-40s %8zu %12.6f %12.6f %14zu\n", name, o.num_gc,
+	 o.total_pause, o.max_pause, peak_heap);
+}
+
+static size_t parse_size(const char* s)
+{
+  char* end;
+  double v = strtod(s, &end);
+  switch (*end) {
+  case 'K': case 'k': v *= 1024; break;
+  case 'M': case 'm': v *= 1024 * 1024; break;
+  case 'G': case 'g': v *= 1024 * 1024 * 1024; break;
+  }
+  return (size_t)v;
+}
+
+static bool parse_config(const char* arg, picogc::config& conf)
+{
+  std::string s(arg);
+  for (size_t pos = 0; pos < s.size(); ) {
+    size_t comma = s.find(',', pos);
+    if (comma == std::string::npos)
+      comma = s.size();
+    std::string item = s.substr(pos, comma - pos);
+    size_t eq = item.find('=');
+    std::string key = item.substr(0, eq);
+    const char* value = eq != std::string::npos ? item.c_str() + eq + 1 : "";
+    if (key == "interval") {
+      conf.gc_interval_bytes(parse_size(value));
+    } else if (key == "arena") {
+      conf.arena_chunk_size(parse_size(value));
+    } else if (key == "mark-stack") {
+      conf.mark_stack_size(parse_size(value));
+    } else if (key == "atomic-chunks") {
+      conf.atomic_chunks(true);
+    } else if (key == "batched-sweep") {
+      conf.batched_sweep(true);
+    } else {
+      return false;
+    }
+    pos = comma + 1;
+  }
+  return true;
+}
+
+static bool replay(FILE* fp, const picogc::config& conf, const char* name)
+{
+  rewind(fp);
+  picogc::recording_reader reader(fp);
+  if (! reader.start())
+    return false;
+  picogc::gc gc(conf);
+  picogc::gc_scope gc_scope(&gc);
+  outcome o;
+  gc.recorder(&o);
+  replay_roots roots;
+  gc.add_roots(&roots);
+  std::vector<picogc::scope*> scopes;
+  scopes.push_back(new picogc::scope);
+  picogc::recorded_event e;
+  while (reader.next(e)) {
+    switch (e.type) {
+    case picogc::RECORD_ALLOC: {
+      size_t extra = e.size > sizeof(replay_object)
+	? e.size - sizeof(replay_object) : 0;
+      int flags = e.flags & (picogc::IS_ATOMIC | picogc::MAY_TRIGGER_GC
+			     | picogc::TRIVIALLY_DESTRUCTIBLE
+			     | picogc::IMMEDIATELY_TRACEABLE);
+      roots.add(e.object,
+		new (picogc::trailing<char>(extra), flags) replay_object);
+    } break;
+    case picogc::RECORD_FREE:
+      roots.remove(e.object);
+      break;
+    case picogc::RECORD_SCOPE_OPEN:
+      scopes.push_back(new picogc::scope);
+      break;
+    case picogc::RECORD_SCOPE_CLOSE:
+      if (scopes.size() > 1) {
+	delete scopes.back();
+	scopes.pop_back();
+      }
+      break;
+    }
+  }
+  while (! scopes.empty()) {
+    delete scopes.back();
+    scopes.pop_back();
+  }
+  gc.remove_roots(&roots);
+  gc.recorder(NULL);
+  print(name, o, gc.metrics().peak_heap_bytes);
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s trace-file [config...]\n", argv[0]);
+    return 1;
+  }
+  FILE* fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  printf("%-40s %8s %12s %12s %14s\n", "config", "num_gc", "pause", "max_pause",
+	 "peak_heap");
+  { // as recorded
+    picogc::recording_reader reader(fp);
+    if (! reader.start()) {
+      fprintf(stderr, "%s: not a trace\n", argv[1]);
+      return 1;
+    }
+    outcome o;
+    picogc::recorded_event e;
+    while (reader.next(e))
+      if (e.type == picogc::RECORD_GC)
+	o.add(e.duration, e.heap_bytes);
+    print("(recorded)", o, o.peak_heap);
+  }
+
+  std::vector<const char*> configs(argv + 2, argv + argc);
+  if (configs.empty()) {
+    static const char* defaults[] = {
+      "interval=1M", "interval=4M", "interval=8M", "interval=32M",
+      "interval=8M,arena=1M", "interval=8M,atomic-chunks"
+    };
+    configs.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+  }
+  for (size_t i = 0; i != configs.size(); ++i) {
+    picogc::config conf;
+    if (! parse_config(configs[i], conf)) {
+      fprintf(stderr, "invalid config: %s\n", configs[i]);
+      return 1;
+    }
+    replay(fp, conf, configs[i]);
+  }
+
+  fclose(fp);
+  return 0;
+}